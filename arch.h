@@ -12,6 +12,7 @@
 
 
 // dword size depending on platform
+#ifndef u32
 #if __x86_64__
   #define u32 unsigned int
   #define s32 int
@@ -19,6 +20,7 @@
   #define u32 unsigned long
   #define s32 long
 #endif
+#endif
 
 
 // Apple Mac OS X
@@ -10,36 +10,54 @@
  *
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE // for pthread_setaffinity_np()
+#endif
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
 #include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
 #include "audio.h"
+#include "audioout.h"
 #include "buffermm.h"
 #include "constants.h"
+#include "dotfile.h"
+#include "engine.h"
 #include "modules.h"
 #include "pattern.h"
+#include "rtlog.h"
 #include "sequencer.h"
 #include "synthesizer.h"
 
-ALCdevice *dev;
-ALCcontext *ctx;
-ALuint buffers[3];
-ALuint source;
-ALenum format;
+// backend the streams are played through
+static audioout_backend *audio_out=&audioout_openal;
+static int audio_fillsong(short *buffer, long frames);
+static int audio_fillaudition(short *buffer, long frames);
+
+// the audition stream plays the synth being edited with short buffers
+int audition_blocklen=AUDITION_BLOCKLEN;
+static unsigned long audition_frame=0;
+
+// keypress to sound latency of the audition path in milliseconds
+static struct timespec audition_trigtime;
+static volatile int audition_trigged=0;
+static int audition_report=0;
+static volatile int audition_measured=0;
+static float audition_latency, audition_latencysum;
+static int audition_latencycount;
      
 unsigned long playpos;
 int audiomode=AUDIOMODE_COMPOSING; 
 int oldtick=-1;
-int audio_spinlock=0;
-int restarts=0;
 unsigned int audiomode_flags=0;
 
-
-int voicepatch[MAX_CHANNELS];
-
 short *render_buffer;
 int render_state;
-int render_oldtick;
 int render_type;
 
 // lengths and positions in 16-bit stereo samples
@@ -68,12 +86,6 @@ extern u32 pattlen[MAX_PATTERN];
 extern int cpatt;
 extern u32 pattdata[MAX_PATTERN][MAX_PATTLENGTH];
 
-// from modules.c
-extern float pitch[MAX_SYNTH];
-extern int accent[MAX_SYNTH];
-extern int gate[MAX_SYNTH];
-extern int restart[MAX_SYNTH];
-
 // from patch.c
 extern int cpatch[MAX_SYNTH]; // selected patch for each synth
 extern float modvalue[MAX_SYNTH][MAX_PATCHES][MAX_MODULES];
@@ -91,37 +103,379 @@ extern int seq_synth[MAX_CHANNELS];
 extern int seq_restart[MAX_CHANNELS];
 extern int seq_mute[MAX_CHANNELS];
 
-// module instance data - module index is its mod structure index number, NOT signal stack position
-float modulator[MAX_CHANNELS][MAX_MODULES];  // currently modulator value
-float output[MAX_CHANNELS][MAX_MODULES];     // output "voltage" from each module
-float localdata[MAX_CHANNELS][MAX_MODULES][16];  // 16 dwords of local data for each module
+/*
+  the audio threads never read the editor's song arrays. after an edit
+  the ui thread copies them to a new snapshot and publishes it with an
+  atomic pointer swap, and the audio threads pick up the latest one at
+  the start of each block. the snapshot a thread is rendering from is
+  advertised in audio_inuse[] so that the ui thread knows which of the
+  replaced snapshots it can free.
+
+  each thread renders with an engine of its own. the render thread plays
+  the song with audio_engine and the playback thread the composing voice
+  with audition_engine, and only the owning thread points its engine at
+  a new snapshot or collects the engine's module buffers. notes and
+  resets from the ui reach the composing voice through a request queue.
+*/
+typedef struct audio_snapshot {
+  ksong song;
+  int seqch;
+  int seqsonglen;
+  int bpm;
+
+  // selections on the ui for the composing voice
+  int synth;
+  int patch;
+  int pattern;
+
+  // edit counters. songversion is bumped by sequencer and pattern edits,
+  // patchversion by patch edits and graphversion by synth graph edits
+  unsigned int songversion;
+  unsigned int patchversion;
+  unsigned int graphversion;
+
+  struct audio_snapshot *next; // on the list of replaced snapshots
+} audio_snapshot;
+
+static audio_snapshot *audio_current=NULL; // latest published
+static audio_snapshot *audio_inuse[AUDIO_THREADS];
+static audio_snapshot *audio_retired=NULL; // ui thread only
+
+// snapshots the engine pointers lead to, each only changed by the
+// thread owning the engine
+static audio_snapshot *audio_enginesnap=NULL;
+static audio_snapshot *audition_enginesnap=NULL;
+
+// edit counters on the ui side, copied to each snapshot
+static unsigned int audio_songversion=0, audio_patchversion=0, audio_graphversion=0;
+static volatile int audio_dirty=1;
+
+// what the audio threads last acted on
+static unsigned int audio_compiledversion;
+static unsigned int audio_loadedversion, audio_loadedgraph;
+static int audio_loadedsynth=-1, audio_loadedpatch=-1;
+
+// the song is rendered by the render thread
+kengine audio_engine={
+  .noiseseed=0x67452301,
+  .profile=1
+};
+
+// the composing voice is played by the playback thread
+kengine audition_engine={
+  .noiseseed=0x67452301
+};
+
+// requests from the ui thread to the composing voice. the ui thread only
+// writes audition_reqtail and the playback thread only audition_reqhead
+#define AUDITION_LOADPATCH	0
+#define AUDITION_NOTE		1
+#define AUDITION_NOTEOFF	2
+#define AUDITION_RESET		3
+#define AUDITION_PANIC		4
+
+typedef struct {
+  int type;
+  int voice;
+  int synth;
+  int value; // note or patch
+} audition_request;
+
+static audition_request audition_requests[AUDITION_REQUESTS];
+static unsigned int audition_reqhead, audition_reqtail;
+
+// parameter changes recorded during a render run
+typedef struct {
+  int start;
+  int measures;
+  int len;
+  kparam list[AUDIO_EDITLOG];
+} audio_editlog;
+static int audio_recordedits=0;
+static audio_editlog *audio_recording=NULL; // audio threads only
+static audio_editlog *audio_recorded=NULL; // handed to the ui thread for saving
 
 // audio peak values
 float audio_peak, audio_latest_peak;
 
-// macros for typecasting the localdata void ptr
-#define mod_fdata(v,m)  ((float*)localdata[v][m])
-#define mod_fpdata(v,m) ((float**)localdata[v][m])
-#define mod_ldata(v,m)  ((u32*)localdata[v][m])
-#define mod_lpdata(v,m) ((u32**)localdata[v][m])
-#define mod_ddata(v,m)  ((double*)localdata[v][m])
+// quality governor for live playback. degraded is set when the
+// current render run used less than full quality
+static int audio_governor=0, audio_degraded=0, audio_govhold=0, audio_govgood=0;
+
+// thread settings from the config
+static int audio_priority=0, audio_policy=SCHED_FIFO, audio_cpu=-1, audio_mlock=0;
+
+// written by the audio threads, read by the ui
+static volatile audio_stats audio_st={ .aheadmin=-1 };
+
+
+// copy the song to a new snapshot and make it the current one. the
+// replaced snapshots are freed once no audio thread is using them
+void audio_publish(void)
+{
+  audio_snapshot *s, *old, **r;
+  int t, used;
+
+  s=malloc(sizeof(audio_snapshot));
+  if (!s) return;
+  memcpy(s->song.mod, mod, sizeof(s->song.mod));
+  memcpy(s->song.signalfifo, signalfifo, sizeof(s->song.signalfifo));
+  memcpy(s->song.modvalue, modvalue, sizeof(s->song.modvalue));
+  memcpy(s->song.pattdata, pattdata, sizeof(s->song.pattdata));
+  memcpy(s->song.pattlen, pattlen, sizeof(s->song.pattlen));
+  memcpy(s->song.seq_pattern, seq_pattern, sizeof(s->song.seq_pattern));
+  memcpy(s->song.seq_repeat, seq_repeat, sizeof(s->song.seq_repeat));
+  memcpy(s->song.seq_transpose, seq_transpose, sizeof(s->song.seq_transpose));
+  memcpy(s->song.seq_patch, seq_patch, sizeof(s->song.seq_patch));
+  memcpy(s->song.seq_synth, seq_synth, sizeof(s->song.seq_synth));
+  memcpy(s->song.seq_restart, seq_restart, sizeof(s->song.seq_restart));
+  memcpy(s->song.seq_mute, seq_mute, sizeof(s->song.seq_mute));
+  s->seqch=seqch;
+  s->seqsonglen=seqsonglen;
+  s->bpm=bpm;
+  s->synth=csynth;
+  s->patch=cpatch[csynth];
+  s->pattern=cpatt;
+  s->songversion=audio_songversion;
+  s->patchversion=audio_patchversion;
+  s->graphversion=audio_graphversion;
+  audio_dirty=0;
+
+  old=__atomic_exchange_n(&audio_current, s, __ATOMIC_SEQ_CST);
+  if (old) { old->next=audio_retired; audio_retired=old; }
+
+  // free what the audio threads are done with
+  r=&audio_retired;
+  while (*r) {
+    s=*r;
+    used=(s==__atomic_load_n(&audio_enginesnap, __ATOMIC_SEQ_CST) ||
+          s==__atomic_load_n(&audition_enginesnap, __ATOMIC_SEQ_CST));
+    for(t=0;t<AUDIO_THREADS;t++)
+      if (s==__atomic_load_n(&audio_inuse[t], __ATOMIC_SEQ_CST)) used=1;
+    if (used) {
+      r=&s->next;
+    } else {
+      *r=s->next;
+      free(s);
+    }
+  }
+}
 
 
-// above which point to round audio peaks
-#define AUDIO_SHAPER_THRESHOLD	0.9
+// save the edits recorded during the last render run, if any
+static void audio_saveedits(void)
+{
+  audio_editlog *log;
+  char *home, editfile[512], logentry[1024];
 
+  log=__atomic_exchange_n(&audio_recorded, NULL, __ATOMIC_ACQ_REL);
+  if (!log) return;
 
-// waveshaper to limit audio range
-float audio_shape(float input)
+  home=getenv("HOME");
+  snprintf(editfile, 511, "%s/Desktop/komposter_edits_%u.kprm", home, (int)time(NULL));
+  if (engine_saveparams(editfile, log->start, log->measures, log->list, log->len)) {
+    snprintf(logentry, 1023, "Failed to write edits to %s", editfile);
+  } else {
+    snprintf(logentry, 1023, "Wrote %d edits to %s", log->len, editfile);
+  }
+  console_post(logentry);
+  free(log);
+}
+
+
+// publish the edits made since the last call. called from the ui timer
+void audio_commit(void)
 {
-  return 0.5 * (fabs(input + AUDIO_SHAPER_THRESHOLD) - fabs(input - AUDIO_SHAPER_THRESHOLD));  
+  if (audio_dirty || !audio_current || csynth!=audio_current->synth ||
+      cpatch[csynth]!=audio_current->patch || cpatt!=audio_current->pattern) audio_publish();
+  audio_saveedits();
+}
+
+
+// start rendering a block from the latest snapshot. returns NULL if
+// nothing has been published yet
+static audio_snapshot *audio_acquire(int t)
+{
+  audio_snapshot *s;
+
+  // advertise the snapshot before using it, and check it wasn't
+  // replaced in between so that the ui thread saw it in use
+  do {
+    s=__atomic_load_n(&audio_current, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&audio_inuse[t], s, __ATOMIC_SEQ_CST);
+  } while (s!=__atomic_load_n(&audio_current, __ATOMIC_SEQ_CST));
+  return s;
+}
+
+
+// point an engine at an acquired snapshot. only called by the thread
+// owning the engine, with enginesnap the snapshot the engine was on
+static void audio_adopt(kengine *e, audio_snapshot **enginesnap, audio_snapshot *s)
+{
+  audio_snapshot *old;
+
+  old=*enginesnap;
+  if (s!=old) {
+    engine_setsong(e, &s->song);
+    __atomic_store_n(enginesnap, s, __ATOMIC_SEQ_CST);
+
+    // module buffers of deleted modules and changed synths can only
+    // be released here, between blocks
+    if (!old || s->graphversion!=old->graphversion ||
+        memcmp(s->song.seq_synth, old->song.seq_synth, sizeof(s->song.seq_synth))) kmm_gcollect(e);
+  }
+  e->seqch=s->seqch;
+  e->seqsonglen=s->seqsonglen;
+  e->bpm=s->bpm;
+}
+
+
+// done with the block
+static void audio_unacquire(int t)
+{
+  __atomic_store_n(&audio_inuse[t], NULL, __ATOMIC_SEQ_CST);
+}
+
+
+// queue a request to the composing voice. dropped if the playback
+// thread has fallen that far behind
+static void audio_request(int type, int voice, int synth, int value)
+{
+  audition_request *r;
+  unsigned int tail;
+
+  tail=__atomic_load_n(&audition_reqtail, __ATOMIC_RELAXED);
+  if (tail - __atomic_load_n(&audition_reqhead, __ATOMIC_ACQUIRE) >= AUDITION_REQUESTS) return;
+  r=&audition_requests[tail&(AUDITION_REQUESTS-1)];
+  r->type=type;
+  r->voice=voice;
+  r->synth=synth;
+  r->value=value;
+  __atomic_store_n(&audition_reqtail, tail+1, __ATOMIC_RELEASE);
+}
+
+
+// play the queued requests on the composing voice. called from the
+// playback thread with audition_engine pointing at a snapshot
+static void audio_applyrequests(void)
+{
+  audition_request *r;
+  unsigned int head;
+
+  head=__atomic_load_n(&audition_reqhead, __ATOMIC_RELAXED);
+  while (head!=__atomic_load_n(&audition_reqtail, __ATOMIC_ACQUIRE)) {
+    r=&audition_requests[head&(AUDITION_REQUESTS-1)];
+    switch (r->type) {
+      case AUDITION_LOADPATCH:
+        engine_loadpatch(&audition_engine, r->voice, r->synth, r->value);
+        break;
+      case AUDITION_NOTE:
+        engine_trignote(&audition_engine, r->voice, r->value);
+        break;
+      case AUDITION_NOTEOFF:
+        audition_engine.gate[r->voice]=0;
+        break;
+      case AUDITION_RESET:
+        engine_resetvoice(&audition_engine, r->voice);
+        break;
+      case AUDITION_PANIC:
+        engine_panic(&audition_engine);
+        break;
+    }
+    head++;
+    __atomic_store_n(&audition_reqhead, head, __ATOMIC_RELEASE);
+  }
+}
+
+
+// keep the composing voice in sync with the patch being edited. called
+// once per AUDIO_RAMPBLOCK samples
+static void audio_updatepatch(audio_snapshot *s)
+{
+  if (s->synth!=audio_loadedsynth || s->patch!=audio_loadedpatch || s->graphversion!=audio_loadedgraph) {
+    // switched to another patch or the synth was rebuilt
+    engine_loadpatch(&audition_engine, 0, s->synth, s->patch);
+    audio_loadedsynth=s->synth;
+    audio_loadedpatch=s->patch;
+    audio_loadedgraph=s->graphversion;
+    audio_loadedversion=s->patchversion;
+  } else if (s->patchversion!=audio_loadedversion) {
+    // edited - glide to new values to avoid zipper noise
+    engine_glidepatch(&audition_engine, 0, s->synth, s->patch, AUDIO_RAMPFRAMES);
+    audio_loadedversion=s->patchversion;
+  }
+}
+
+
+// hand the edits recorded in the render run to the ui thread and, if
+// next is set, start recording the run about to begin. if the ui hasn't
+// saved the previous run yet the buffer is reused and those are lost
+static void audio_recordrun(int next)
+{
+  if (!audio_recordedits) return;
+  if (audio_recording && audio_engine.recordlen > 0 && !__atomic_load_n(&audio_recorded, __ATOMIC_ACQUIRE)) {
+    audio_recording->len=audio_engine.recordlen;
+    __atomic_store_n(&audio_recorded, audio_recording, __ATOMIC_RELEASE);
+    audio_recording=NULL;
+  }
+  engine_record(&audio_engine, NULL, 0);
+  if (!next) return;
+
+  if (!audio_recording) audio_recording=malloc(sizeof(audio_editlog));
+  if (!audio_recording) return;
+  audio_recording->start=render_start;
+  audio_recording->measures=render_measures;
+  engine_record(&audio_engine, audio_recording->list, AUDIO_EDITLOG);
+}
+
+
+// time taken to render a block relative to how long it plays, in total
+// and for each voice from the profile of the engine that rendered it
+static void audio_rendertime(kengine *e, struct timespec *t0, struct timespec *t1, long frames)
+{
+  float t;
+  int i;
+
+  t=((t1->tv_sec-t0->tv_sec) + (t1->tv_nsec-t0->tv_nsec)/1000000000.0f) * OUTPUTFREQ / frames;
+  audio_st.rendertime=t;
+  audio_st.renderavg+=(t-audio_st.renderavg)*0.1f;
+  if (t > audio_st.rendermax) audio_st.rendermax=t;
+
+  for(i=0;i<MAX_CHANNELS;i++) {
+    t=e->voicetime[i] * OUTPUTFREQ / frames;
+    audio_st.voiceload[i]+=(t-audio_st.voiceload[i])*0.1f;
+    e->voicetime[i]=0;
+  }
+  audio_st.renders++;
+}
+
+
+// update audio peaks from what the engine mixed since last call
+static void audio_updatepeaks(float p)
+{
+  if (p > audio_peak) audio_peak=p;
+  if (p > audio_latest_peak) audio_latest_peak=p;
 }
 
 
 int audio_initialize(void)
 {
-  int error, i;
-  short data[AUDIOBUFFER_LEN*2]; //16bit stereo
+  char *v;
+
+  // first snapshot of the song for the audio threads
+  audio_publish();
+
+  // realtime settings for the audio threads
+  v=dotfile_getvalue("audioPriority");
+  if (v) audio_priority=atoi(v);
+  v=dotfile_getvalue("audioPolicy");
+  if (v && !strcmp(v, "rr")) audio_policy=SCHED_RR;
+  v=dotfile_getvalue("audioCpu");
+  if (v) audio_cpu=atoi(v);
+  v=dotfile_getvalue("audioMlock");
+  if (v) audio_mlock=atoi(v);
+  if (audio_mlock && mlockall(MCL_CURRENT|MCL_FUTURE))
+    printf("Failed to lock memory (%s), audio may be paged out\n", strerror(errno));
 
   audio_peak=0.0f;
   audio_latest_peak=0.0f;
@@ -136,116 +490,131 @@ int audio_initialize(void)
   render_loops=0;
   render_played_loops=0;
 
-  dev=NULL;
-  ctx=NULL;
-  dev=alcOpenDevice(NULL);
-  if (dev==NULL) { printf("alcOpenDevice() failed to return a device!\n"); return 0; }
-  ctx=alcCreateContext(dev, NULL);
-  if (ctx==NULL) { printf("alcCreateContext() failed to return a context!\n"); return 0; }
-  alcMakeContextCurrent(ctx);
-  format = AL_FORMAT_STEREO16;
-
-  alGenBuffers(3, buffers);
-  if (alGetError()!=AL_NO_ERROR) { printf("Failed to generate audio buffers!\n"); return 0; }
-
-  alGenSources(1, &source);
-  if (alGetError()!=AL_NO_ERROR) { printf("Failed to generate audio source\n"); return 0; }
-
-  // set positions  
-  alSource3f(source, AL_POSITION,        0.0, 0.0, 0.0);
-  alSource3f(source, AL_VELOCITY,        0.0, 0.0, 0.0);
-  alSource3f(source, AL_DIRECTION,       0.0, 0.0, 0.0);
-  alSourcef (source, AL_ROLLOFF_FACTOR,  0.0          );
-  alSourcei (source, AL_SOURCE_RELATIVE, AL_TRUE      );
-
-  // set gain
-  alSourcef(source, AL_GAIN, 1.0f);
-
-  // queue three empty zeroed buffers
-  for(i=0;i<AUDIOBUFFER_LEN;i++) { data[i*2]=0; data[i*2+1]=0; }
-  alBufferData(buffers[0], format, data, AUDIOBUFFER_LEN*4, OUTPUTFREQ);  
-  alBufferData(buffers[1], format, data, AUDIOBUFFER_LEN*4, OUTPUTFREQ);
-  alBufferData(buffers[2], format, data, AUDIOBUFFER_LEN*4, OUTPUTFREQ);
-
-  // start playback
-  alSourceQueueBuffers(source, 3, buffers);
-  error=alGetError();
-  if (error!=AL_NO_ERROR) { printf("Failed to queue source buffers (err %d/0x%x)\n",error,error); return 0; }
-  alSourcePlay(source);
-  if (alGetError()!=AL_NO_ERROR) { printf("Failed to start source playback\n"); return 0; }
+  // output backend and device from the config
+  v=dotfile_getvalue("audioBackend");
+  if (v && !(audio_out=audioout_find(v))) {
+    printf("Unknown audio backend %s, using openal\n", v);
+    audio_out=&audioout_openal;
+  }
+  v=dotfile_getvalue("audioPacing");
+  if (!audio_out->open(dotfile_getvalue("audioDevice"), (v && !strcmp(v, "max")) ? AUDIOOUT_MAXSPEED : 0)) return 0;
+
+  // audition block size from the config, in frames
+  v=dotfile_getvalue("auditionBlockSize");
+  if (v) audition_blocklen=atoi(v);
+  if (audition_blocklen<AUDITION_MINBLOCK) audition_blocklen=AUDITION_MINBLOCK;
+  if (audition_blocklen>AUDITION_MAXBLOCK) audition_blocklen=AUDITION_MAXBLOCK;
+  v=dotfile_getvalue("auditionLatencyReport");
+  if (v) audition_report=atoi(v);
+  v=dotfile_getvalue("recordEdits");
+  if (v) audio_recordedits=atoi(v);
+  v=dotfile_getvalue("qualityGovernor");
+  if (v) audio_governor=atoi(v);
+
+  // three buffers for playback and a few short ones for audition
+  if (!audio_out->start(AUDIOOUT_SONG, 3, AUDIOBUFFER_LEN, audio_fillsong)) return 0;
+  if (!audio_out->start(AUDIOOUT_AUDITION, AUDITION_BUFFERS, audition_blocklen, audio_fillaudition)) return 0;
 
   return 1;
 }
 
 
 
-int audio_isplaying()
+void audio_release(void)
 {
-    ALenum state;
-    
-    alGetSourcei(source, AL_SOURCE_STATE, &state);
-    return (state == AL_PLAYING);
+  audio_out->close();
+
+  // keep the edits of a run that was still playing
+  audio_recordrun(0);
+  audio_saveedits();
 }
 
 
-void audio_release(void)
+// refill the song stream
+static int audio_fillsong(short *buffer, long frames)
 {
-  ALuint buffer;
-  int queued;
+  audio_latest_peak=0.0f;
+  audio_st.buffers++;
+  return audio_process(buffer, frames);
+}
 
-  alSourceStop(source);
-  alGetSourcei(source, AL_BUFFERS_QUEUED, &queued);
-  while(queued--)
-    alSourceUnqueueBuffers(source, 1, &buffer);
-  alDeleteSources(1, &source);
-  alDeleteBuffers(1, buffers);
+
+// refill the audition stream. the latency of a note played from the ui
+// is measured when the buffer it starts in is queued: time since the
+// keypress plus the audio queued ahead of the buffer. the device's own
+// buffering comes on top of that and can't be seen from here
+static int audio_fillaudition(short *buffer, long frames)
+{
+  int trigged;
+  struct timespec now;
+
+  trigged=audition_trigged;
+  audition_trigged=0;
+  audio_processaudition(buffer, frames);
+
+  if (trigged) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    audition_latency=(now.tv_sec-audition_trigtime.tv_sec)*1000.0f +
+                     (now.tv_nsec-audition_trigtime.tv_nsec)/1000000.0f +
+                     audio_out->latency(AUDIOOUT_AUDITION)*1000.0f/OUTPUTFREQ;
+    audition_latencysum+=audition_latency;
+    audition_latencycount++;
+    audition_measured=1;
+  }
+  return frames;
 }
 
 
 int audio_update(int cs)
 {
-  int processed, active;
-  ALuint buffer;
-  short data[AUDIOBUFFER_LEN*2]; //16bit stereo
-
-  active=0;
-  alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
-  // if (processed) printf("refilling %d buffer(s)\n",processed);
-  while(processed--)
-  {
-    alSourceUnqueueBuffers(source, 1, &buffer);
-    if (alGetError()!=AL_NO_ERROR) return 0;
-
-    // fill data and queue the buffer
-    audio_latest_peak=0.0f;
-    audio_process((short*)(&data), AUDIOBUFFER_LEN);
-    alBufferData(buffer, format, data, AUDIOBUFFER_LEN*4, OUTPUTFREQ);
-    active++;
- 
-    alSourceQueueBuffers(source, 1, &buffer);
-    if (alGetError()!=AL_NO_ERROR) return 0;
-  }
+  int active;
 
-  // restart if both buffers ran out
-  if (!audio_isplaying()) {
-    // printf("audio: playback died, restarting(%d)..\n", restarts++);
-    alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
-    alSourcePlay(source);
-  }
-  
+  active=audio_out->update(AUDIOOUT_SONG);
+  audio_out->update(AUDIOOUT_AUDITION);
   return active; // number of buffers re-filled
 }
 
 
-// play into a buffer. bufferlen = number of 16-bit stereo samples
+void audioout_underrun(int stream)
+{
+  audio_st.underruns++;
+}
+
+
+long audioout_ready(int stream)
+{
+  if (stream!=AUDIOOUT_SONG || audiomode!=AUDIOMODE_PLAY) return -1;
+  switch (render_state) {
+    case RENDER_START:
+    case RENDER_IN_PROGRESS:
+      // nothing to play until the run starts
+      return 0;
+    case RENDER_LIVE:
+      if (render_live_loop) return LONG_MAX;
+      return render_pos-render_playpos;
+    case RENDER_PLAYBACK:
+    case RENDER_LIVE_COMPLETE:
+      return LONG_MAX;
+  }
+  return -1;
+}
+
+
+audioout_backend *audioout_find(const char *name)
+{
+  if (!strcmp(name, audioout_openal.name)) return &audioout_openal;
+  if (!strcmp(name, audioout_null.name)) return &audioout_null;
+  if (!strcmp(name, audioout_file.name)) return &audioout_file;
+  return NULL;
+}
+
+
+// play into a buffer from what the render thread has rendered.
+// bufferlen = number of 16-bit stereo samples
 int audio_process(short *buffer, long bufferlen)
 {
-  int i, m, mi=0, mt, ii, pkey;
-  float signals[4], p;
-  short s;
-  long ticks=0, copylen;
-  int voice, pattpos;
-  void *buf;
+  int i;
+  long copylen;
 
   // clear the buffer
   for(i=0;i<bufferlen*2;i++) buffer[i]=0;
@@ -253,39 +622,7 @@ int audio_process(short *buffer, long bufferlen)
   // if playback is muted, exit immediately
   if (audiomode==AUDIOMODE_MUTE) return bufferlen;
 
-  // now we start the render for real - set the spin lock to signal other threads that
-  // we're rendering and no changes should be made to synth data
-  audio_spinlock=0;
-
   if (audiomode==AUDIOMODE_PLAY) {
-    // start a new render     
-    if (render_state==RENDER_START) {
-      // start a new render, reset all synths and load patch 0
-      for(i=0;i<seqch;i++) {
-        audio_resetsynth(i); 
-        audio_loadpatch(i, seq_synth[i], 0);
-      }
-      if (render_buffer) { free(render_buffer); render_buffer=NULL; }
-      render_start=seq_render_start;
-      if (render_type==RENDER_IN_PROGRESS) {
-        render_measures=seq_render_end - seq_render_start;
-      } else {
-        if (seq_render_end > seq_render_start) {
-          render_measures=seq_render_end - seq_render_start;
-        } else {
-          render_measures=seqsonglen - seq_render_start;
-        }
-      }
-      render_bufferlen=((OUTPUTFREQ*60*render_measures*4)/bpm);
-      render_buffer=calloc(2*render_bufferlen, sizeof(short));
-      render_pos=0;
-      render_state=render_type;
-      render_playpos=0;
-      render_oldtick=-1;
-      render_loops=0;
-      render_played_loops=0;
-    }
-
     // if we're playing live, make sure there's enough unplayed audio in the render
     // buffer and then copy from render buffer to audio output buffer. if the computer
     // is too slow for the number of channels/synths used, the audio output will have
@@ -310,6 +647,12 @@ int audio_process(short *buffer, long bufferlen)
         render_playpos+=copylen;        
       }
     }
+    if (render_state==RENDER_LIVE && !render_live_loop) {
+      // how far the renderer is ahead, or if it fell behind
+      audio_st.ahead=render_pos-render_playpos;
+      if (audio_st.aheadmin<0 || audio_st.ahead<audio_st.aheadmin) audio_st.aheadmin=audio_st.ahead;
+      if (audio_st.ahead<bufferlen) audio_st.late++;
+    }
     if (render_state==RENDER_PLAYBACK  ||
         ((render_state==RENDER_LIVE || render_state==RENDER_LIVE_COMPLETE) && render_pos>=(render_playpos+bufferlen) && !render_live_loop)
        )
@@ -325,9 +668,8 @@ int audio_process(short *buffer, long bufferlen)
           memset(&buffer[copylen], 0, (bufferlen-copylen)*4);
         }
 
-        // stop playback and reset synths to clear any sounds left playing
+        // stop playback, the next run resets the synths
         render_state=RENDER_COMPLETE; render_playpos=0;
-        for(i=0;i<seqch;i++) audio_resetsynth(i);
 
       } else {
         // copy a full buffer from renderbuffer to playback buffer
@@ -340,12 +682,45 @@ int audio_process(short *buffer, long bufferlen)
     if (render_state==RENDER_LIVE_COMPLETE && ((render_bufferlen-render_playpos)<bufferlen)) {
         render_state=RENDER_COMPLETE;
         audiomode=AUDIOMODE_COMPOSING;
-        for(i=0;i<seqch;i++) audio_resetsynth(i);
     }
-    audio_spinlock=0;
     return bufferlen;
   }
 
+  // composing and pattern preview go to the audition source
+  return bufferlen;
+}
+
+
+// play the synth being edited into a buffer for the audition source
+int audio_processaudition(short *buffer, long bufferlen)
+{
+  int i, m, pkey;
+  float p;
+  short s;
+  long ticks=0;
+  int voice, pattpos;
+  audio_snapshot *snap;
+  u32 *patt;
+  struct timespec t0, t1;
+
+  // clear the buffer
+  for(i=0;i<bufferlen*2;i++) buffer[i]=0;
+
+  snap=audio_acquire(AUDIO_THREAD_PLAYBACK);
+  if (!snap) return bufferlen;
+  audio_adopt(&audition_engine, &audition_enginesnap, snap);
+  audio_applyrequests();
+
+  // silent while muted or playing the song, but keep the knob turns
+  // from piling up in the queue
+  if (audiomode!=AUDIOMODE_COMPOSING && audiomode!=AUDIOMODE_PATTERNPLAY) {
+    engine_applyparams(&audition_engine);
+    audio_unacquire(AUDIO_THREAD_PLAYBACK);
+    return bufferlen;
+  }
+  patt=snap->song.pattdata[snap->pattern];
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
   // loop for each sample in buffer
   for(i=0;i<bufferlen;i++) {
     voice=0;    
@@ -357,77 +732,60 @@ int audio_process(short *buffer, long bufferlen)
       }
       audiomode_flags=0;
       
-      ticks=playpos / (OUTPUTFREQ/(bpm*256/60)); // calc tick from sample index
+      ticks=playpos / (OUTPUTFREQ/(snap->bpm*256/60)); // calc tick from sample index
       pattpos=ticks>>6;
 
       // follow the pattern and play any notes
       if (ticks!=oldtick) { // new tick
         if (!(ticks&63)) {
           // tick 0/64/128/192 : trigger notes
-          if (pattdata[cpatt][pattpos] && !(pattdata[cpatt][pattpos]&NOTE_LEGATO)) {
-            pkey=pattdata[cpatt][pattpos]&0x7f;
-            audio_trignote(voice, pkey);
-            accent[voice] = (pattdata[cpatt][pattpos]&NOTE_ACCENT) ? 1 : 0;
+          if (patt[pattpos] && !(patt[pattpos]&NOTE_LEGATO)) {
+            pkey=patt[pattpos]&0x7f;
+            engine_trignote(&audition_engine, voice, pkey);
+            audition_engine.accent[voice] = (patt[pattpos]&NOTE_ACCENT) ? 1 : 0;
           }
           // TODO: push a slide to stack if portamento
         }
         if ((ticks&63)==60) {
           // tick 60/124/188/252 : drop gate if following note is not legato
           m=pattpos+1;
-          gate[voice]=0;
-          if ( m<(pattlen[cpatt]*16) ) { // don't drop gate if next note is legato
-            if (pattdata[cpatt][m]&NOTE_LEGATO) gate[voice]=1;
+          audition_engine.gate[voice]=0;
+          if ( m<(snap->song.pattlen[snap->pattern]*16) ) { // don't drop gate if next note is legato
+            if (patt[m]&NOTE_LEGATO) audition_engine.gate[voice]=1;
           }
         }
       }        
     }
     
     if (audiomode==AUDIOMODE_PATTERNPLAY || audiomode==AUDIOMODE_COMPOSING) {
-      // copy modulator values from active patch when composing / previewing pattern
-      audio_loadpatch(voice, csynth, cpatch[csynth]);
+      // pick up changes to the active patch when composing / previewing pattern
+      if (!(audition_frame++&(AUDIO_RAMPBLOCK-1))) {
+        audio_updatepatch(snap);
+        engine_applyparams(&audition_engine);
+        engine_smooth(&audition_engine);
+      }
 
       // process the synthesizer signal stack
-      m=0;
-      while (signalfifo[csynth][m]>=0) {
-        mi=signalfifo[csynth][m];
-        mt=mod[csynth][mi].type;
-        for(int i=0;i<4;i++) {
-          ii = mod[csynth][mi].input[i];
-          signals[i] = (ii>=0) ? output[0][ii] : 0.0f;
-        }
-        if (mt>=0 && modDataBufferLength[mt]) {
-          memcpy(&buf, &localdata[voice][mi][0], sizeof(void*));
-          if (!buf) {
-            // !!!! this doesn't compile with xcode 4.1 LLVM
-            buf=kmm_alloc(modDataBufferLength[mt], voice, csynth, mi, mt);
-            memcpy(&localdata[voice][mi][0], &buf, sizeof(void*));
-            // !!!!
-          }
-        }
-        if (mt>=0)
-          output[voice][mi]=mod_functable[mt](voice, &modulator[voice][mi], (void*)&localdata[voice][mi], (float*)&signals);
-        m++;
-      }
-      restart[voice]=0; // did restart on this sample
-      p=output[voice][mi];
-       
-      // update audio peaks
-      if (fabs(p) > audio_peak) audio_peak=fabs(p);
-      if (fabs(p) > audio_latest_peak) audio_latest_peak=fabs(p);
+      p=engine_runvoice(&audition_engine, voice, snap->synth);
+      audio_updatepeaks(fabs(p));
  
-      p=audio_shape(p);
+      p=engine_shape(p);
       s=(short)(32766*p);
       buffer[i*2]=s; buffer[i*2+1]=s; // output stream is in stereo
 
       // advance the play position
       oldtick=ticks;
       playpos++;
-      if ((ticks>>10) >= pattlen[cpatt]) { ticks=0; playpos=0; }
+      if ((ticks>>10) >= snap->song.pattlen[snap->pattern]) { ticks=0; playpos=0; }
     }
   }
 
-  // ok, buffer is filled and we're done! release the spin lock
-  audio_spinlock=0;
+  // all of it on the composing voice
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  audition_engine.voicetime[0]+=(t1.tv_sec-t0.tv_sec) + (t1.tv_nsec-t0.tv_nsec)/1000000000.0;
+  audio_rendertime(&audition_engine, &t0, &t1, bufferlen);
+
+  audio_unacquire(AUDIO_THREAD_PLAYBACK);
   return bufferlen;
 }
 
@@ -438,18 +796,100 @@ int audio_process(short *buffer, long bufferlen)
 
 
 
+// adjust the quality of live playback to how well the renderer keeps up
+static void audio_govern(void)
+{
+  long ahead;
+  int q;
+
+  ahead=render_pos-render_playpos;
+  if (render_live_loop && render_loops > render_played_loops) ahead+=render_bufferlen;
+  q=audio_engine.quality;
+
+  if (audio_govhold > 0) audio_govhold--;
+  if (ahead < AUDIOBUFFER_LEN || audio_st.rendertime > AUDIO_GOVERNOR_HIGH) {
+    // falling behind, step down unless the last step is still settling
+    audio_govgood=0;
+    if (audio_govhold || q>=ENGINE_QUALITY_LOWEST) return;
+    q++;
+    audio_govhold=AUDIO_GOVERNOR_HOLD;
+    audio_degraded=1;
+    rtlog(RTLOG_CONSOLE, "Render falling behind, quality lowered to level %d", q);
+  } else if (q>ENGINE_QUALITY_FULL && audio_st.rendertime < AUDIO_GOVERNOR_LOW) {
+    // plenty of headroom for a while, step back up
+    if (++audio_govgood < AUDIO_GOVERNOR_RESTORE) return;
+    q--;
+    audio_govgood=0;
+    audio_govhold=AUDIO_GOVERNOR_HOLD;
+    rtlog(RTLOG_CONSOLE, q ? "Render quality raised to level %d" : "Render back to full quality", q);
+  } else {
+    audio_govgood=0;
+    return;
+  }
+  engine_setquality(&audio_engine, q);
+  audio_st.quality=q;
+}
+
+
+// start a new render run of the song. called by the render thread when
+// the ui has set render_state to RENDER_START. the playback thread
+// doesn't touch the render buffer until render_state is set at the end
+static void audio_startrun(audio_snapshot *snap)
+{
+  if (render_buffer) { free(render_buffer); render_buffer=NULL; }
+  render_start=seq_render_start;
+  if (render_type==RENDER_IN_PROGRESS) {
+    render_measures=seq_render_end - seq_render_start;
+  } else {
+    if (seq_render_end > seq_render_start) {
+      render_measures=seq_render_end - seq_render_start;
+    } else {
+      render_measures=snap->seqsonglen - seq_render_start;
+    }
+  }
+  // reset all synths and load patch 0
+  audio_recordrun(1);
+  render_bufferlen=engine_start(&audio_engine, render_start, render_measures);
+  audio_compiledversion=snap->songversion;
+  if (render_bufferlen>=0) render_buffer=calloc(2*render_bufferlen, sizeof(short));
+  if (!render_buffer) {
+    rtlog(RTLOG_CONSOLE, "Out of memory for rendering the song");
+    render_bufferlen=0;
+    audiomode=AUDIOMODE_COMPOSING;
+    __atomic_store_n(&render_state, RENDER_COMPLETE, __ATOMIC_RELEASE);
+    return;
+  }
+  render_pos=0;
+
+  // every run starts at full quality, offline renders stay there
+  engine_setquality(&audio_engine, ENGINE_QUALITY_FULL);
+  audio_st.quality=ENGINE_QUALITY_FULL;
+  audio_degraded=0;
+  audio_govhold=0;
+  audio_govgood=0;
+  render_playpos=0;
+  render_loops=0;
+  render_played_loops=0;
+  __atomic_store_n(&render_state, render_type, __ATOMIC_RELEASE);
+}
+
+
 long audio_render(void)
 {
-  int m, mi=0, mt, ii, pkey;
-  float signals[4], p;
-  short s;
-  int i, voice;
-  int synth;
-  int pattern, pattstart, pattpos;
-  long ticks=0;
-  void *buf;
   short *buffer;
-  long bufferlen;
+  long bufferlen, n;
+  audio_snapshot *snap;
+  struct timespec t0, t1;
+
+  if (render_state==RENDER_START) {
+    snap=audio_acquire(AUDIO_THREAD_RENDER);
+    if (snap) {
+      audio_adopt(&audio_engine, &audio_enginesnap, snap);
+      audio_startrun(snap);
+    }
+    audio_unacquire(AUDIO_THREAD_RENDER);
+    return 0;
+  }
 
   // render a block of audio
   bufferlen=AUDIOBUFFER_LEN;  
@@ -470,210 +910,196 @@ long audio_render(void)
     if (render_state==RENDER_LIVE && render_pos >= (render_playpos+AUDIO_RENDER_AHEAD*bufferlen)) return 0;
   }
 
-  // loop for each sample in buffer
-  for(i=0;i<bufferlen;i++) {
-    p=0;
-    ticks=render_pos / (OUTPUTFREQ/(bpm*256/60)); // calc tick from sample index
-    ticks+=(render_start<<10);
-
-    for(voice=0;voice<seqch;voice++) {
-      synth=seq_synth[voice];
-
-      // find if there's a pattern playing on this voice
-      pattern=-1; // no pattern by default
-      pattstart=0;
-      if (sequencer_ispattern(voice, ticks>>10)) { // is there a pattern here?
-        pattstart=sequencer_patternstart(voice, ticks>>10);
-        pattern=seq_pattern[voice][pattstart];
-        pattpos=(ticks/64) - (pattstart*16);
-        while (pattpos>=(pattlen[pattern]*16)) pattpos-=(pattlen[pattern]*16);
-        // pattpos is the play position inside the pattern
-      }
-
-      if (pattern>=0) {
-        // follow the pattern and play any notes
-        if (ticks!=render_oldtick) { // new tick
-          if (!(ticks&63)) {
-            if (pattpos==0 || render_pos==0) {
-              // tick 0 on new pattern or first sample of a render run -> load patch to synth
-              audio_loadpatch(voice, synth, seq_patch[voice][pattstart]);
-            }
-            // tick 0/64/128/192 : trigger notes
-            if (pattdata[pattern][pattpos] && !(pattdata[pattern][pattpos]&NOTE_LEGATO)) {
-              pkey=pattdata[pattern][pattpos]&0x7f;
-              pkey+=seq_transpose[voice][pattstart];
- 	      audio_trignote(voice, pkey);
-              accent[voice] = (pattdata[pattern][pattpos]&NOTE_ACCENT) ? 1 : 0;
-            }
-            // TODO: push a slide to stack if portamento
-          }
-          if ((ticks&63)==60) {
-            // tick 60/124/188/252 : drop gate if following note is not legato
-            m=pattpos+1;
-            gate[voice]=0;
-            if ( m<(pattlen[pattern]*16) ) { // don't drop gate if next note is legato
-              if (pattdata[pattern][m]&NOTE_LEGATO) gate[voice]=1;
-            }
-          }
-        }        
+  snap=audio_acquire(AUDIO_THREAD_RENDER);
+  if (!snap) return 0;
+  audio_adopt(&audio_engine, &audio_enginesnap, snap);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if (snap->songversion!=audio_compiledversion) {
+    // song was edited, follow the changes from here on
+    if (engine_compile(&audio_engine)) {
+      rtlog(RTLOG_CONSOLE, "Out of memory for following the song edits, playback stopped");
+      render_state=RENDER_COMPLETE;
+      audiomode=AUDIOMODE_COMPOSING;
+      audio_unacquire(AUDIO_THREAD_RENDER);
+      return 0;
+    }
+    audio_compiledversion=snap->songversion;
+  }
+  audio_engine.peak=0.0f;
+  n=engine_render(&audio_engine, buffer, bufferlen);
+  audio_updatepeaks(audio_engine.peak);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if (n>0) audio_rendertime(&audio_engine, &t0, &t1, n);
+
+  render_pos+=n;
+  if (render_state==RENDER_LIVE && audio_governor) audio_govern();
+  if (render_pos >= render_bufferlen) {
+    if (render_state==RENDER_LIVE) {
+      if (!render_live_loop) {
+        render_state=RENDER_LIVE_COMPLETE;
+      } else {
+        // loop back to start, each loop is recorded as a run of its own
+        render_pos=0;
+        render_loops++;
+        audio_recordrun(1);
+        engine_seek(&audio_engine, 0);
+        engine_panic(&audio_engine);
       }
+    } else {
+      render_state=RENDER_COMPLETE;
+    }
+    if (render_state!=RENDER_LIVE) audio_recordrun(0);
+  }
 
-      // process the synthesizer signal stack
-      m=0;
-      while (signalfifo[synth][m]>=0 && m<MAX_MODULES) {
-        mi=signalfifo[synth][m];
-        mt=mod[synth][mi].type;
-        for(int i=0;i<4;i++) {
-          ii = mod[synth][mi].input[i];
-          signals[i] = (ii>=0) ? output[voice][ii] : 0.0f;
-        }
-        
-        if (mt>=0 && modDataBufferLength[mt]) {
-          memcpy(&buf, &localdata[voice][mi][0], sizeof(void*));
-
-          if (!buf) {
-            // !!!! this does not compile with xcode 4.1 LLVM
-            buf=kmm_alloc(modDataBufferLength[mt], voice, synth, mi, mt);
-            memcpy(&localdata[voice][mi][0], &buf, sizeof(void*));
-            // !!!!
-          }
-
-        }
+  // ok, buffer is filled and we're done!
+  audio_unacquire(AUDIO_THREAD_RENDER);
+  return n;
+}
 
-        if (mt>=0)
-          output[voice][mi]=mod_functable[mt](voice, &modulator[voice][mi], (void*)&localdata[voice][mi], (float*)&signals);
-        m++;
-      }
 
-      restart[voice]=0; // did restart on this sample
 
-      if (seq_mute[voice]) continue; // skip mixing into final output if voice is muted
-      p+=output[voice][mi];
+// apply the realtime settings to the calling audio thread
+void audio_threadsetup(int thread)
+{
+  struct sched_param param;
+  int r;
+
+  if (audio_priority > 0) {
+    memset(&param, 0, sizeof(param));
+    param.sched_priority=audio_priority - thread;
+    if (param.sched_priority < sched_get_priority_min(audio_policy)) param.sched_priority=sched_get_priority_min(audio_policy);
+    if (param.sched_priority > sched_get_priority_max(audio_policy)) param.sched_priority=sched_get_priority_max(audio_policy);
+    r=pthread_setschedparam(pthread_self(), audio_policy, &param);
+    if (r) {
+      rtlog(RTLOG_CONSOLE, "Realtime priority not permitted (%s)", strerror(r));
+    } else {
+      __atomic_fetch_add(&audio_st.realtime, 1, __ATOMIC_RELAXED);
     }
+  }
 
-    // update audio peaks
-    if (fabs(p) > audio_peak) audio_peak=fabs(p);
-    if (fabs(p) > audio_latest_peak) audio_latest_peak=fabs(p);
-
-    p=audio_shape(p);
-    s=(short)(32766*p);
-    buffer[i*2]=s; buffer[i*2+1]=s; // output stream is in stereo
-
-    oldtick=ticks;
-    render_pos++;
-    if (render_pos >= render_bufferlen) {
-      if (render_state==RENDER_LIVE) {
-        if (!render_live_loop) {
-          render_state=RENDER_LIVE_COMPLETE;
-          return i;
-        } else {
-          // loop back to start
-          render_pos=0;
-          render_loops++;
-          audio_panic();
-        }
-      } else {
-        render_state=RENDER_COMPLETE; return i;
-      }
-    }
-    
-    
+#ifdef __linux__
+  if (audio_cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(audio_cpu, &cpus);
+    r=pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (r) rtlog(RTLOG_CONSOLE, "Failed to pin audio thread to cpu %d (%s)", audio_cpu, strerror(r));
   }
+#endif
+}
 
-  // ok, buffer is filled and we're done!
-  return bufferlen;
+
+void audio_getstats(audio_stats *s)
+{
+  *s=*(audio_stats*)&audio_st;
 }
 
 
+// clear the lowest and highest values
+void audio_resetstats(void)
+{
+  audio_st.aheadmin=-1;
+  audio_st.rendermax=0.0f;
+}
 
-// loads a patch from the bank to the synth voice
-void audio_loadpatch(int voice, int synth, int patch)
+
+// latest and average keypress to sound latency of the audition path.
+// returns 1 if a note has been measured since the last call and
+// auditionLatencyReport is set in the config
+int audio_auditionlatency(float *latest, float *average)
+{
+  if (!audition_report || !audition_measured) return 0;
+  audition_measured=0;
+  *latest=audition_latency;
+  *average=audition_latencysum/audition_latencycount;
+  return 1;
+}
+
+
+// called after editing the modulator values of a patch. reload is set
+// when the module graph of a synth has changed and the new values must
+// be loaded at once instead of gliding to them
+void audio_patchchanged(int reload)
+{
+  if (reload) audio_graphversion++; else audio_patchversion++;
+  audio_dirty=1;
+}
+
+
+// called after turning a knob or typing in a value. the change is
+// queued to the engine so that the voices playing the patch glide to it
+// without waiting for the next snapshot
+void audio_paramchanged(int synth, int patch, int module)
 {
-  int j;
+  kparam p;
+  int mt, full;
+
+  mt=mod[synth][module].type;
+  p.pos=-1;
+  p.synth=synth;
+  p.patch=patch;
+  p.module=module;
+  p.smooth=(mt>0 && modModulatorTypes[mt]==1) ? AUDIO_PARAMSMOOTH : 0;
+  p.value=modvalue[synth][patch][module];
+
+  // to the composing voice, and to the song while it plays live. other
+  // runs start from a snapshot that already has the change. if either
+  // queue is full, drop what is queued so it can't land on top of the
+  // reloaded patch
+  full=engine_queueparam(&audition_engine, &p);
+  if (render_state==RENDER_LIVE) full|=engine_queueparam(&audio_engine, &p);
+  if (full) {
+    engine_flushparams(&audio_engine);
+    engine_flushparams(&audition_engine);
+    audio_patchchanged(0);
+    return;
+  }
+  audio_dirty=1;
+}
 
-  // copy modulator values form patch to synth modules
-  for(j=0;j<MAX_MODULES;j++) if (mod[synth][j].type)
-    modulator[ voice ][ j ] = modvalue[ synth ][ patch ][ j ];
+
+// called after editing patterns or the sequencer so that the
+// song playing live picks up the changes
+void audio_songchanged(void)
+{
+  audio_songversion++;
+  audio_dirty=1;
+}
+
+
+// loads a patch from the bank to the composing voice
+void audio_loadpatch(int voice, int synth, int patch)
+{
+  audio_request(AUDITION_LOADPATCH, voice, synth, patch);
 }
 
 // trigger a note
 void audio_trignote(int voice, int note)
 {
-  int i;
-  float freq;
+  clock_gettime(CLOCK_MONOTONIC, &audition_trigtime);
+  audition_trigged=1;
+  audio_request(AUDITION_NOTE, voice, 0, note);
+}
 
-  freq=8.1757989156; // c-0 in hz
-  for(i=0;i<note;i++) freq*=1.059463094; // ratio between two seminotes
-  pitch[voice]=freq;
-  gate[voice]=1;
-  restart[voice]=seq_restart[voice];
-  // printf("note_on: voice %d midi note %d, hardrestart=%d\n",voice,note,hardrestart);
+// release the key of a note
+void audio_noteoff(int voice)
+{
+  audio_request(AUDITION_NOTEOFF, voice, 0, 0);
 }
 
 
-// panic reset - completely resets all modules
+// panic reset - completely resets all modules of the composing voice.
+// the song engine is reset by the render thread when a run starts
 void audio_panic(void)
 {
-  int voice;
-  for(voice=0;voice<seqch;voice++) audio_resetsynth(voice);
+  audio_request(AUDITION_PANIC, 0, 0, 0);
 }
 
 
-// reset a synth voice so that it no longer produces sound
+// reset a composing voice so that it no longer produces sound
 void audio_resetsynth(int voice)
 {
-  int m,mi,mt,synth;
-  long i;
-  float *lbuf;
-
-  gate[voice]=0;
-  m=0;
-  synth=seq_synth[voice];
-  while (signalfifo[synth][m]>=0 && m<MAX_MODULES) {
-    mi=signalfifo[synth][m];
-    mt=mod[synth][mi].type;
-    output[voice][mi]=0;
-    pitch[voice]=110.0/OUTPUTFREQ;
-    switch(mt) {
-      case MOD_WAVEFORM:
-        mod_fdata(voice, mi)[0]=0; // osc accu
-        mod_fdata(voice, mi)[1]=0; // subosc accu
-        break;
-      case MOD_ADSR:
-         mod_fdata(voice, mi)[0]=0; // accu
-         mod_ldata(voice, mi)[1]=0;  // old gate
-       break;
-      case MOD_LFO:
-        mod_fdata(voice, mi)[0]=0; // accu
-        break;
-      case MOD_DELAY:
-//        lbuf=mod_fpdata(voice, mi)[0]; // bufferptr
-        memcpy(&lbuf, &localdata[voice][mi][0], sizeof(void*));
-        if (lbuf) memset(lbuf, 0, modDataBufferLength[MOD_DELAY]*sizeof(float));
-        else printf("audio_resetsynth(): buffer for delay not yet allocated for v %d mi %d\n", voice, mi);
-        mod_ldata(voice, mi)[2]=0; // write position
-       break;
-      case MOD_FILTER:
-        mod_fdata(voice, mi)[0]=0; //lp
-        mod_fdata(voice, mi)[1]=0; //bp
-        mod_fdata(voice, mi)[2]=0; //hp        
-        break;
-      case MOD_LPF24:
-        for(i=0;i<8;i++) mod_ddata(voice, mi)[0]=0;
-        break;
-      case MOD_RESAMPLE:
-        mod_fdata(voice, mi)[0]=0; // accu
-        mod_fdata(voice, mi)[1]=0; // held sample
-        break;
-      case MOD_SUPERSAW:
-        for(i=0;i<8;i++) mod_fdata(voice, mi)[0]=0;
-        mod_fdata(voice, mi)[8]=0; //lp
-        mod_fdata(voice, mi)[9]=0; //bp
-        mod_fdata(voice, mi)[10]=0; //hp
-        break;
-    }
-    m++;
-  }
+  audio_request(AUDITION_RESET, voice, 0, 0);
 }
 
 
@@ -702,6 +1128,12 @@ int audio_exportwav() //char *filename)
 
   char *home, audiofile[512], logentry[1024];
 
+  // exports are always full quality
+  if (audio_degraded) {
+    console_post("Playback was rendered at reduced quality - render offline to export");
+    return 1;
+  }
+
   home=getenv("HOME");
   snprintf(audiofile, 511, "%s/Desktop/komposter_render_%u.wav", home, (int)time(NULL));
   
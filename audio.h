@@ -14,6 +14,7 @@
 #define __AUDIO_H__
 
 #include "arch.h"
+#include "constants.h"
 
 #define AUDIOBUFFER_LEN	1024
 
@@ -26,6 +27,36 @@
 // on the latency.
 #define AUDIO_RENDER_AHEAD	2
 
+// patch edits are picked up every AUDIO_RAMPBLOCK samples while
+// composing, and knobs glide to the new value over AUDIO_RAMPFRAMES
+// samples. the block is the engine's smoothing step
+#define AUDIO_RAMPBLOCK	ENGINE_SMOOTHBLOCK
+#define AUDIO_RAMPFRAMES	512
+
+// knob turns go to the engine through its parameter queue and the
+// voices playing the patch glide to the new value over AUDIO_PARAMSMOOTH
+// samples. with recordEdits=1 in ~/.komposter the changes made during
+// song playback are saved to a .kprm file next to rendered wavs, up to
+// AUDIO_EDITLOG of them for each run
+#define AUDIO_PARAMSMOOTH	512
+#define AUDIO_EDITLOG		65536
+
+// the synth being edited plays through a source of its own with a
+// couple of short buffers, so notes played on the patch and pattern
+// pages are heard right away while song playback keeps the long ones.
+// the block size in frames can be set with auditionBlockSize in
+// ~/.komposter, and auditionLatencyReport=1 posts the latency of
+// each note to the console
+#define AUDITION_BUFFERS	2
+#define AUDITION_BLOCKLEN	128
+#define AUDITION_MINBLOCK	64
+#define AUDITION_MAXBLOCK	256
+
+// notes, patch loads and resets for the composing voice wait in a queue
+// for the playback thread, which applies them at the start of its next
+// block. must be a power of two
+#define AUDITION_REQUESTS	64
+
 #define OUTPUTFREQ 44100
 
 #define AUDIOMODE_MUTE		0
@@ -41,16 +72,68 @@
 #define RENDER_LIVE		5
 #define RENDER_LIVE_COMPLETE	6
 
+// with qualityGovernor=1 in ~/.komposter, live playback lowers the
+// engine's quality a level at a time when the renderer gets less than
+// a buffer ahead of playback or takes over AUDIO_GOVERNOR_HIGH of the
+// time a block plays, and raises it again after AUDIO_GOVERNOR_RESTORE
+// blocks rendered under AUDIO_GOVERNOR_LOW. offline renders always
+// run at full quality
+#define AUDIO_GOVERNOR_HIGH	0.9f
+#define AUDIO_GOVERNOR_LOW	0.4f
+#define AUDIO_GOVERNOR_HOLD	8
+#define AUDIO_GOVERNOR_RESTORE	200
+
+// audio goes out through the backend set with audioBackend in
+// ~/.komposter: openal (default), null or file. audioDevice names the
+// openal device or the wav file to write, and audioPacing=max makes the
+// null and file sinks run as fast as audio can be rendered
+
+// the playback and render threads can be run with realtime priority.
+// in ~/.komposter, audioPriority=1..99 sets the priority of the
+// playback thread with the render thread one below it, audioPolicy=rr
+// uses round-robin instead of fifo scheduling, audioCpu=n pins both
+// threads to a cpu and audioMlock=1 locks the process in memory. each
+// falls back to the default when not permitted
+#define AUDIO_THREAD_PLAYBACK	0
+#define AUDIO_THREAD_RENDER	1
+#define AUDIO_THREADS		2
+
+// statistics of the audio threads, see audio_getstats()
+typedef struct {
+  unsigned long buffers;    // playback buffers filled
+  unsigned long underruns;  // times a source ran dry and was restarted
+  unsigned long late;       // live playback buffers left silent waiting for the renderer
+  long ahead;               // frames rendered ahead of live playback
+  long aheadmin;            // lowest since the statistics were reset, -1 if none
+  float rendertime;         // time to render the last block relative to its length
+  float renderavg;          // smoothed
+  float rendermax;          // highest since the statistics were reset
+  unsigned long renders;    // blocks timed
+  float voiceload[MAX_CHANNELS]; // smoothed render time of each voice relative to block length
+  int realtime;             // threads running with realtime priority
+  int quality;              // engine quality level set by the governor
+} audio_stats;
+
 int audio_initialize(void);
-int audio_isplaying(void);
+void audio_threadsetup(int thread);
+void audio_getstats(audio_stats *s);
+void audio_resetstats(void);
 void audio_release(void);
 int audio_update(int cs);
 int audio_process(short *buffer, long bufferlen);
+int audio_processaudition(short *buffer, long bufferlen);
+int audio_auditionlatency(float *latest, float *average);
 
 void audio_loadpatch(int voice, int synth, int patch);
 void audio_trignote(int voice, int note);
+void audio_noteoff(int voice);
 
 void audio_panic(void);
+void audio_publish(void);
+void audio_commit(void);
+void audio_songchanged(void);
+void audio_patchchanged(int reload);
+void audio_paramchanged(int synth, int patch, int module);
 void audio_resetsynth(int voice);
 
 int audio_exportwav(); //char *filename);
@@ -0,0 +1,67 @@
+/*
+ * Komposter
+ *
+ * Copyright (c) 2010 Noora Halme et al. (see AUTHORS)
+ *
+ * This code is licensed under the GNU General Public
+ * License version 2. See LICENSE for full text.
+ *
+ * Audio output backends
+ *
+ */
+
+#ifndef __AUDIOOUT_H__
+#define __AUDIOOUT_H__
+
+// output streams
+#define AUDIOOUT_SONG		0 // song playback
+#define AUDIOOUT_AUDITION	1 // the synth being edited
+#define AUDIOOUT_STREAMS	2
+
+// flags for opening a backend
+#define AUDIOOUT_MAXSPEED	1 // null and file sinks consume frames as fast as they are rendered
+
+// fills a buffer with frames of 16-bit stereo audio
+typedef int (*audioout_fill)(short *buffer, long frames);
+
+/*
+  a backend plays a number of streams, each made of a ring of buffers
+  that are refilled by calling the fill function of the stream when
+  the backend is done with them. update() is called regularly from the
+  playback thread, all the other functions from the thread that set up
+  audio.
+*/
+typedef struct {
+  const char *name;
+
+  // open a device, or the default one if NULL. returns 1 or 0 on failure
+  int (*open)(const char *device, int flags);
+  void (*close)(void);
+
+  // start a stream of buffers of frames each. returns 1 or 0 on failure
+  int (*start)(int stream, int buffers, long frames, audioout_fill fill);
+
+  // refill the buffers played since last call. returns how many
+  int (*update)(int stream);
+
+  // frames queued ahead of what is being heard
+  long (*latency)(int stream);
+} audioout_backend;
+
+extern audioout_backend audioout_openal;
+extern audioout_backend audioout_null;
+extern audioout_backend audioout_file;
+
+// backend by name, NULL if unknown
+audioout_backend *audioout_find(const char *name);
+
+// called by the backends when a stream ran dry
+void audioout_underrun(int stream);
+
+// frames of a stream that can be taken without running into a gap in
+// what has been rendered, LONG_MAX if all of the run is there or -1 if
+// the stream isn't playing a run. the null and file sinks go by this
+// with AUDIOOUT_MAXSPEED and by the clock when it's -1
+long audioout_ready(int stream);
+
+#endif
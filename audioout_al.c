@@ -0,0 +1,162 @@
+/*
+ * Komposter
+ *
+ * Copyright (c) 2010 Noora Halme et al. (see AUTHORS)
+ *
+ * This code is licensed under the GNU General Public
+ * License version 2. See LICENSE for full text.
+ *
+ * OpenAL audio output
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "audio.h"
+#include "audioout.h"
+
+#define AL_MAXBUFFERS	4
+
+typedef struct {
+  ALuint source;
+  ALuint buffers[AL_MAXBUFFERS];
+  int count;
+  long frames;
+  audioout_fill fill;
+  short *data;
+} al_stream;
+
+static ALCdevice *dev;
+static ALCcontext *ctx;
+static al_stream al_streams[AUDIOOUT_STREAMS];
+
+
+static int al_open(const char *device, int flags)
+{
+  dev=alcOpenDevice(device);
+  if (dev==NULL) { printf("alcOpenDevice() failed to return a device!\n"); return 0; }
+  ctx=alcCreateContext(dev, NULL);
+  if (ctx==NULL) { printf("alcCreateContext() failed to return a context!\n"); return 0; }
+  alcMakeContextCurrent(ctx);
+  return 1;
+}
+
+
+static void al_close(void)
+{
+  ALuint buffer;
+  al_stream *s;
+  int i, queued;
+
+  for(i=0;i<AUDIOOUT_STREAMS;i++) {
+    s=&al_streams[i];
+    if (!s->count) continue;
+    alSourceStop(s->source);
+    alGetSourcei(s->source, AL_BUFFERS_QUEUED, &queued);
+    while(queued--)
+      alSourceUnqueueBuffers(s->source, 1, &buffer);
+    alDeleteSources(1, &s->source);
+    alDeleteBuffers(s->count, s->buffers);
+    free(s->data);
+    s->count=0;
+  }
+}
+
+
+// set up a streaming source and start it playing silence
+static int al_start(int stream, int buffers, long frames, audioout_fill fill)
+{
+  al_stream *s=&al_streams[stream];
+  int error, i;
+
+  if (buffers > AL_MAXBUFFERS) buffers=AL_MAXBUFFERS;
+  s->data=calloc(frames*2, sizeof(short)); //16bit stereo
+  if (!s->data) return 0;
+  s->frames=frames;
+  s->fill=fill;
+
+  alGenBuffers(buffers, s->buffers);
+  if (alGetError()!=AL_NO_ERROR) { printf("Failed to generate audio buffers!\n"); return 0; }
+  alGenSources(1, &s->source);
+  if (alGetError()!=AL_NO_ERROR) { printf("Failed to generate audio source\n"); return 0; }
+  s->count=buffers;
+
+  // set positions  
+  alSource3f(s->source, AL_POSITION,        0.0, 0.0, 0.0);
+  alSource3f(s->source, AL_VELOCITY,        0.0, 0.0, 0.0);
+  alSource3f(s->source, AL_DIRECTION,       0.0, 0.0, 0.0);
+  alSourcef (s->source, AL_ROLLOFF_FACTOR,  0.0          );
+  alSourcei (s->source, AL_SOURCE_RELATIVE, AL_TRUE      );
+
+  // set gain
+  alSourcef(s->source, AL_GAIN, 1.0f);
+
+  // queue empty zeroed buffers
+  for(i=0;i<buffers;i++) alBufferData(s->buffers[i], AL_FORMAT_STEREO16, s->data, frames*4, OUTPUTFREQ);
+
+  // start playback
+  alSourceQueueBuffers(s->source, buffers, s->buffers);
+  error=alGetError();
+  if (error!=AL_NO_ERROR) { printf("Failed to queue source buffers (err %d/0x%x)\n",error,error); return 0; }
+  alSourcePlay(s->source);
+  if (alGetError()!=AL_NO_ERROR) { printf("Failed to start source playback\n"); return 0; }
+  return 1;
+}
+
+
+static int al_update(int stream)
+{
+  al_stream *s=&al_streams[stream];
+  int processed, active;
+  ALuint buffer;
+  ALenum state;
+
+  if (!s->count) return 0;
+  active=0;
+  alGetSourcei(s->source, AL_BUFFERS_PROCESSED, &processed);
+  while(processed--)
+  {
+    alSourceUnqueueBuffers(s->source, 1, &buffer);
+    if (alGetError()!=AL_NO_ERROR) return 0;
+
+    // fill data and queue the buffer
+    s->fill(s->data, s->frames);
+    alBufferData(buffer, AL_FORMAT_STEREO16, s->data, s->frames*4, OUTPUTFREQ);
+    active++;
+
+    alSourceQueueBuffers(s->source, 1, &buffer);
+    if (alGetError()!=AL_NO_ERROR) return 0;
+  }
+
+  // restart if the buffers ran out
+  alGetSourcei(s->source, AL_SOURCE_STATE, &state);
+  if (state!=AL_PLAYING) {
+    audioout_underrun(stream);
+    alSourcePlay(s->source);
+  }
+  return active; // number of buffers re-filled
+}
+
+
+static long al_latency(int stream)
+{
+  al_stream *s=&al_streams[stream];
+  int queued, offset;
+
+  if (!s->count) return 0;
+  alGetSourcei(s->source, AL_BUFFERS_QUEUED, &queued);
+  alGetSourcei(s->source, AL_SAMPLE_OFFSET, &offset);
+  return queued*s->frames - offset;
+}
+
+
+audioout_backend audioout_openal={
+  .name="openal",
+  .open=al_open,
+  .close=al_close,
+  .start=al_start,
+  .update=al_update,
+  .latency=al_latency
+};
+
@@ -0,0 +1,212 @@
+/*
+ * Komposter
+ *
+ * Copyright (c) 2010 Noora Halme et al. (see AUTHORS)
+ *
+ * This code is licensed under the GNU General Public
+ * License version 2. See LICENSE for full text.
+ *
+ * Null and file audio output
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "audio.h"
+#include "audioout.h"
+
+/*
+  the null sink throws the audio away and the file sink writes the song
+  stream to a wav file. both take buffers from the streams at the pace
+  they would play on a device, or as fast as the song is rendered with
+  the AUDIOOUT_MAXSPEED flag, which makes them useful for benchmarking
+  and soak testing live playback without a sound device. at max speed
+  they never run ahead of the renderer, so the file has no gaps, and
+  go by the clock again when no run is playing. the file stops growing
+  at the largest size a wav header can hold.
+*/
+
+typedef struct {
+  int count;
+  long frames;
+  audioout_fill fill;
+  short *data;
+  struct timespec start; // when the stream started playing
+  unsigned long played;  // buffers taken since then
+} null_stream;
+
+// most audio data a wav file can hold with the riff size in 32 bits
+#define NULL_MAXBYTES	(0xffffffffULL-36)
+
+static null_stream null_streams[AUDIOOUT_STREAMS];
+static int null_flags;
+static FILE *null_file=NULL;
+static unsigned long long null_filebytes;
+
+
+// frames played on the wall clock since the stream started
+static long null_clock(null_stream *s)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec-s->start.tv_sec)*OUTPUTFREQ + (now.tv_nsec-s->start.tv_nsec)/(1000000000/OUTPUTFREQ);
+}
+
+
+static int null_open(const char *device, int flags)
+{
+  null_flags=flags;
+  return 1;
+}
+
+
+static void null_close(void)
+{
+  int i;
+
+  for(i=0;i<AUDIOOUT_STREAMS;i++) {
+    free(null_streams[i].data);
+    null_streams[i].data=NULL;
+    null_streams[i].count=0;
+  }
+}
+
+
+static int null_start(int stream, int buffers, long frames, audioout_fill fill)
+{
+  null_stream *s=&null_streams[stream];
+
+  s->data=calloc(frames*2, sizeof(short)); //16bit stereo
+  if (!s->data) return 0;
+  s->count=buffers;
+  s->frames=frames;
+  s->fill=fill;
+  s->played=0;
+  clock_gettime(CLOCK_MONOTONIC, &s->start);
+  return 1;
+}
+
+
+static int null_update(int stream)
+{
+  null_stream *s=&null_streams[stream];
+  long due, ready;
+  int n, i;
+
+  if (!s->count) return 0;
+  ready=(null_flags&AUDIOOUT_MAXSPEED) ? audioout_ready(stream) : -1;
+  if (ready>=0) {
+    // only what has been rendered, rather than underrun silence. the
+    // clock starts over from here for when the run is done
+    due=ready/s->frames;
+    n=(due > s->count) ? s->count : due;
+    clock_gettime(CLOCK_MONOTONIC, &s->start);
+    s->played=0;
+  } else {
+    // keep the buffers queued ahead of the clock like a device would
+    due=null_clock(s)/s->frames + s->count - s->played;
+    if (due > s->count) {
+      // all buffers played before they were refilled
+      audioout_underrun(stream);
+      s->played+=due-s->count;
+      due=s->count;
+    }
+    n=due;
+  }
+
+  for(i=0;i<n;i++) {
+    s->fill(s->data, s->frames);
+    if (null_file && stream==AUDIOOUT_SONG && null_filebytes+s->frames*4 <= NULL_MAXBYTES) {
+      fwrite(s->data, s->frames*4, 1, null_file);
+      null_filebytes+=s->frames*4;
+    }
+    s->played++;
+  }
+  return n;
+}
+
+
+static long null_latency(int stream)
+{
+  null_stream *s=&null_streams[stream];
+
+  if (!s->count || (null_flags&AUDIOOUT_MAXSPEED)) return 0;
+  return s->played*s->frames - null_clock(s);
+}
+
+
+audioout_backend audioout_null={
+  .name="null",
+  .open=null_open,
+  .close=null_close,
+  .start=null_start,
+  .update=null_update,
+  .latency=null_latency
+};
+
+
+// wav header for 16-bit stereo, the sizes are filled in on close
+static void file_header(u32 databytes)
+{
+  u32 dw[3];
+  unsigned short w[2];
+
+  fwrite("RIFF", 4, 1, null_file);
+  dw[0]=36+databytes;
+  fwrite(dw, 4, 1, null_file);
+  fwrite("WAVEfmt ", 8, 1, null_file);
+  dw[0]=16;
+  fwrite(dw, 4, 1, null_file);
+  w[0]=1; w[1]=2; // pcm, stereo
+  fwrite(w, 2, 2, null_file);
+  dw[0]=OUTPUTFREQ; dw[1]=OUTPUTFREQ*2*2;
+  fwrite(dw, 4, 2, null_file);
+  w[0]=2*2; w[1]=16; // block align, bits per sample
+  fwrite(w, 2, 2, null_file);
+  fwrite("data", 4, 1, null_file);
+  dw[0]=databytes;
+  fwrite(dw, 4, 1, null_file);
+}
+
+
+static int file_open(const char *device, int flags)
+{
+  char path[512];
+
+  if (device) {
+    strncpy(path, device, 511);
+    path[511]=0;
+  } else {
+    snprintf(path, 511, "%s/komposter_output_%u.wav", getenv("HOME"), (int)time(NULL));
+  }
+  null_file=fopen(path, "wb");
+  if (!null_file) { printf("Failed to open %s for audio output\n", path); return 0; }
+  printf("Writing audio output to %s\n", path);
+  null_filebytes=0;
+  file_header(0);
+  return null_open(device, flags);
+}
+
+
+static void file_close(void)
+{
+  null_close();
+  if (!null_file) return;
+  fseek(null_file, 0, SEEK_SET);
+  file_header(null_filebytes);
+  fclose(null_file);
+  null_file=NULL;
+}
+
+
+audioout_backend audioout_file={
+  .name="file",
+  .open=file_open,
+  .close=file_close,
+  .start=null_start,
+  .update=null_update,
+  .latency=null_latency
+};
@@ -10,7 +10,12 @@
  *
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include "buffermm.h"
+#include "rtlog.h"
 
 /*
   memory management for keeping count on what buffers have been allocated and if they are still in use
@@ -35,22 +40,14 @@
 
   all in all - this is a pretty big mess and there has to be a better way to handle this. :)
 
-*/
-
-
-// from audio.c
-extern float localdata[MAX_CHANNELS][MAX_MODULES][16];
-
-// from synthesizer.c
-extern synthmodule mod[MAX_SYNTH][MAX_MODULES];
-
-// from sequencer.c
-extern int seq_synth[MAX_CHANNELS]; // which synth assigned to each channel
-
+  each entry also records the engine context the buffer belongs to, since there can be several
+  engines in one process. the table is shared, so all access to it goes through kmm_lock.
 
+*/
 
 
 typedef struct {
+  kengine *engine;
   void *ptr;
   unsigned long bytes;
   int voice;
@@ -61,12 +58,15 @@ typedef struct {
 
 
 kmm_mement kmmtable[KMM_ENTRIES];
+pthread_mutex_t kmm_lock=PTHREAD_MUTEX_INITIALIZER;
 
 
 void kmm_init(void)
 {
   int i;
+  pthread_mutex_lock(&kmm_lock);
   for(i=0;i<KMM_ENTRIES;i++) {
+    kmmtable[i].engine=NULL;
     kmmtable[i].ptr=NULL;
     kmmtable[i].bytes=0;
     kmmtable[i].voice=0xfe;
@@ -74,19 +74,22 @@ void kmm_init(void)
     kmmtable[i].module=0xfe;
     kmmtable[i].modtype=0xfe;
   }
+  pthread_mutex_unlock(&kmm_lock);
 }
 
 
-void *kmm_alloc(unsigned long len, int voice, int synth, int module, int modtype)
+void *kmm_alloc(kengine *e, unsigned long len, int voice, int synth, int module, int modtype)
 {
   int i;
   void *buffer;
   
-//  buffer=calloc(len, sizeof(unsigned long));
-  buffer=malloc(len*sizeof(u32));
+  // zeroed so that a delay line never plays back stale heap contents
+  buffer=calloc(len, sizeof(u32));
   if (buffer) {
+    pthread_mutex_lock(&kmm_lock);
     for(i=0;i<KMM_ENTRIES;i++) {
       if (!kmmtable[i].ptr) {
+        kmmtable[i].engine=e;
         kmmtable[i].ptr=buffer;
         kmmtable[i].bytes=len*sizeof(u32);
         kmmtable[i].voice=voice;
@@ -94,52 +97,70 @@ void *kmm_alloc(unsigned long len, int voice, int synth, int module, int modtype
         kmmtable[i].module=module;
         kmmtable[i].modtype=modtype;
 
-        printf("kmm: module data buffer allocated from %08lx - len %d (%d bytes), v %d s %d mi %d mt %d\n",
+        rtlog(0, "kmm: module data buffer allocated from %08lx - len %lu (%lu bytes), v %d s %d mi %d mt %d",
           (unsigned long)buffer, len, len*sizeof(u32), voice,synth,module,modtype);
         
+        pthread_mutex_unlock(&kmm_lock);
         return buffer;
       }
     }
+    pthread_mutex_unlock(&kmm_lock);
+    free(buffer);
   }
   return 0; // table is full
 }
 
 
 
-void kmm_gcollect(void)
+// free the buffers of an engine which it no longer uses. the buffers of
+// other engines are left alone, since they may be rendering right now
+void kmm_gcollect(kengine *e)
 {
   int i;
 
   // scan the kmm table and free any buffers which are no longer being used
+  pthread_mutex_lock(&kmm_lock);
   for(i=0;i<KMM_ENTRIES;i++) {
-    if (kmmtable[i].ptr) {
-      if (seq_synth[kmmtable[i].voice] != kmmtable[i].synth) {
+    if (kmmtable[i].ptr && kmmtable[i].engine==e) {
+      if (e->seq_synth[kmmtable[i].voice] != kmmtable[i].synth) {
         // channel no longer uses this synth -> release the buffer
-//        printf("kmm: synth changed, releasing module data from %08lx\n", (unsigned long)kmmtable[i].ptr);
-printf("kmm: synth changed, releasing module data from %08lx (v %d s %d mi %d mt %d)\n",
-  (unsigned long)kmmtable[i].ptr, kmmtable[i].voice, kmmtable[i].synth, kmmtable[i].module, kmmtable[i].modtype);
+        rtlog(0, "kmm: synth changed, releasing module data from %08lx (v %d s %d mi %d mt %d)",
+          (unsigned long)kmmtable[i].ptr, kmmtable[i].voice, kmmtable[i].synth, kmmtable[i].module, kmmtable[i].modtype);
         free(kmmtable[i].ptr);
 
-        memset(&localdata[kmmtable[i].voice][kmmtable[i].module][0], 0, sizeof(void*));
-//        localdata[kmmtable[i].voice][kmmtable[i].module][0]=0;
-
+        memset(&e->localdata[kmmtable[i].voice][kmmtable[i].module][0], 0, sizeof(void*));
         kmmtable[i].ptr=NULL;
         continue;
       }
 
-      if (kmmtable[i].modtype != mod[kmmtable[i].synth][kmmtable[i].module].type) {
+      if (kmmtable[i].modtype != e->mod[kmmtable[i].synth][kmmtable[i].module].type) {
         // module type has changed or it has been deleted -> release
-//        printf("kmm: modtype changed, releasing module data from %08lx\n", (unsigned long)kmmtable[i].ptr);
-printf("kmm: modtype changed, releasing module data from %08lx (v %d s %d mi %d mt %d)\n",
-  (unsigned long)kmmtable[i].ptr, kmmtable[i].voice, kmmtable[i].synth, kmmtable[i].module, kmmtable[i].modtype);
+        rtlog(0, "kmm: modtype changed, releasing module data from %08lx (v %d s %d mi %d mt %d)",
+          (unsigned long)kmmtable[i].ptr, kmmtable[i].voice, kmmtable[i].synth, kmmtable[i].module, kmmtable[i].modtype);
         free(kmmtable[i].ptr);
 
-        memset(&localdata[kmmtable[i].voice][kmmtable[i].module][0], 0, sizeof(void*));
-//        localdata[kmmtable[i].voice][kmmtable[i].module][0]=0;
- 
+        memset(&e->localdata[kmmtable[i].voice][kmmtable[i].module][0], 0, sizeof(void*));
         kmmtable[i].ptr=NULL;
         continue;
       }
     }
   }
-}
\ No newline at end of file
+  pthread_mutex_unlock(&kmm_lock);
+}
+
+
+// release all buffers owned by an engine that is about to be freed
+void kmm_release(kengine *e)
+{
+  int i;
+
+  pthread_mutex_lock(&kmm_lock);
+  for(i=0;i<KMM_ENTRIES;i++) {
+    if (kmmtable[i].ptr && kmmtable[i].engine==e) {
+      free(kmmtable[i].ptr);
+      memset(&e->localdata[kmmtable[i].voice][kmmtable[i].module][0], 0, sizeof(void*));
+      kmmtable[i].ptr=NULL;
+    }
+  }
+  pthread_mutex_unlock(&kmm_lock);
+}
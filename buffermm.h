@@ -13,15 +13,14 @@
 #ifndef __BUFFERMM_H__
 #define __BUFFERMM_H__
 
-#include "modules.h"
-#include "pattern.h"
-#include "synthesizer.h"
+#include "engine.h"
 
 
 #define KMM_ENTRIES     1024
 
 void kmm_init(void);
-void *kmm_alloc(unsigned long bytes, int voice, int synth, int module, int modtype);
-void kmm_gcollect(void);
+void *kmm_alloc(kengine *e, unsigned long bytes, int voice, int synth, int module, int modtype);
+void kmm_gcollect(kengine *e);
+void kmm_release(kengine *e);
 
 #endif
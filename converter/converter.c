@@ -17,6 +17,7 @@
 #include "constants.h"
 #include "fileops.h"
 #include "modules.h"
+#include "packsize.h"
 
 
 // from synthesizer.c
@@ -30,7 +31,7 @@ float modvalue[MAX_SYNTH][MAX_PATCHES][MAX_MODULES];
 int modquantifier[MAX_SYNTH][MAX_PATCHES][MAX_MODULES];
 
 // from pattern.c
-unsigned long pattdata[MAX_PATTERN][MAX_PATTLENGTH];
+unsigned int pattdata[MAX_PATTERN][MAX_PATTLENGTH];
 unsigned int pattlen[MAX_PATTERN];
 
 // from sequencer.c
@@ -53,16 +54,45 @@ int patchct;
 int synthlen[MAX_SYNTH];
 int synthstart[MAX_SYNTH];
 int patchstart[MAX_SYNTH*MAX_PATCHES];
-
-int patternstart[MAX_CHANNELS];
+int patternstart[MAX_PATTERN+1];
 
 int synthmap[MAX_SYNTH];
+int synthindex[MAX_SYNTH]; // new index of each synth used
+int synths; // number of synths used
+int modused[MODTYPES]; // module types used by the synths
+int folded[MAX_SYNTH], removed[MAX_SYNTH]; // modules folded into constants
 int patchmap[MAX_SYNTH*MAX_PATCHES];
 int patternmap[MAX_PATTERN];
 
 
 int delays=0; // how many delays are used simultaneously
 int truesonglen;
+int notefirst=255, notelast=-1; // range of notes played
+int rawsong=0; // write songdata as one word per row instead of events
+int cheader=0; // write a c header for kplayer.c instead of nasm
+int synthcode=0; // write the synths as c code for kplayer.c
+int sizereport=0; // print the estimated packed size of each table
+int compactlayout=0; // write the tables in the layout that packs best
+char *srcname;
+
+// tables for the player, built from the song before writing them out
+int tickdivider;
+int modcount; // entries in modtypes and modinputs
+unsigned char modtypes[MAX_SYNTH*(MAX_MODULES+1)];
+unsigned char modinputs[MAX_SYNTH*(MAX_MODULES+1)][4]; // ms[0] to ms[3]
+int patchcount; // entries in patchdata
+unsigned int patchdata[MAX_SYNTH*MAX_PATCHES*(MAX_MODULES+1)]; // float or integer bits
+unsigned char patchkind[MAX_SYNTH*MAX_PATCHES*(MAX_MODULES+1)]; // 0=no modulator, 1=float, 2=integer
+unsigned short songdata[MAX_CHANNELS][MAX_SONGLEN*16]; // raw song, one word per row
+int songrows[MAX_CHANNELS];
+int eventcount; // bytes in patternevents
+unsigned char patternevents[MAX_PATTERN*MAX_PATTLENGTH*4];
+unsigned char songorder[MAX_CHANNELS][MAX_SONGLEN*2+1][4]; // order list entries
+int orderpos[MAX_CHANNELS][MAX_SONGLEN*2+1]; // song position of each entry, -1 at the end
+int ordercount[MAX_CHANNELS];
+
+// note events of one pattern being encoded
+unsigned char events[MAX_PATTLENGTH*2*2];
 
 // comparison function for sorting the sequencer events
 int sqcompare(const void* va, const void* vb) {
@@ -74,39 +104,126 @@ int sqcompare(const void* va, const void* vb) {
   return 0;
 }
 
-int main(int argc, char **argv) {
-  int r, v, m, s, i, p, n, d, l, t, o;
-  float f;
-  unsigned int u;
-  unsigned char sc;
-  unsigned short note;
+// widen the range of notes played to cover a pattern at a transpose
+void note_range(int pattern, int transpose) {
+  int n, d;
 
-  // load the ksong file to memory
-  if (argc!=2) {
-    printf("komposter ksong converter (c) 2010 firehawk/tda\n\nusage:  %s <filename.ksong>\n\n", argv[0]);
-    return -1;
+  for(n=0; n<pattlen[pattern]*16; n++) {
+    if (pattdata[pattern][n] > 0) {
+      d=(pattdata[pattern][n] & 0x7f)+transpose;
+      if (d<notefirst) notefirst=d;
+      if (d>notelast) notelast=d;
+    }
   }
-  r=load_ksong(argv[1]);
-  if (r) { printf("Error loading .ksong! Errorcode %08x\n", r); return -1; }
+}
 
-  // song is now loaded to the data variables defined above. so if you want to
-  // use your own player code, you'll need to modify the code below to suit your
-  // needs. the example code i've included here uses my x86 assembly language
-  // player which is provided as a reference implementation. the code is in nasm
-  // syntax.
-  //
-  // this coverter will also strip any patterns and patches not actually used
-  // from the output. this way the composer can send worktunes with additional
-  // stuff in them and the coder can still get a good idea on how the tune will
-  // actually compress.
-  //
-  // TODO: stripping unused synthesizers from the output - use synthmap to remap
-  // the indexes. currently all synthesizsers in the ksong are converted.
-  //
+// fold the modules of a synth whose inputs are all constant for a patch,
+// like knobs scaled or mixed together. the ones feeding other modules
+// become knobs holding the result for each patch, and the rest drop out
+// of the signal stack when it is rebuilt
+void fold_synth(int s) {
+  static float value[MAX_PATCHES][MAX_MODULES];
+  unsigned char constant[MAX_MODULES];
+  int m, mi, t, i, ii, p, before;
+  float ms[4], f;
 
-  // header
-  printf(";; generated with komposter ksong-to-NASM converter (c) 2010 firehawk/tda\n;;\n");
-  printf(";; source file:\n;;   %s\n;;\n", argv[1]);
+  synth_stackify(s);
+  memset(constant, 0, sizeof(constant));
+  for(m=0;signalfifo[s][m]>=0;m++) {
+    mi=signalfifo[s][m];
+    t=mod[s][mi].type;
+    if (!modFoldable[t]) continue;
+    constant[mi]=1;
+    for(i=0;i<modInputCount[t];i++) {
+      ii=mod[s][mi].input[i];
+      if (ii>=0 && !constant[ii]) constant[mi]=0;
+    }
+    if (!constant[mi]) continue;
+
+    // same arithmetic as the modules in the editor
+    for(p=0;p<MAX_PATCHES;p++) {
+      for(i=0;i<4;i++) {
+        ii=(i<modInputCount[t]) ? mod[s][mi].input[i] : -1;
+        ms[i]=(ii>=0) ? value[p][ii] : 0.0f;
+      }
+      switch(t) {
+        case MOD_KNOB:       f=modvalue[s][p][mi]; break;
+        case MOD_ATTENUATOR: f=ms[0]*modvalue[s][p][mi]; break;
+        case MOD_AMPLIFIER:  f=ms[0]*ms[1]; break;
+        case MOD_MIXER:      f=ms[0]+ms[1]+ms[2]+ms[3]; break;
+        case MOD_DISTORT:
+        default:
+          f=ms[0]*ms[1];
+          if (fabs(f)>1.0) f=f/fabs(f);
+          break;
+      }
+      value[p][mi]=f;
+    }
+  }
+  before=m;
+
+  // replace the constants feeding the rest of the synth with knobs
+  folded[s]=0;
+  for(m=0;signalfifo[s][m]>=0;m++) {
+    mi=signalfifo[s][m];
+    if (constant[mi]) continue;
+    for(i=0;i<modInputCount[mod[s][mi].type];i++) {
+      ii=mod[s][mi].input[i];
+      if (ii<0 || !constant[ii] || mod[s][ii].type==MOD_KNOB) continue;
+      mod[s][ii].type=MOD_KNOB;
+      for(t=0;t<4;t++) mod[s][ii].input[t]=-1;
+      for(p=0;p<MAX_PATCHES;p++) modvalue[s][p][ii]=value[p][ii];
+      folded[s]++;
+    }
+  }
+  synth_stackify(s);
+  for(m=0;signalfifo[s][m]>=0;m++);
+  removed[s]=before-m;
+}
+
+// encode the notes of a pattern as a stream of events. the stream starts
+// with the number of rows to skip before the first event. each event is
+// then a note byte (bit 7 for note off, 0 for no new note) followed by
+// the number of rows to skip before the next one, with bit 7 set for an
+// accent on this note. gaps longer than 127 rows are bridged with empty
+// events. returns the length of the stream in bytes
+int encode_pattern(int pattern) {
+  int n, d, len, last, gap, noteon;
+  unsigned char note, accent;
+
+  len=0; last=-1; accent=0; noteon=0;
+  for(n=0; n<=pattlen[pattern]*16; n++) {
+    note=0;
+    if (n<pattlen[pattern]*16) {
+      if (!pattdata[pattern][n]) continue;
+      d=pattdata[pattern][n] & 0x7f;
+      if (noteon != d) {
+        note=d;
+        noteon=d;
+      }
+      if (n+1>=pattlen[pattern]*16 || !(pattdata[pattern][n+1]&NOTE_LEGATO)) { note|=0x80; noteon=0; }
+      if (!note) continue; // tied to the same note, nothing to play
+    }
+    for(gap=n-last-1; gap>127; gap-=128) {
+      events[len++]=accent|127;
+      events[len++]=0;
+      accent=0;
+    }
+    events[len++]=accent|gap;
+    if (n==pattlen[pattern]*16) break; // end of pattern, never reached
+    events[len++]=note;
+    accent=((note&0x7f) && (pattdata[pattern][n]&NOTE_ACCENT)) ? 0x80 : 0;
+    last=n;
+  }
+  return len;
+}
+
+// gather the tables for the player from the loaded song
+void build_tables(void) {
+  int r, v, m, s, i, p, n, d, l, t, patch;
+  float f;
+  unsigned int u;
+  unsigned short note;
 
   // gather a list of synthesizers used and map them to new indexes
   memset(&synthmap, -1, MAX_SYNTH*4);
@@ -114,10 +231,8 @@ int main(int argc, char **argv) {
     for(p=0;synthmap[p]>=0;p++) if (synthmap[p]==seq_synth[v]) break;
     if(synthmap[p]<0) synthmap[p]=seq_synth[v];
   }
-  printf(";; synthesizers used:\n");
-  for(i=0;synthmap[i]>=0;i++) printf(";;   %02x : (%02x:%-24s)\n",
-    i, synthmap[i], synthname[synthmap[i]]);
-  printf(";;\n");
+  for(synths=0;synths<MAX_SYNTH && synthmap[synths]>=0;synths++)
+    synthindex[synthmap[synths]]=synths;
 
   // before saving the patches and patterns, scan through the play sequence
   // to see which ones are actually used. they are stored into arrays and
@@ -136,15 +251,6 @@ int main(int argc, char **argv) {
       }
     }
   }
-  printf(";; patterns used:\n;;   ");
-  for(i=0;patternmap[i]>=0;i++) {
-     printf("%02x ", patternmap[i]);
-     if ((i&15)==15) printf("\n;;   ");
-  }
-  printf("\n;;\n;; patches used:\n");
-  for(i=0;patchmap[i]>=0;i++) printf(";;   %02x : (%02x:%-24s) patch (%02x:%-24s)\n", 
-    i, patchmap[i]>>8, synthname[patchmap[i]>>8], patchmap[i]&255, patchname[patchmap[i]>>8][patchmap[i]&255]);
-  printf(";;\n;;\n\n");
 
   // find out the number of delay modules used during playback
   delays=0;
@@ -166,56 +272,34 @@ int main(int argc, char **argv) {
   }
   truesonglen=m;
 
-  // number of channels and synthesizers
-  printf("%%define NUM_CHANNELS %d\n", seqch);
-  printf("%%define NUM_SYNTHS %d\n", synthct);
-  printf("%%define NUM_DELAYS %d\n", delays);
-  printf("%%define SONG_LEN %d\n", truesonglen*16);
-  printf("\n");
-
   // bpm rate converted to a tick divider (max. 255)
-  t=OUTPUTFREQ/(bpm*256/60);
-  printf("\n; bpm %d at %dhz sample rate\ntickdivider dd %05xh\n\n",bpm,OUTPUTFREQ,t);
+  tickdivider=OUTPUTFREQ/(bpm*256/60);
 
-  // master volume multiplier
-  printf("; master volume is %f\nsamplemul dd %f\n\n", 1.0, 32766.0);
- 
   // stackify each synth prior to converting and populate the fifopos member on each struct
-  for(s=0;s<synthct;s++) {
-    synth_stackify(s);
+  memset(&modused, 0, sizeof(modused));
+  modused[MOD_KNOB]=1; // for the dummy module at the start of each stack
+  for(i=0;i<synths;i++) {
+    s=synthmap[i];
+    fold_synth(s);
     m=0;
     while (signalfifo[s][m]>=0) {
       mod[s][signalfifo[s][m]].fifopos=m;
+      modused[mod[s][signalfifo[s][m]].type]=1;
       m++;
     }    
-  }
- 
-  // function pointer lists for synthesizer signal stacks
-  i=1;
-  printf("modfunctions: ; function pointers to modules\n");
-  for(s=0;s<synthct;s++) {
-    printf(".fp_s%02x:\n\tdd module_func_cv", s);
-    m=0;
-    while (signalfifo[s][m]>=0) {
-      if (m&3) printf(", "); else printf("\n\tdd ");
-      printf("module_func_%s", modFunctionNames[ mod[s][signalfifo[s][m]].type ]);
-//      if ((m&3)==3) printf("\n\tdd ");
-      m++;
-    }
-    printf("\n");
     synthlen[s]=m;
-    i+=m;
   }
-  printf("\n");
 
-  // synth module inputs
+  // module types and inputs for the synthesizer signal stacks. each stack
+  // starts with a dummy cv module which feeds zero to the unconnected inputs
   i=0;
-  printf("modinputs: ; wiring within each synthesizer\n");
-  for(s=0;s<synthct;s++) {   
-    synthstart[s]=i;
-    printf(".in_s%02x:\n\tdb 000h, 000h, 000h, 000h ; %02x: dummy zero\n", s, i++);
-    m=0;
-    while (signalfifo[s][m]>=0) {
+  for(n=0;n<synths;n++) {
+    s=synthmap[n];
+    synthstart[n]=i;
+    modtypes[i]=MOD_KNOB;
+    memset(modinputs[i++], 0, 4);
+    for(m=0;signalfifo[s][m]>=0;m++) {
+      modtypes[i+m]=mod[s][signalfifo[s][m]].type;
       for(r=0;r<4;r++) {
         // get the fifo position instead
         if (mod[s][signalfifo[s][m]].input[r]>=0) {
@@ -224,84 +308,293 @@ int main(int argc, char **argv) {
         } else {
           mod[s][signalfifo[s][m]].input[r]=0; // unconnected, feed zero from the dummy
         }
+        modinputs[i+m][r]=mod[s][signalfifo[s][m]].input[r];
       }
+    }
+    i+=m;
+  }
+  modcount=i;
+
+  // the patch modulator data
+  r=0;
+  for(i=0;patchmap[i]>=0;i++) {
+    patchstart[i]=r;
+    s=patchmap[i]>>8;
+    p=patchmap[i]&255;
+    f=0.0; patchkind[r]=1;
+    memcpy(&patchdata[r++], &f, 4);
+    for(m=0;signalfifo[s][m]>=0;m++,r++) {
+      t=mod[s][signalfifo[s][m]].type;
+      f=modvalue[s][p][signalfifo[s][m]];
+      switch (modModulatorTypes[t]) {
+        // 0=no modulator, 1=float, 2=integer
+        case 0:
+          patchkind[r]=0;
+          patchdata[r]=0;
+          break;
+        case 1:
+          patchkind[r]=1;
+          memcpy(&patchdata[r], &f, 4);
+          break;
+        case 4: // lfo, 0=triangle, 1=sine
+          patchkind[r]=2;
+          patchdata[r]=((int)f == 3) ? 1 : 0;
+          break;
+        case 5: // filter
+        default:
+          patchkind[r]=2;
+          patchdata[r]=(int)f;
+          break;
+      }
+    }
+  }
+  patchcount=r;
+
+  if (rawsong) {
+    // the raw note on/off data with lots of zeroes in between. :)
+    for(v=0;v<seqch;v++) {
+      int patternrepeats=0;
+      int patterntranspose=0;
+      int noteon=0;
+
+      p=0; l=0;
+      while (p<truesonglen) {
+
+        if (seq_pattern[v][p]>=0) {
+          // a new pattern on the sequence
+          i=seq_pattern[v][p]; // pattern index
+          patternrepeats = seq_repeat[v][p];
+          patterntranspose = seq_transpose[v][p];
+          patch=0;
+          for(m=0;patchmap[m]>=0;m++) 
+            if (
+                 ( (patchmap[m]&255)==seq_patch[v][p]  ) && 
+                 ( (patchmap[m]>>8)==seq_synth[v]      )
+               ) patch=m+1;
+
+          note_range(i, patterntranspose);
+
+          // i = pattern index
+          // scan through the pattern and generate notes and rests
+          for(r=0;r<patternrepeats;r++) {
+            for(n=0; n<(pattlen[i]*16); n++) {
+              note=patch<<8;
+              patch=0;
+              if (pattdata[i][n] > 0) {
+                d=pattdata[i][n] & 0x7f;
+                if (noteon != d) {
+                  note|=(d+patterntranspose); //|0x80;
+                  if (pattdata[i][n] & NOTE_ACCENT) note|=0x4000;
+                  noteon=d;
+                }
+                if (!(pattdata[i][n+1]&NOTE_LEGATO)) { note|=0x8000; noteon=0; }
+              }
+              songdata[v][l++]=note;
+              if ((n&15)==15) p++;
+            }
+          }
+        } else {
+          // no pattern here, add rest for 1 measure
+          for(n=0;n<16;n++) songdata[v][l++]=0;
+          p++;
+        }
+      }
+      songrows[v]=l;
+    }
+  } else {
+    // each pattern used as a stream of note events. pattern 0 is an empty
+    // measure used for the rests between patterns
+    patternstart[0]=0;
+    patternevents[0]=16;
+    r=1;
+    for(i=0;patternmap[i]>=0;i++) {
+      patternstart[i+1]=r;
+      l=encode_pattern(patternmap[i]);
+      memcpy(&patternevents[r], events, l);
+      r+=l;
+    }
+    patternstart[i+1]=r;
+    eventcount=r;
+
+    // order list for each channel with entries of four bytes: pattern,
+    // repeats minus one (at most 127), transpose and patch to load (0 for
+    // none). the last entry rests until the end of the buffer
+    for(v=0;v<seqch;v++) {
+      p=0; l=0;
+      while (p<truesonglen) {
+        if (seq_pattern[v][p]>=0 && seq_repeat[v][p]>0) {
+          i=seq_pattern[v][p];
+          for(n=0;patternmap[n]!=i;n++);
+          patch=0;
+          for(m=0;patchmap[m]>=0;m++)
+            if ( (patchmap[m]&255)==seq_patch[v][p] && (patchmap[m]>>8)==seq_synth[v] ) patch=m+1;
+          note_range(i, seq_transpose[v][p]);
+          for(r=seq_repeat[v][p]; r>0; r-=128, l++) {
+            songorder[v][l][0]=n+1;
+            songorder[v][l][1]=(r>128 ? 128 : r)-1;
+            songorder[v][l][2]=seq_transpose[v][p];
+            songorder[v][l][3]=patch;
+            orderpos[v][l]=p;
+            patch=0;
+          }
+          p+=seq_repeat[v][p]*pattlen[i];
+        } else {
+          // rest until the next pattern
+          for(r=0; p<truesonglen && (seq_pattern[v][p]<0 || seq_repeat[v][p]<=0); p++) r++;
+          for(n=p-r; r>0; r-=128, n+=128, l++) {
+            songorder[v][l][0]=0;
+            songorder[v][l][1]=(r>128 ? 128 : r)-1;
+            songorder[v][l][2]=0;
+            songorder[v][l][3]=0;
+            orderpos[v][l]=n;
+          }
+        }
+      }
+      songorder[v][l][0]=0;
+      songorder[v][l][1]=127;
+      songorder[v][l][2]=0;
+      songorder[v][l][3]=0;
+      orderpos[v][l++]=-1;
+      ordercount[v]=l;
+    }
+  }
+  if (notelast<0) notefirst=notelast=1;
+}
+
+// print the tables as nasm source for player.asm
+void write_nasm(void) {
+  int r, v, m, s, i, p, n, l, t;
+  float f;
+
+  // header
+  printf(";; generated with komposter ksong-to-NASM converter (c) 2010 firehawk/tda\n;;\n");
+  printf(";; source file:\n;;   %s\n;;\n", srcname);
+  printf(";; synthesizers used:\n");
+  for(i=0;synthmap[i]>=0;i++) printf(";;   %02x : (%02x:%-24s)\n",
+    i, synthmap[i], synthname[synthmap[i]]);
+  printf(";;\n");
+  printf(";; patterns used:\n;;   ");
+  for(i=0;patternmap[i]>=0;i++) {
+     printf("%02x ", patternmap[i]);
+     if ((i&15)==15) printf("\n;;   ");
+  }
+  printf("\n;;\n;; patches used:\n");
+  for(i=0;patchmap[i]>=0;i++) printf(";;   %02x : (%02x:%-24s) patch (%02x:%-24s)\n", 
+    i, patchmap[i]>>8, synthname[patchmap[i]>>8], patchmap[i]&255, patchname[patchmap[i]>>8][patchmap[i]&255]);
+  printf(";;\n;;\n\n");
+
+  // number of channels and synthesizers
+  printf("%%define NUM_CHANNELS %d\n", seqch);
+  printf("%%define NUM_SYNTHS %d\n", synths);
+  printf("%%define NUM_DELAYS %d\n", delays);
+  if (!rawsong) printf("%%define SONG_EVENTS 1\n");
+
+  // song length in rows and the tick divider. a row is 64 ticks, so the
+  // player renders SONG_LEN*64*TICKDIVIDER samples
+  printf("%%define SONG_LEN %d\n", truesonglen*16);
+  printf("%%define TICKDIVIDER %d\n", tickdivider);
+  printf("\n");
+  printf("\n; bpm %d at %dhz sample rate\ntickdivider dd TICKDIVIDER\n\n",bpm,OUTPUTFREQ);
+
+  // master volume multiplier
+  printf("; master volume is %f\nsamplemul dd %f\n\n", 1.0, 32766.0);
+
+  for(i=0;i<synths;i++) {
+    s=synthmap[i];
+    if (folded[s] || removed[s])
+      printf("; synth %02x: %d constant modules folded, %d removed\n", i, folded[s], removed[s]);
+  }
+
+  // module types used, so that the player can leave out the rest
+  printf("; modules used\n%%define USE_MODULES 1\n");
+  for(t=0;t<MODTYPES;t++)
+    if (modused[t]) printf("%%define USE_MODULE_%s 1\n", modFunctionNames[t]);
+  printf("\n");
+ 
+  // module types for synthesizer signal stacks
+  printf("modtypes: ; type of each module\n");
+  for(i=0;i<synths;i++) {
+    printf("\t; synth %02x\n\tdb %03xh\n", i, modtypes[synthstart[i]]);
+    l=synthlen[synthmap[i]];
+    for(m=0;m<l;m++) {
+      if (m&7) printf(", "); else printf("\tdb ");
+      printf("%03xh", modtypes[synthstart[i]+1+m]);
+      if ((m&7)==7) printf("\n");
+    }
+    if (m&7) printf("\n");
+  }
+  printf("\n");
+
+  // synth module inputs
+  printf("modinputs: ; wiring within each synthesizer\n");
+  for(n=0;n<synths;n++) {
+    i=synthstart[n];
+    printf(".in_s%02x:\n\tdb 000h, 000h, 000h, 000h ; %02x: dummy zero\n", n, i++);
+    l=synthlen[synthmap[n]];
+    for(m=0;m<l;m++) {
       // inputs are written in reverse order so that they end up the
       // right way when loaded as a single dword on small-endian architecture
       printf("\tdb %03xh, %03xh, %03xh, %03xh ; %02x: %02x %s\n", 
-        mod[s][signalfifo[s][m]].input[3], mod[s][signalfifo[s][m]].input[2],
-        mod[s][signalfifo[s][m]].input[1], mod[s][signalfifo[s][m]].input[0],
-        i+m, m+1, modTypeNames[mod[s][signalfifo[s][m]].type]);
-      m++;
+        modinputs[i+m][3], modinputs[i+m][2], modinputs[i+m][1], modinputs[i+m][0],
+        i+m, m+1, modTypeNames[modtypes[i+m]]);
     }
-    i+=m;
   }
   printf("\n");
 
+  // offsets to start of each synth in modtypes and modinputs
+  printf("synthstart: ; start offset for each synth\n\tdw ");
+  for(i=0;i<synths;i++) {
+    if (i) printf(", ");
+    printf("%05xh", synthstart[i]);
+  }
+  printf("\n\n");
 
   // output the patch modulator data
-  r=0;
   printf("patchdata: ; modulator data for all patches\n");
   for(i=0;patchmap[i]>=0;i++) {
-    patchstart[i]=r;
+    r=patchstart[i];
     s=patchmap[i]>>8;
     p=patchmap[i]&255;
     printf(".p%02x: ; (synth %02x patch %02x)\n\tdd 0.00",i,s,p);
     r++;
-    m=0;
-    while (signalfifo[s][m]>=0) {
+    for(m=0;m<synthlen[s];m++,r++) {
       if (m&3) printf(", "); else  printf("\n\tdd ");
-      t=mod[s][signalfifo[s][m]].type;
-      switch (modModulatorTypes[t]) {
-        // 0=no modulator, 1=float, 2=integer
+      switch (patchkind[r]) {
         case 0:
           printf( "0h" );
           break;
         case 1:
-          f=modvalue[s][p][signalfifo[s][m]];
+          memcpy(&f, &patchdata[r], 4);
           if ((f-floor(f))>0) {
             printf("%10.10g", f);
           } else {
             printf("%10.10f", f);
           }
           break;
-        case 4: // lfo, 0=triangle, 1=sine
-          if ( (int)(modvalue[s][p][signalfifo[s][m]]) == 3) {
-            printf( "01h" );
-          } else {
-            printf( "00h" );
-          }
-          break;
-        case 5: // filter
         default:
-          printf( "0%xh", (int)(modvalue[s][p][signalfifo[s][m]]) );
+          printf( "0%xh", patchdata[r] );
           break;
       }
-//      if ((m&3)==3) printf("\n\tdd ");
-      m++;
     }
-    r+=m;
     printf("\n");
   }
   printf("\n");
  
   // offsets to start of each patch
-  printf("patchstart: ; start offset for each patch\n\tdd ");
+  printf("patchstart: ; start offset for each patch\n\tdw ");
   for(i=0;patchmap[i]>=0;i++) {
     if (i) printf(", ");
-    printf("patchdata.p%02x", i);
+    printf("%05xh", patchstart[i]);
   }
   printf("\n\n");
 
   // synthesizer number used on each channel
-  printf("voicefunctions: ; function call list address for each seq channel\n");
-  for(v=0;v<seqch;v++) {
-    printf("\tdd modfunctions.fp_s%02x\n", seq_synth[v]);
-  }    
-  printf("\nvoiceinputs: ; wiring list address for each seq channel\n");
+  printf("seqvoice: ; synth used on each channel\n\tdb ");
   for(v=0;v<seqch;v++) {
-    printf("\tdd modinputs.in_s%02x\n", seq_synth[v]);
-  }    
-  printf("\n");
+    if (v) printf(", ");
+    printf("%03xh", synthindex[seq_synth[v]]);
+  }
+  printf("\n\n");
 
   // seq restart flags
   printf("seqmask: ; mask for channel flags\n\tdb ");
@@ -310,92 +603,609 @@ int main(int argc, char **argv) {
   }
   printf("0x%02x\n\n", (unsigned char)((seq_restart[v])<<4)|1);
 
-  // output the raw note on/off data with lots of zeroes in between. :)
-  printf("channelptr: ; pointers to start of each channel data\n");
-  for(v=0;v<seqch;v++) {
-    printf("\tdd songdata.ch%02x\n", v);
+  if (rawsong) {
+    // one line of words for each measure
+    printf("songdata:\n");
+    for(v=0;v<seqch;v++) {
+      printf(".ch%02d:", v);
+      for(n=0;n<songrows[v];n++) {
+        if (n&15) printf(", "); else printf(" ; %d\n\tdw ", n>>4);
+        printf("0x%04x", songdata[v][n]);
+      }
+      printf("\n\t; p=%d\n\n", songrows[v]>>4);
+    }
+    printf("\n");
+  } else {
+    printf("patterns: ; note events of each pattern\n.pt00: ; rest\n\tdb 16\n");
+    for(i=0;patternmap[i]>=0;i++) {
+      printf(".pt%02x: ; (pattern %02x)", i+1, patternmap[i]);
+      for(n=0;n<patternstart[i+2]-patternstart[i+1];n++) {
+        if (n&15) printf(", "); else printf("\n\tdb ");
+        printf("0x%02x", patternevents[patternstart[i+1]+n]);
+      }
+      printf("\n");
+    }
+    printf("\npatternstart: ; start offset for each pattern\n\tdw 00000h");
+    for(i=0;patternmap[i]>=0;i++) printf(", %05xh", patternstart[i+1]);
+    printf("\n\npatternlen: ; length of each pattern in measures\n\tdb 1");
+    for(i=0;patternmap[i]>=0;i++) printf(", %d", pattlen[patternmap[i]]);
+    printf("\n\n");
+
+    printf("orderlist: ; order list address for each channel\n");
+    for(v=0;v<seqch;v++) printf("\tdd songorder.ch%02d\n", v);
+    printf("\nsongorder:\n");
+    for(v=0;v<seqch;v++) {
+      printf(".ch%02d:\n", v);
+      for(l=0;l<ordercount[v];l++) {
+        if (songorder[v][l][0])
+          printf("\tdb 0x%02x, %3d, %3d, 0x%02x ; %d\n", songorder[v][l][0], songorder[v][l][1],
+            (signed char)songorder[v][l][2], songorder[v][l][3], orderpos[v][l]);
+        else if (orderpos[v][l]>=0)
+          printf("\tdb 0x00, %3d,   0, 0x00 ; %d\n", songorder[v][l][1], orderpos[v][l]);
+        else
+          printf("\tdb 0x00, 127,   0, 0x00 ; end\n");
+      }
+    }
+    printf("\n");
   }
-  printf("\nsongdata:\n");
-  for(v=0;v<seqch;v++) {
-    printf(".ch%02d:", v);
-    patternstart[v]=o;
-    
-    int restcount=0;
-    int patternrepeats=0;
-    int patterntranspose=0;
-    int noteon=0;
-
-
-    p=0;
-    while (p<truesonglen) {
-
-      if (seq_pattern[v][p]>=0) {
-        // a new pattern on the sequence
-        i=seq_pattern[v][p]; // pattern index
-        patternrepeats = seq_repeat[v][p];
-        patterntranspose = seq_transpose[v][p];
-        int patch=0;
-        for(m=0;patchmap[m]>=0;m++) 
-          if (
-               ( (patchmap[m]&255)==seq_patch[v][p]  ) && 
-               ( (patchmap[m]>>8)==seq_synth[v]      )
-             ) patch=m+1;
-
-        // i = pattern index
-        // scan through the pattern and generate notes and rests
-        // increment r on each byte written
-        for(r=0;r<patternrepeats;r++) {
-          for(n=0; n<(pattlen[i]*16); n++) {
-            if (n&15) printf(", "); else printf(" ; %d\n\tdw ", p);
-            note=patch<<8;
-            patch=0;
-            if (pattdata[i][n] > 0) {
-              d=pattdata[i][n] & 0x7f;
-              if (noteon != d) {
-                note|=(d+patterntranspose); //|0x80;
-                if (pattdata[i][n] & NOTE_ACCENT) note|=0x4000;
-                noteon=d;
-              }
-              if (!(pattdata[i][n+1]&NOTE_LEGATO)) { note|=0x8000; noteon=0; }
-            }
-            printf("0x%04x", note);
-//            if ((n&15)==15) { printf(" ; %d\n\tdw ", p); p++; }
-            if ((n&15)==15) p++;
+
+  // phase increments for the notes played, computed the same way as
+  // engine_notefreq[] in the editor so that the pitches match exactly
+  printf("; phase increment per sample for notes NOTE_FIRST to %d\n", notelast);
+  printf("%%define NOTE_FIRST %d\n", notefirst);
+  l=notelast;
+  if (compactlayout) {
+    // doubling a note is exact, so it packs better to leave the octaves
+    // above the lowest to the player
+    l=(notelast-notefirst<12) ? notelast : notefirst+11;
+    printf("%%define NOTE_COUNT %d\n%%define NOTE_OCTAVE %d\nnoteoctave:", notelast-notefirst+1, l-notefirst+1);
+  } else printf("notetable:");
+  for(n=notefirst;n<=l;n++) {
+    if ((n-notefirst)&3) printf(", "); else printf("\n\tdd ");
+    f=440.0*pow(2.0, (n-69)/12.0) / OUTPUTFREQ;
+    printf("%#.9g", f);
+  }
+  printf("\n\n");
+
+  // footer
+  printf(";; eof\n");
+}
+
+// separator before item i of a c array with n items per line
+void c_sep(int i, int n, const char *indent) {
+  if (i) printf(",");
+  if (i%n) printf(" "); else printf("\n%s", indent);
+}
+
+// print the tables as a c header for kplayer.c. the names and layout
+// follow the nasm output, except that the module inputs are in order
+// and the order lists are indexed from one songorder array
+void write_c(void) {
+  int v, i, n, l, t;
+  float f;
+
+  printf("/*\n * generated with komposter ksong-to-C converter (c) 2010 firehawk/tda\n *\n");
+  printf(" * source file:\n *   %s\n *\n", srcname);
+  printf(" * synthesizers used:\n");
+  for(i=0;synthmap[i]>=0;i++) printf(" *   %02x : (%02x:%s)\n", i, synthmap[i], synthname[synthmap[i]]);
+  printf(" */\n\n");
+
+  printf("#define NUM_CHANNELS %d\n", seqch);
+  printf("#define NUM_SYNTHS %d\n", synths);
+  printf("#define NUM_DELAYS %d\n", delays);
+  if (!rawsong) printf("#define SONG_EVENTS 1\n");
+  printf("#define SONG_LEN %d\n", truesonglen*16);
+  printf("#define TICKDIVIDER %d\n", tickdivider);
+  printf("#define NOTE_FIRST %d\n\n", notefirst);
+
+  printf("// bpm %d at %dhz sample rate\nstatic const int tickdivider = TICKDIVIDER;\n\n", bpm, OUTPUTFREQ);
+  printf("// master volume\nstatic const float samplemul = %ff;\n\n", 32766.0);
+
+  printf("// modules used\n#define USE_MODULES 1\n");
+  for(t=0;t<MODTYPES;t++)
+    if (modused[t]) printf("#define USE_MODULE_%s 1\n", modFunctionNames[t]);
+  printf("\n");
+
+  printf("// type of each module\nstatic const unsigned char modtypes[] = {");
+  for(i=0;i<modcount;i++) {
+    c_sep(i, 16, "\t");
+    printf("%d", modtypes[i]);
+  }
+  printf("\n};\n\n");
+
+  printf("// wiring within each synthesizer, ms[0] to ms[3]\nstatic const unsigned char modinputs[][4] = {\n");
+  for(i=0;i<modcount;i++)
+    printf("\t{ %2d, %2d, %2d, %2d }, // %02x: %s\n", modinputs[i][0], modinputs[i][1],
+      modinputs[i][2], modinputs[i][3], i, modTypeNames[modtypes[i]]);
+  printf("};\n\n");
+
+  printf("// start offset for each synth\nstatic const unsigned short synthstart[] = { ");
+  for(i=0;i<synths;i++) printf("%s%d", i ? ", " : "", synthstart[i]);
+  printf(" };\n\n");
+
+  // floats are written as their bit patterns so that the modulators
+  // read as integers share the same table
+  printf("// modulator data for all patches\nstatic const unsigned int patchdata[] = {");
+  for(i=0,l=0,n=0;i<patchcount;i++) {
+    if (patchmap[l]>=0 && i==patchstart[l]) {
+      printf("\n\t// %02x: synth %02x patch %02x", l, patchmap[l]>>8, patchmap[l]&255);
+      l++; n=0;
+    }
+    if (n++&3) printf(" "); else printf("\n\t");
+    if (patchkind[i]==1) {
+      memcpy(&f, &patchdata[i], 4);
+      printf("0x%08x, /* %g */", patchdata[i], f);
+    } else printf("%d,", patchdata[i]);
+  }
+  printf("\n};\n\n");
+
+  printf("// start offset for each patch\nstatic const unsigned short patchstart[] = { ");
+  for(i=0;patchmap[i]>=0;i++) printf("%s%d", i ? ", " : "", patchstart[i]);
+  printf(" };\n\n");
+
+  printf("// synth used on each channel\nstatic const unsigned char seqvoice[] = { ");
+  for(v=0;v<seqch;v++) printf("%s%d", v ? ", " : "", synthindex[seq_synth[v]]);
+  printf(" };\n\n");
+
+  printf("// mask for channel flags\nstatic const unsigned char seqmask[] = { ");
+  for(v=0;v<seqch;v++) printf("%s0x%02x", v ? ", " : "", (unsigned char)((seq_restart[v])<<4)|1);
+  printf(" };\n\n");
+
+  if (rawsong) {
+    printf("// one word per row for each channel\nstatic const unsigned short songdata[NUM_CHANNELS][SONG_LEN] = {\n");
+    for(v=0;v<seqch;v++) {
+      printf("\t{");
+      for(n=0;n<songrows[v];n++) {
+        c_sep(n, 16, "\t\t");
+        printf("0x%04x", songdata[v][n]);
+      }
+      printf("\n\t},\n");
+    }
+    printf("};\n\n");
+  } else {
+    printf("// note events of each pattern\nstatic const unsigned char patterns[] = {");
+    for(i=0;i<eventcount;i++) {
+      c_sep(i, 16, "\t");
+      printf("0x%02x", patternevents[i]);
+    }
+    printf("\n};\n\n");
+    printf("// start offset for each pattern\nstatic const unsigned short patternstart[] = { 0");
+    for(i=0;patternmap[i]>=0;i++) printf(", %d", patternstart[i+1]);
+    printf(" };\n\n");
+    printf("// length of each pattern in measures\nstatic const unsigned char patternlen[] = { 1");
+    for(i=0;patternmap[i]>=0;i++) printf(", %d", pattlen[patternmap[i]]);
+    printf(" };\n\n");
+
+    printf("// order list start in songorder for each channel\nstatic const unsigned short orderlist[] = { ");
+    for(v=0,n=0;v<seqch;v++) {
+      printf("%s%d", v ? ", " : "", n);
+      n+=ordercount[v]*4;
+    }
+    printf(" };\n\n");
+    printf("// pattern, repeats minus one, transpose (signed) and patch of each\n// order list entry\n");
+    printf("static const unsigned char songorder[] = {\n");
+    for(v=0;v<seqch;v++) {
+      printf("\t// channel %d\n", v);
+      for(l=0;l<ordercount[v];l++)
+        printf("\t%d, %d, %d, %d,\n", songorder[v][l][0], songorder[v][l][1],
+          songorder[v][l][2], songorder[v][l][3]);
+    }
+    printf("};\n\n");
+  }
+
+  printf("// phase increment per sample for notes NOTE_FIRST to %d\nstatic const float notetable[] = {", notelast);
+  for(n=notefirst;n<=notelast;n++) {
+    c_sep(n-notefirst, 4, "\t");
+    f=440.0*pow(2.0, (n-69)/12.0) / OUTPUTFREQ;
+    printf("%#.9gf", f);
+  }
+  printf("\n};\n");
+}
+
+// print a float modulator as a c literal that reads back to the same bits
+void c_float(unsigned int bits) {
+  float f;
+
+  memcpy(&f, &bits, 4);
+  printf("%#.9gf", f);
+}
+
+// do the modules of type t with modulator mv keep state between samples
+int module_stateful(int t, unsigned int mv) {
+  switch (t) {
+    case MOD_ADSR:
+    case MOD_WAVEFORM:
+    case MOD_LFO:
+    case MOD_LPF24:
+    case MOD_DELAY:
+    case MOD_RESAMPLE:
+      return 1;
+    case MOD_FILTER:
+      return (mv&3)!=0;
+  }
+  return 0;
+}
+
+// does the code for a module read input r. out tells if the output is used
+int input_read(int t, unsigned int mv, int r, int out) {
+  switch (t) {
+    case MOD_WAVEFORM: return out ? 1 : r<2; // only the phase runs without
+    case MOD_LFO: return out ? r<3 : r==0;
+    case MOD_ACCENT: return r<2; // like an amp when there's no accent
+    case MOD_FILTER: return (mv&3) ? r<3 : r==0;
+    case MOD_DELAY: return r!=2;
+    case MOD_SUPERSAW: return r==0;
+  }
+  return r<modInputCount[t];
+}
+
+// print one straight-line function running synth n with the modulators
+// in mv. outputs read later in the sample are local variables, only the
+// ones read back on the next sample are kept in the module data, and the
+// modules that neither feed the output nor keep state are left out
+void write_synth_code(int n, const unsigned int *mv, const char *name) {
+  unsigned char needed[MAX_MODULES+1], persist[MAX_MODULES+1], live[MAX_MODULES+1];
+  char ms[4][16];
+  const unsigned char *types, *in;
+  int len, m, k, t, r, used, changed, acc;
+
+  types=&modtypes[synthstart[n]];
+  for(len=1;types[len-1]!=MOD_OUTPUT;len++);
+  memset(needed, 0, len);
+  memset(persist, 0, len);
+  for(m=0;m<len;m++) live[m]=module_stateful(types[m], mv[m]);
+  live[len-1]=needed[len-1]=1;
+  do {
+    changed=0;
+    for(k=0;k<len;k++) {
+      if (!live[k]) continue;
+      for(r=0;r<4;r++) {
+        if (!input_read(types[k], mv[k], r, needed[k] || persist[k])) continue;
+        m=modinputs[synthstart[n]+k][r];
+        if (m<k && !needed[m]) needed[m]=changed=1;
+        if (m>=k && !persist[m]) persist[m]=changed=1;
+        if (!live[m]) live[m]=changed=1;
+      }
+    }
+  } while (changed);
+
+  printf("static float %s(kmodule *md, int v, unsigned char fl)\n{\n  float", name);
+  for(m=0,k=0,acc=0;m<len;m++) {
+    if (needed[m]) printf("%s%so%d", k ? "," : "", (k && !(k%12)) ? "\n    " : " ", m), k++;
+    if (types[m]==MOD_WAVEFORM && (needed[m] || persist[m])) acc=1;
+  }
+  if (acc) printf(", acc");
+  for(m=0;m<len;m++) if (types[m]==MOD_WAVEFORM) break;
+  if (m<len) printf(", sub");
+  printf(";\n\n");
+
+  for(m=0;m<len;m++) {
+    t=types[m];
+    in=modinputs[synthstart[n]+m];
+    used=needed[m] || persist[m];
+    for(r=0;r<4;r++) {
+      if (in[r]<m) sprintf(ms[r], "o%d", in[r]); else sprintf(ms[r], "md[%d].out", in[r]);
+    }
+
+    printf("  // %02x: %s\n", m, modTypeNames[t]);
+    if (!live[m]) {
+      printf("  next_noise();\n");
+      continue;
+    }
+
+    // the parts run for the state of the module
+    if (t==MOD_WAVEFORM) {
+      if (used) printf("  sub=%s;\n  acc=", ms[2]); else printf("  sub=0.0f;\n  ");
+      printf("vco_phase(&md[%d], %s, %s, &sub, fl);\n", m, ms[0], ms[1]);
+    }
+    if (t==MOD_FILTER && (mv[m]&3)) printf("  vcf(&md[%d], %s, %s, %s);\n", m, ms[0], ms[1], ms[2]);
+
+    if (used || (t!=MOD_WAVEFORM && t!=MOD_FILTER)) {
+      if (needed[m]) printf("  o%d=", m); else if (persist[m]) printf("  md[%d].out=", m); else printf("  ");
+      switch (t) {
+        case MOD_CV:
+          printf("pitch[v]");
+          break;
+        case MOD_ADSR:
+          printf("env(&md[%d], %s, %s, %s, %s, fl)", m, ms[0], ms[1], ms[2], ms[3]);
+          break;
+        case MOD_WAVEFORM:
+          switch (mv[m]&255) {
+            case VCO_PULSE: printf("vco_pulse(acc, %s)", ms[1]); break;
+            case VCO_SAW: printf("vco_saw(acc)"); break;
+            case VCO_TRIANGLE: printf("vco_triangle(acc)"); break;
+            default: printf("sin2pi(acc)");
           }
-        }
-      } else {
-        // no pattern here, add rest for 1 measure
-        printf(" ; %d\n\tdw 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000",p);
-        p++;
+          printf("+sub+vco_noise(%s)", ms[3]);
+          break;
+        case MOD_LFO:
+          if (used) {
+            printf("%s(lfo_phase(&md[%d], %s, fl))*%s+%s", (mv[m]&255) ? "lfo_triangle" : "lfo_sine",
+              m, ms[0], ms[1], ms[2]);
+          } else printf("lfo_phase(&md[%d], %s, fl)", m, ms[0]);
+          break;
+        case MOD_KNOB:
+          c_float(mv[m]);
+          break;
+        case MOD_AMPLIFIER:
+          printf("%s*%s", ms[0], ms[1]);
+          break;
+        case MOD_MIXER:
+          printf("%s+%s+%s+%s", ms[0], ms[1], ms[2], ms[3]);
+          break;
+        case MOD_FILTER:
+          switch (mv[m]&3) {
+            case VCF_OFF: printf("%s", ms[0]); break;
+            case VCF_LOWPASS: printf("md[%d].d.vcf.lp", m); break;
+            case VCF_HIGHPASS: printf("md[%d].d.vcf.hp", m); break;
+            default: printf("md[%d].d.vcf.bp", m);
+          }
+          break;
+        case MOD_LPF24:
+          printf("lpf24(&md[%d], %s, %s, %s)", m, ms[0], ms[1], ms[2]);
+          break;
+        case MOD_DELAY:
+          printf("delay(&md[%d], %s, %s, %s, %d)", m, ms[0], ms[1], ms[3], (mv[m]&255) ? 1 : 0);
+          break;
+        case MOD_ATTENUATOR:
+        case MOD_OUTPUT:
+          printf("%s*", ms[0]);
+          c_float(mv[m]);
+          break;
+        case MOD_RESAMPLE:
+          printf("resample(&md[%d], %s, %s)", m, ms[0], ms[1]);
+          break;
+        case MOD_DISTORT:
+          printf("dist(%s, %s)", ms[0], ms[1]);
+          break;
+        case MOD_ACCENT:
+          printf("(fl & FLAG_ACCENT) ? ");
+          c_float(mv[m]);
+          printf(" : %s*%s", ms[0], ms[1]);
+          break;
+        default: // supersaw and the types the players leave out
+          printf("%s", ms[0]);
       }
+      printf(";\n");
+      if (needed[m] && persist[m]) printf("  md[%d].out=o%d;\n", m, m);
     }
-    printf("\n\t; p=%d\n\n", p);
-    
+    printf("  next_noise();\n");
   }
-  printf("\n");
+  printf("  return o%d;\n}\n\n", len-1);
+}
 
+// print the synths as straight-line c for kplayer.c, one function for
+// each patch and one for each synth before any patch is loaded. the
+// waveforms and filter modes are picked here instead of on every sample
+void write_code(void) {
+  static unsigned int zero[MAX_MODULES+1];
+  char name[32];
+  int i, s, p;
 
+  printf("/*\n * generated with komposter ksong-to-C converter (c) 2010 firehawk/tda\n *\n");
+  printf(" * source file:\n *   %s\n *\n", srcname);
+  printf(" * synth code for kplayer.c, to be compiled with SYNTH_CODE defined and\n");
+  printf(" * the song.h written from the same song\n */\n\n");
 
+  printf("#if NUM_SYNTHS != %d || SONG_LEN != %d || TICKDIVIDER != %d\n", synths, truesonglen*16, tickdivider);
+  printf("#error synths.h was written for a different song\n#endif\n\n");
 
+  printf("typedef float (*synthfunc)(kmodule *md, int v, unsigned char fl);\n\n");
 
-  
+  for(i=0;i<synths;i++) {
+    printf("// synth %02x: %s, no patch loaded\n", i, synthname[synthmap[i]]);
+    sprintf(name, "synth_%d", i);
+    write_synth_code(i, zero, name);
+  }
+  for(i=0;patchmap[i]>=0;i++) {
+    s=patchmap[i]>>8;
+    p=patchmap[i]&255;
+    printf("// patch %02x: synth %02x %s, patch %02x %s\n", i, synthindex[s], synthname[s], p, patchname[s][p]);
+    sprintf(name, "patch_%d", i);
+    write_synth_code(synthindex[s], &patchdata[patchstart[i]], name);
+  }
 
+  printf("// code for each synth before any patch is loaded\nstatic const synthfunc synthcode[NUM_SYNTHS] = {");
+  for(i=0;i<synths;i++) {
+    c_sep(i, 8, "\t");
+    printf("synth_%d", i);
+  }
+  printf("\n};\n\n");
+  printf("// code for each patch\nstatic const synthfunc patchcode[] = {");
+  for(i=0;patchmap[i]>=0;i++) {
+    c_sep(i, 8, "\t");
+    printf("patch_%d", i);
+  }
+  printf("\n};\n");
+}
 
+// binary image of the tables in the order the nasm output lays them out,
+// for estimating the packed size of each
+unsigned char image[0x100000];
+int imagelen, sectioncount;
+int sectionstart[32];
+const char *sectionname[32];
 
-    
+// layouts of the tables. only the note table octave is written with -l
+// and understood by the players, the rest are for comparing estimates
+#define LAYOUT_NOTEOCTAVE	1 // lowest octave, the rest are doubles
+#define LAYOUT_INPUTCOLUMNS	2 // modinputs one input at a time
+#define LAYOUT_PATCHCOLUMNS	4 // patchdata one module at a time per synth
+#define LAYOUT_ORDERCOLUMNS	8 // songorder one field at a time
+#define LAYOUT_EVENTCOLUMNS	16 // gaps and notes of the events apart
+#define LAYOUTS			5
 
+const char *layoutnames[LAYOUTS]={
+  "note table as one octave",
+  "modinputs column-major",
+  "patchdata column-major",
+  "songorder column-major",
+  "patterns as gaps and notes"
+};
 
+void put_bytes(unsigned int x, int n) {
+  for(;n>0;n--,x>>=8) image[imagelen++]=x&255;
+}
 
+void section(const char *name) {
+  sectionname[sectioncount]=name;
+  sectionstart[sectioncount++]=imagelen;
+}
 
+void build_image(int layout) {
+  int v, i, n, l, r, m, p;
+  float f;
 
+  imagelen=sectioncount=0;
+  section("tickdivider, samplemul");
+  put_bytes(tickdivider, 4);
+  f=32766.0; memcpy(&r, &f, 4);
+  put_bytes(r, 4);
 
+  section("modtypes");
+  for(i=0;i<modcount;i++) put_bytes(modtypes[i], 1);
+  section("modinputs");
+  if (layout & LAYOUT_INPUTCOLUMNS) {
+    for(n=3;n>=0;n--) for(i=0;i<modcount;i++) put_bytes(modinputs[i][n], 1);
+  } else {
+    for(i=0;i<modcount;i++) for(n=3;n>=0;n--) put_bytes(modinputs[i][n], 1);
+  }
+  section("synthstart");
+  for(i=0;i<synths;i++) put_bytes(synthstart[i], 2);
+  section("patchdata");
+  if (layout & LAYOUT_PATCHCOLUMNS) {
+    for(i=0;i<synths;i++)
+      for(m=0;m<=synthlen[synthmap[i]];m++)
+        for(p=0;patchmap[p]>=0;p++)
+          if (synthindex[patchmap[p]>>8]==i) put_bytes(patchdata[patchstart[p]+m], 4);
+  } else {
+    for(i=0;i<patchcount;i++) put_bytes(patchdata[i], 4);
+  }
+  section("patchstart");
+  for(i=0;patchmap[i]>=0;i++) put_bytes(patchstart[i], 2);
+  section("seqvoice, seqmask");
+  for(v=0;v<seqch;v++) put_bytes(synthindex[seq_synth[v]], 1);
+  for(v=0;v<seqch;v++) put_bytes((seq_restart[v]<<4)|1, 1);
 
+  if (rawsong) {
+    section("songdata");
+    for(v=0;v<seqch;v++)
+      for(n=0;n<songrows[v];n++) put_bytes(songdata[v][n], 2);
+  } else {
+    section("patterns");
+    if (layout & LAYOUT_EVENTCOLUMNS) {
+      for(i=0;i<eventcount;i+=2) put_bytes(patternevents[i], 1);
+      for(i=1;i<eventcount;i+=2) put_bytes(patternevents[i], 1);
+    } else {
+      for(i=0;i<eventcount;i++) put_bytes(patternevents[i], 1);
+    }
+    section("patternstart, patternlen");
+    put_bytes(0, 2);
+    for(i=0;patternmap[i]>=0;i++) put_bytes(patternstart[i+1], 2);
+    put_bytes(1, 1);
+    for(i=0;patternmap[i]>=0;i++) put_bytes(pattlen[patternmap[i]], 1);
+    section("orderlist");
+    for(v=0,n=0;v<seqch;v++) {
+      put_bytes(n, 4); // the offset, the linker adds the base address
+      n+=ordercount[v]*4;
+    }
+    section("songorder");
+    for(r=0;r<((layout & LAYOUT_ORDERCOLUMNS) ? 4 : 1);r++)
+      for(v=0;v<seqch;v++)
+        for(l=0;l<ordercount[v];l++)
+          for(n=0;n<4;n++)
+            if (!(layout & LAYOUT_ORDERCOLUMNS) || n==r) put_bytes(songorder[v][l][n], 1);
+  }
 
+  section("notetable");
+  l=(layout & LAYOUT_NOTEOCTAVE) ? notefirst+11 : notelast;
+  for(n=notefirst;n<=notelast && n<=l;n++) {
+    f=440.0*pow(2.0, (n-69)/12.0) / OUTPUTFREQ;
+    memcpy(&r, &f, 4);
+    put_bytes(r, 4);
+  }
+  sectionstart[sectioncount]=imagelen;
+}
 
+// estimated packed size of the whole image
+double image_packed(void) {
+  pack_reset();
+  return pack_bytes(image, imagelen);
+}
 
+// print the size of each table as written and how small it's estimated
+// to pack, followed by how the total would change in other layouts
+void write_sizes(void) {
+  double packed, total=0.0;
+  int i, len, layout;
 
-  
-  // footer
-  printf(";; eof\n");
+  layout=compactlayout ? LAYOUT_NOTEOCTAVE : 0;
+  build_image(layout);
+  pack_reset();
+  fprintf(stderr, "%-28s %7s %9s %9s\n", "table", "bytes", "packed", "bits/byte");
+  for(i=0;i<sectioncount;i++) {
+    len=sectionstart[i+1]-sectionstart[i];
+    packed=pack_bytes(image+sectionstart[i], len);
+    total+=packed;
+    fprintf(stderr, "%-28s %7d %9.1f %9.2f\n", sectionname[i], len, packed, len ? packed*8.0/len : 0.0);
+  }
+  fprintf(stderr, "%-28s %7d %9.1f %9.2f\n\n", "total", imagelen, total, imagelen ? total*8.0/imagelen : 0.0);
+
+  fprintf(stderr, "packed total in other layouts:\n");
+  for(i=0;i<LAYOUTS;i++) {
+    if (rawsong && (1<<i)>=LAYOUT_ORDERCOLUMNS) continue;
+    build_image(layout^(1<<i));
+    packed=image_packed();
+    fprintf(stderr, "  %s %-26s %9.1f %+8.1f\n", (layout & (1<<i)) ? "without" : "with   ",
+      layoutnames[i], packed, packed-total);
+  }
+}
+
+int main(int argc, char **argv) {
+  int r, t;
+
+  // load the ksong file to memory
+  for(;argc>2 && argv[1][0]=='-';argc--,argv++) {
+    if (!strcmp(argv[1], "-r")) rawsong=1;
+    else if (!strcmp(argv[1], "-c")) cheader=1;
+    else if (!strcmp(argv[1], "-g")) synthcode=1;
+    else if (!strcmp(argv[1], "-s")) sizereport=1;
+    else if (!strcmp(argv[1], "-l")) compactlayout=1;
+    else break;
+  }
+  if (argc!=2) {
+    printf("komposter ksong converter (c) 2010 firehawk/tda\n\nusage:  %s [-r] [-l] [-s] [-c] [-g] <filename.ksong>\n\n", argv[0]);
+    printf("  -r  write the song as one word per row for each channel instead of\n");
+    printf("      patterns of note events and an order list\n");
+    printf("  -l  write the note table for one octave for the player to expand\n");
+    printf("  -s  print the estimated packed size of each table to stderr, and\n");
+    printf("      how other layouts of the tables would change it\n");
+    printf("  -c  write a c header for player/kplayer.c instead of nasm source\n");
+    printf("  -g  write the synths as c code for player/kplayer.c to go with the\n");
+    printf("      header from -c\n\n");
+    return -1;
+  }
+  srcname=argv[1];
+  r=load_ksong(srcname);
+  if (r) { printf("Error loading .ksong! Errorcode %08x\n", r); return -1; }
+
+  // song is now loaded to the data variables defined above. so if you want to
+  // use your own player code, you'll need to modify the code below to suit your
+  // needs. the tables are written either for my x86 assembly language player
+  // which is provided as a reference implementation, in nasm syntax, or as
+  // a c header for the portable player in player/kplayer.c.
+  //
+  // this coverter will also strip any patterns and patches not actually used
+  // from the output. this way the composer can send worktunes with additional
+  // stuff in them and the coder can still get a good idea on how the tune will
+  // actually compress. the same goes for synthesizers that aren't played on
+  // any channel, and the player only assembles the modules that are used.
+  //
+  build_tables();
+  for(t=0;t<MODTYPES;t++)
+    if (modused[t] && (t==MOD_SUPERSAW || t>MOD_OUTPUT)) fprintf(stderr, "warning: module type %s is not supported by the player\n", modTypeNames[t]);
+
+  if (synthcode) write_code(); else if (cheader) write_c(); else write_nasm();
+  if (sizereport) write_sizes();
   return 0;
-}
\ No newline at end of file
+}
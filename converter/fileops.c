@@ -25,7 +25,7 @@ extern int signalfifo[MAX_SYNTH][MAX_MODULES];
 extern char patchname[MAX_SYNTH][MAX_PATCHES][128];
 extern float modvalue[MAX_SYNTH][MAX_PATCHES][MAX_MODULES];
 extern int modquantifier[MAX_SYNTH][MAX_PATCHES][MAX_MODULES];
-extern unsigned long pattdata[MAX_PATTERN][MAX_PATTLENGTH];
+extern unsigned int pattdata[MAX_PATTERN][MAX_PATTLENGTH];
 extern unsigned int pattlen[MAX_PATTERN];
 extern int seqch;
 extern int seqsonglen;
@@ -217,14 +217,14 @@ void* load_chunk(FILE *f, char *chunktype)
   long filepos;
   int r;
   unsigned char fchunktype[4];
-  unsigned long fchunklen;
+  unsigned int fchunklen; // 32 bits in the file
   unsigned char *cbuffer;
   
   // check chunk type
   filepos=ftell(f);
   r=fread(fchunktype, sizeof(char), 4, f);
   if (!r) return NULL;
-  r=fread(&fchunklen, sizeof(long), 1, f);
+  r=fread(&fchunklen, sizeof(fchunklen), 1, f);
   if (memcmp(fchunktype, chunktype, 4)) {
     fseek(f, filepos, SEEK_SET); 
     return NULL;
@@ -248,12 +248,12 @@ long probe_chunk(FILE *f, char *chunktype)
 {
   long filepos;
   int r;
-  unsigned long fchunklen;
+  unsigned int fchunklen;
   
   filepos=ftell(f);
   r=fread(chunktype, sizeof(char), 4, f);
   if (!r) { fseek(f, filepos, SEEK_SET); return 0; }
-  r=fread(&fchunklen, sizeof(long), 1, f);
+  r=fread(&fchunklen, sizeof(fchunklen), 1, f);
   fseek(f, filepos, SEEK_SET);
   if (!r) { return 0; }
   return fchunklen;
@@ -31,7 +31,7 @@ const char *modFunctionNames[MODTYPES]=
         "env",
         "vco",
         "lfo",
-        "accent",
+        "cv",
         "amp",
         "mixer",
         "vcf",
@@ -45,7 +45,7 @@ const char *modFunctionNames[MODTYPES]=
         "output",
         "bitcrush",
         "slew",
-        "cv"
+        "modulator"
 };
 
 
@@ -269,6 +269,29 @@ const char* modModulatorNames[MODTYPES]={
 "channel"
 };
 
+// modules whose output only depends on their inputs and modulator
+const int modFoldable[MODTYPES]={
+	0, //CV
+	0, //ADSR
+	0, //wave
+	0, //lfo
+	1, //knob
+	1, //amp
+	1, //mixer
+	0, //filter
+	0, //lpf24
+	0, //delay
+	1, //attenuator
+	0, //resample
+	0, //supersaw
+	1, //distort
+	0, //accent
+	0, //output
+	0, // bitcrush
+        0, // slew
+        0  // modulator
+};
+
 // modulator value type. 0=no modulator, 1=float, 2=integer
 const int modModulatorTypes[MODTYPES]={
 	1, //CV
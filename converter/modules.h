@@ -99,6 +99,7 @@ extern const int modInputScale[MODTYPES][4];
 extern const int modOutputScale[MODTYPES];
 extern const char* modModulatorNames[MODTYPES];
 extern const int modModulatorTypes[MODTYPES];
+extern const int modFoldable[MODTYPES];
 extern const char* modVcoWaveforms[VCO_WAVEFORMS];
 extern const char* modLfoWaveforms[LFO_WAVEFORMS];
 extern const char* modVcfModes[VCF_MODES];
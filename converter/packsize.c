@@ -0,0 +1,115 @@
+/*
+ * Komposter converter
+ *
+ * Copyright (c) 2010 Noora Halme et al. (see AUTHORS)
+ *
+ * This code is licensed under the MIT license:
+ * http://www.opensource.org/licenses/mit-license.php
+ *
+ * A small context mixing model for estimating how well the song data
+ * compresses with the usual 4k exe packers. It predicts one bit at a
+ * time from the preceding bytes in several contexts, mixes the
+ * predictions and counts the bits it would take to code the data. The
+ * contexts are the previous one to four and six bytes, plus sparse ones
+ * skipping to the same byte of the previous word and dword, which is
+ * where these packers find most of the structure in tables of floats.
+ *
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "packsize.h"
+
+#define MODELS		8
+#define TABLEBITS	20
+#define TABLESIZE	(1<<TABLEBITS)
+
+static unsigned short prob[MODELS][TABLESIZE]; // p(1) in 16 bits
+static float weight[MODELS];
+static unsigned char history[8]; // last bytes, history[0] the latest
+static unsigned int ctx[MODELS]; // context hash of each model for the byte
+
+
+// stretch(p)=ln(p/(1-p)) and squash as its inverse
+static float stretch(float p)
+{
+  return logf(p/(1.0f-p));
+}
+
+static float squash(float x)
+{
+  if (x>20.0f) x=20.0f;
+  if (x<-20.0f) x=-20.0f;
+  return 1.0f/(1.0f+expf(-x));
+}
+
+
+// hash the bytes selected by mask from the history into a context
+static unsigned int hash_context(int model, int mask)
+{
+  unsigned int h=(model+1)*0x9e3779b1u;
+  int i;
+
+  for(i=0;i<8;i++) if (mask & (1<<i)) h=(h^history[i])*0x2f0b4ca3u+i;
+  return h^(h>>15);
+}
+
+static void update_contexts(void)
+{
+  static const int masks[MODELS]={ 0x00, 0x01, 0x03, 0x07, 0x0f, 0x3f, 0x02, 0x08 };
+  int i;
+
+  for(i=0;i<MODELS;i++) ctx[i]=hash_context(i, masks[i]);
+}
+
+
+void pack_reset(void)
+{
+  int i;
+
+  for(i=0;i<TABLESIZE;i++) prob[0][i]=32768;
+  for(i=1;i<MODELS;i++) memcpy(prob[i], prob[0], sizeof(prob[0]));
+  for(i=0;i<MODELS;i++) weight[i]=0.3f;
+  memset(history, 0, sizeof(history));
+  update_contexts();
+}
+
+
+double pack_bytes(const unsigned char *data, int len)
+{
+  float st[MODELS], p, dot, err;
+  unsigned int idx[MODELS], c0;
+  double bits=0.0;
+  int i, b, m, bit;
+
+  for(i=0;i<len;i++) {
+    // code the byte from the top bit down, c0 holds the bits so far
+    // with a leading one
+    for(c0=1,b=7;b>=0;b--) {
+      bit=(data[i]>>b)&1;
+      for(m=0,dot=0.0f;m<MODELS;m++) {
+        idx[m]=(ctx[m]+c0*0x3c6ef372u) & (TABLESIZE-1);
+        st[m]=stretch((prob[m][idx[m]]+0.5f)/65537.0f);
+        dot+=weight[m]*st[m];
+      }
+      p=squash(dot);
+      if (p<1.0f/4096.0f) p=1.0f/4096.0f;
+      if (p>4095.0f/4096.0f) p=4095.0f/4096.0f;
+      bits-=log2(bit ? p : 1.0f-p);
+
+      // train the mixer and the predictions toward the bit
+      err=bit-p;
+      for(m=0;m<MODELS;m++) {
+        weight[m]+=0.02f*err*st[m];
+        if (bit) prob[m][idx[m]]+=(65535-prob[m][idx[m]])>>4;
+        else prob[m][idx[m]]-=prob[m][idx[m]]>>4;
+      }
+      c0=(c0<<1)|bit;
+    }
+    memmove(history+1, history, sizeof(history)-1);
+    history[0]=data[i];
+    update_contexts();
+  }
+  return bits/8.0;
+}
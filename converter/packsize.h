@@ -0,0 +1,21 @@
+/*
+ * Komposter converter
+ *
+ * Copyright (c) 2010 Noora Halme et al. (see AUTHORS)
+ *
+ * This code is licensed under the MIT license:
+ * http://www.opensource.org/licenses/mit-license.php
+ *
+ */
+
+#ifndef __PACKSIZE_H__
+#define __PACKSIZE_H__
+
+// start the estimate over with an empty model
+void pack_reset(void);
+
+// feed data to the model after what was fed before and return the
+// estimated size in bytes it would take in the compressed stream
+double pack_bytes(const unsigned char *data, int len);
+
+#endif
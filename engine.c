@@ -0,0 +1,1055 @@
+/*
+ * Komposter
+ *
+ * Copyright (c) 2010 Noora Halme et al. (see AUTHORS)
+ *
+ * This code is licensed under the GNU General Public
+ * License version 2. See LICENSE for full text.
+ *
+ * Reentrant synthesis engine
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include "buffermm.h"
+#include "engine.h"
+
+// macros for typecasting the localdata void ptr
+#define mod_fdata(v,m)  ((float*)e->localdata[v][m])
+#define mod_ldata(v,m)  ((u32*)e->localdata[v][m])
+#define mod_ddata(v,m)  ((double*)e->localdata[v][m])
+
+// above which point to round audio peaks
+#define ENGINE_SHAPER_THRESHOLD	0.9
+
+
+static pthread_once_t engine_once=PTHREAD_ONCE_INIT;
+static pthread_once_t crc_once=PTHREAD_ONCE_INIT;
+static u32 crc_table[256];
+
+float engine_notefreq[ENGINE_NOTES];
+
+
+// waveshaper to limit audio range
+float engine_shape(float input)
+{
+  return 0.5 * (fabs(input + ENGINE_SHAPER_THRESHOLD) - fabs(input - ENGINE_SHAPER_THRESHOLD));
+}
+
+
+// build the note frequency table and the module lookup tables. each
+// note is computed from a-4 directly so the error doesn't accumulate
+// towards the top of the keyboard
+static void engine_inittables(void)
+{
+  int i;
+
+  for(i=0;i<ENGINE_NOTES;i++)
+    engine_notefreq[i]=440.0*pow(2.0, (i-69)/12.0) / OUTPUTFREQ;
+  calc_supersaw_tables();
+}
+
+void engine_init(void)
+{
+  pthread_once(&engine_once, engine_inittables);
+}
+
+
+kengine *engine_new(void)
+{
+  kengine *e;
+  ksong *song;
+  int s, m, c, i;
+
+  engine_init();
+
+  e=calloc(1, sizeof(kengine));
+  if (!e) return NULL;
+  song=calloc(1, sizeof(ksong));
+  if (!song) { free(e); return NULL; }
+
+  for(s=0;s<MAX_SYNTH;s++) {
+    for(m=0;m<MAX_MODULES;m++) {
+      song->mod[s][m].type=-1;
+      song->signalfifo[s][m]=-1;
+    }
+  }
+  for(c=0;c<MAX_CHANNELS;c++)
+    for(i=0;i<MAX_SONGLEN;i++) song->seq_pattern[c][i]=-1;
+
+  e->storage=song;
+  engine_setsong(e, song);
+  e->seqch=0;
+  e->seqsonglen=0;
+  e->bpm=120;
+  e->noiseseed=0x67452301;
+  return e;
+}
+
+
+// point an engine at a song
+void engine_setsong(kengine *e, ksong *song)
+{
+  int s;
+
+  engine_init();
+  e->mod=song->mod;
+  e->signalfifo=song->signalfifo;
+  e->modvalue=song->modvalue;
+  e->pattdata=song->pattdata;
+  e->pattlen=song->pattlen;
+  e->seq_pattern=song->seq_pattern;
+  e->seq_repeat=song->seq_repeat;
+  e->seq_transpose=song->seq_transpose;
+  e->seq_patch=song->seq_patch;
+  e->seq_synth=song->seq_synth;
+  e->seq_restart=song->seq_restart;
+  e->seq_mute=song->seq_mute;
+  for(s=0;s<MAX_SYNTH;s++) engine_fold(e, s);
+}
+
+
+void engine_free(kengine *e)
+{
+  int ch;
+
+  if (!e) return;
+  kmm_release(e);
+  for(ch=0;ch<MAX_CHANNELS;ch++) free(e->events[ch]);
+  free(e->storage);
+  free(e);
+}
+
+
+
+
+//
+// song loading
+//
+
+// reads a chunk header from a memory image. returns a pointer to the
+// chunk data or NULL if the type doesn't match or the chunk is truncated
+static unsigned char *engine_chunk(unsigned char *data, long len, long *pos, char *type, u32 *chunklen)
+{
+  unsigned char *c;
+
+  if (*pos+8 > len) return NULL;
+  c=&data[*pos];
+  if (memcmp(c, type, 4)) return NULL;
+  memcpy(chunklen, &c[4], sizeof(u32));
+  if (*chunklen > len - *pos - 8) return NULL;
+  *pos+=8+*chunklen;
+  return &c[8];
+}
+
+
+int engine_loadmem(kengine *e, unsigned char *data, long len)
+{
+  unsigned char *c;
+  long pos, fpos;
+  u32 chunklen, np, sl, pl;
+  int cpat, csyn, ch, songlen, nm, i, j, p, m;
+
+  if (!e->storage) return FILE_ERROR_CORRUPT; // never overwrite the editor arrays
+  if (len < 16 || memcmp(data, "KSNG", 4)) return FILE_ERROR_CORRUPT;
+  memcpy(&chunklen, &data[4], sizeof(u32));
+  if (chunklen+8 != len) return FILE_ERROR_CORRUPT;
+
+  memcpy(&cpat, &data[8], sizeof(int));
+  memcpy(&csyn, &data[12], sizeof(int));
+  if (cpat<0 || cpat>MAX_PATTERN || csyn<0 || csyn>MAX_SYNTH) return FILE_ERROR_CORRUPT;
+  pos=16;
+
+  // sequencer
+  c=engine_chunk(data, len, &pos, "KSEQ", &chunklen);
+  if (!c || chunklen<12) return FILE_ERROR_CHUNKTYPE;
+  memcpy(&ch, &c[0], sizeof(int));
+  memcpy(&songlen, &c[4], sizeof(int));
+  memcpy(&e->bpm, &c[8], sizeof(int));
+  if (ch<0 || ch>MAX_CHANNELS || songlen<0 || songlen>MAX_SONGLEN || e->bpm<=0) return FILE_ERROR_CORRUPT;
+  if (chunklen < 12 + 4*ch + 4*ch*songlen*4) return FILE_ERROR_CORRUPT;
+  e->seqch=ch;
+  e->seqsonglen=songlen;
+
+  memcpy(e->seq_synth, &c[12], 4*ch);
+  for(i=0;i<ch;i++) {
+    e->seq_restart[i]=e->seq_synth[i]>>16;
+    e->seq_synth[i]&=0xff;
+    e->seq_mute[i]=0;
+    if (e->seq_synth[i]>=MAX_SYNTH) return FILE_ERROR_CORRUPT;
+  }
+  fpos=12 + 4*ch;
+  for(i=0;i<ch;i++) memcpy(e->seq_pattern[i],   &c[fpos+(0*ch+i)*songlen*4], songlen*4);
+  for(i=0;i<ch;i++) memcpy(e->seq_repeat[i],    &c[fpos+(1*ch+i)*songlen*4], songlen*4);
+  for(i=0;i<ch;i++) memcpy(e->seq_transpose[i], &c[fpos+(2*ch+i)*songlen*4], songlen*4);
+  for(i=0;i<ch;i++) memcpy(e->seq_patch[i],     &c[fpos+(3*ch+i)*songlen*4], songlen*4);
+  for(i=0;i<ch;i++) {
+    for(j=0;j<songlen;j++) {
+      if (e->seq_pattern[i][j]>=MAX_PATTERN || e->seq_patch[i][j]<0 || e->seq_patch[i][j]>=MAX_PATCHES)
+        return FILE_ERROR_CORRUPT;
+    }
+  }
+
+  // patterns
+  for(i=0;i<cpat;i++) {
+    c=engine_chunk(data, len, &pos, "KPAT", &chunklen);
+    if (!c || chunklen<4) return FILE_ERROR_CHUNKTYPE;
+    memcpy(&pl, &c[0], sizeof(u32));
+    if (pl > MAX_PATTLENGTH/16 || chunklen < 4+pl*64) return FILE_ERROR_CORRUPT;
+    e->pattlen[i]=pl;
+    memcpy(e->pattdata[i], &c[4], pl*16*4);
+  }
+
+  // synths and their patch banks
+  for(i=0;i<csyn;i++) {
+    c=engine_chunk(data, len, &pos, "KSYN", &chunklen);
+    if (!c || chunklen<136) return FILE_ERROR_CHUNKTYPE;
+    memcpy(&nm, &c[0], sizeof(int));
+    if (nm<0 || nm>MAX_MODULES || chunklen < 136+nm*sizeof(synthmodule)) return FILE_ERROR_CORRUPT;
+    for(m=0;m<MAX_MODULES;m++) e->mod[i][m].type=-1;
+    memcpy(e->mod[i], &c[136], nm*sizeof(synthmodule));
+    for(m=0;m<nm;m++) {
+      if (e->mod[i][m].type>=MODTYPES) return FILE_ERROR_CORRUPT;
+      for(j=0;j<4;j++)
+        if (e->mod[i][m].input[j]<-1 || e->mod[i][m].input[j]>=MAX_MODULES) return FILE_ERROR_CORRUPT;
+    }
+    engine_stackify(e, i);
+
+    c=engine_chunk(data, len, &pos, "KBNK", &chunklen);
+    if (!c || chunklen<8) return FILE_ERROR_CHUNKTYPE;
+    memcpy(&np, &c[0], sizeof(u32));
+    memcpy(&sl, &c[4], sizeof(u32));
+    if (np>MAX_PATCHES || sl>MAX_MODULES || chunklen < 8+np*(128+3*sl*4)) return FILE_ERROR_CORRUPT;
+    for(p=0;p<np;p++) {
+      fpos=8 + p*(128 + 3*sl*4);
+      memcpy(e->modvalue[i][p], &c[fpos+128+sl*4], sl*4);
+    }
+  }
+
+  return 0;
+}
+
+
+int engine_load(kengine *e, const char *filename)
+{
+  FILE *f;
+  unsigned char *data;
+  long len;
+  int r;
+
+  f=fopen(filename, "rb");
+  if (!f) return FILE_ERROR_FOPEN;
+  fseek(f, 0, SEEK_END);
+  len=ftell(f);
+  fseek(f, 0, SEEK_SET);
+  if (len<=0) { fclose(f); return FILE_ERROR_CORRUPT; }
+
+  data=malloc(len);
+  if (!data) { fclose(f); return FILE_ERROR_FREAD; }
+  if (fread(data, 1, len, f) != len) { free(data); fclose(f); return FILE_ERROR_FREAD; }
+  fclose(f);
+
+  r=engine_loadmem(e, data, len);
+  free(data);
+  return r;
+}
+
+
+static void engine_crcinit(void)
+{
+  u32 c;
+  int n, k;
+
+  for(n=0;n<256;n++) {
+    c=n;
+    for(k=0;k<8;k++) c=(c&1) ? 0xedb88320^(c>>1) : c>>1;
+    crc_table[n]=c;
+  }
+}
+
+u32 engine_crc32(u32 crc, const unsigned char *data, long len)
+{
+  long i;
+
+  pthread_once(&crc_once, engine_crcinit);
+  crc^=0xffffffff;
+  for(i=0;i<len;i++) crc=crc_table[(crc^data[i])&0xff]^(crc>>8);
+  return crc^0xffffffff;
+}
+
+
+u32 engine_songcrc(const unsigned char *data, long len)
+{
+  u32 crc;
+
+  // the checksum covers the ksng data after the header, excluding itself
+  if (len < 12) return 0;
+  memcpy(&crc, &data[len-4], sizeof(u32));
+  if (!crc) crc=engine_crc32(0, &data[8], len-12);
+  return crc;
+}
+
+
+void engine_setparam(kengine *e, int synth, int patch, int module, float value)
+{
+  if (synth<0 || synth>=MAX_SYNTH || patch<0 || patch>=MAX_PATCHES || module<0 || module>=MAX_MODULES) return;
+  e->modvalue[synth][patch][module]=value;
+}
+
+
+
+// queue a parameter change. this is the only function that may be
+// called from another thread while the engine renders
+int engine_queueparam(kengine *e, kparam *p)
+{
+  unsigned int tail;
+
+  tail=__atomic_load_n(&e->paramtail, __ATOMIC_RELAXED);
+  if (tail - __atomic_load_n(&e->paramhead, __ATOMIC_ACQUIRE) >= ENGINE_PARAMQUEUE) return -1;
+  e->paramqueue[tail&(ENGINE_PARAMQUEUE-1)]=*p;
+  __atomic_store_n(&e->paramtail, tail+1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+
+// drop the changes queued so far. may be called from the queueing thread
+void engine_flushparams(kengine *e)
+{
+  __atomic_store_n(&e->paramflush, __atomic_load_n(&e->paramtail, __ATOMIC_RELAXED), __ATOMIC_RELEASE);
+}
+
+
+// first queued change, or NULL if the queue is empty
+static kparam *engine_peekparam(kengine *e)
+{
+  unsigned int head, flush;
+
+  head=__atomic_load_n(&e->paramhead, __ATOMIC_RELAXED);
+  flush=__atomic_load_n(&e->paramflush, __ATOMIC_ACQUIRE);
+  if ((int)(flush-head) > 0) {
+    head=flush;
+    __atomic_store_n(&e->paramhead, head, __ATOMIC_RELEASE);
+  }
+  if (head==__atomic_load_n(&e->paramtail, __ATOMIC_ACQUIRE)) return NULL;
+  return &e->paramqueue[head&(ENGINE_PARAMQUEUE-1)];
+}
+
+static void engine_popparam(kengine *e)
+{
+  __atomic_store_n(&e->paramhead, e->paramhead+1, __ATOMIC_RELEASE);
+}
+
+
+// start a modulator of a voice gliding to a value over steps calls to
+// engine_smooth(), or set it at once if steps is 0
+static void engine_glide(kengine *e, int voice, int m, float value, int steps)
+{
+  if (e->smoothleft[voice][m]) e->smoothing--;
+  e->smoothleft[voice][m]=steps;
+  if (steps) {
+    e->smoothtarget[voice][m]=value;
+    e->smoothing++;
+  } else {
+    e->modulator[voice][m]=value;
+  }
+  e->constdirty[voice]=1;
+}
+
+
+// start the voices playing the patch gliding to a new parameter value.
+// the song isn't touched, it may be a snapshot shared with other engines
+static void engine_applyparam(kengine *e, kparam *p)
+{
+  int voice;
+
+  if (p->synth<0 || p->synth>=MAX_SYNTH || p->patch<0 || p->patch>=MAX_PATCHES) return;
+  if (p->module<0 || p->module>=MAX_MODULES) return;
+
+  for(voice=0;voice<MAX_CHANNELS;voice++) {
+    if (e->voicesynth[voice]!=p->synth || e->voicepatch[voice]!=p->patch) continue;
+    engine_glide(e, voice, p->module, p->value, p->smooth/ENGINE_SMOOTHBLOCK);
+  }
+
+  if (e->record && e->recordlen < e->recordmax) {
+    e->record[e->recordlen]=*p;
+    e->record[e->recordlen].pos=e->pos;
+    e->recordlen++;
+  }
+}
+
+
+// apply queued and replayed changes due at the current position.
+// returns the position of the next one
+static long engine_params(kengine *e)
+{
+  kparam *p;
+
+  while (e->replaypos < e->replaylen && e->replay[e->replaypos].pos <= e->pos)
+    engine_applyparam(e, &e->replay[e->replaypos++]);
+  while ((p=engine_peekparam(e)) && p->pos <= e->pos) {
+    engine_applyparam(e, p);
+    engine_popparam(e);
+  }
+
+  if (p) {
+    if (e->replaypos < e->replaylen && e->replay[e->replaypos].pos < p->pos)
+      return e->replay[e->replaypos].pos;
+    return p->pos;
+  }
+  if (e->replaypos < e->replaylen) return e->replay[e->replaypos].pos;
+  return LONG_MAX;
+}
+
+
+void engine_applyparams(kengine *e)
+{
+  kparam *p;
+
+  while ((p=engine_peekparam(e))) {
+    engine_applyparam(e, p);
+    engine_popparam(e);
+  }
+}
+
+
+void engine_smooth(kengine *e)
+{
+  int voice, m;
+
+  if (!e->smoothing) return;
+  for(voice=0;voice<MAX_CHANNELS;voice++) {
+    for(m=0;m<MAX_MODULES;m++) {
+      if (!e->smoothleft[voice][m]) continue;
+      e->modulator[voice][m]+=(e->smoothtarget[voice][m]-e->modulator[voice][m])/e->smoothleft[voice][m];
+      e->constdirty[voice]=1;
+      if (!--e->smoothleft[voice][m]) e->smoothing--;
+    }
+  }
+}
+
+
+// stop gliding the parameters of a voice
+static void engine_stopsmooth(kengine *e, int voice)
+{
+  int m;
+
+  if (!e->smoothing) return;
+  for(m=0;m<MAX_MODULES;m++) {
+    if (e->smoothleft[voice][m]) {
+      e->smoothleft[voice][m]=0;
+      e->smoothing--;
+    }
+  }
+}
+
+
+void engine_record(kengine *e, kparam *buf, int max)
+{
+  e->record=buf;
+  e->recordmax=buf ? max : 0;
+  e->recordlen=0;
+}
+
+
+void engine_replay(kengine *e, kparam *list, int n)
+{
+  e->replay=list;
+  e->replaylen=list ? n : 0;
+  e->replaypos=0;
+}
+
+
+/*
+  recorded parameter changes are saved as "KPRM", dwords for the start
+  measure and length of the render run in measures, a dword count and
+  16 bytes for each change:
+
+    dword  sample position
+    word   synth
+    word   patch
+    word   module
+    word   smoothing length in samples
+    float  value
+*/
+int engine_saveparams(const char *filename, int start, int measures, kparam *list, int n)
+{
+  FILE *f;
+  unsigned char rec[16];
+  s32 pos;
+  u32 hdr[3];
+  int i;
+
+  f=fopen(filename, "wb");
+  if (!f) return -1;
+  hdr[0]=start;
+  hdr[1]=measures;
+  hdr[2]=n;
+  fwrite("KPRM", 4, 1, f);
+  fwrite(hdr, 4, 3, f);
+  for(i=0;i<n;i++) {
+    pos=list[i].pos;
+    memcpy(&rec[0], &pos, 4);
+    memcpy(&rec[4], &list[i].synth, 2);
+    memcpy(&rec[6], &list[i].patch, 2);
+    memcpy(&rec[8], &list[i].module, 2);
+    memcpy(&rec[10], &list[i].smooth, 2);
+    memcpy(&rec[12], &list[i].value, 4);
+    fwrite(rec, 16, 1, f);
+  }
+  if (fclose(f)) return -1;
+  return 0;
+}
+
+
+int engine_loadparams(const char *filename, int *start, int *measures, kparam **list, int *n)
+{
+  FILE *f;
+  unsigned char rec[16];
+  char magic[4];
+  s32 pos;
+  u32 hdr[3], count;
+  kparam *p;
+  int i;
+
+  f=fopen(filename, "rb");
+  if (!f) return -1;
+  if (fread(magic, 4, 1, f)!=1 || memcmp(magic, "KPRM", 4) || fread(hdr, 4, 3, f)!=3 ||
+      hdr[0] >= MAX_SONGLEN || hdr[1] > MAX_SONGLEN || hdr[2] > 0x1000000) { fclose(f); return -1; }
+  count=hdr[2];
+  p=malloc(sizeof(kparam)*(count ? count : 1));
+  if (!p) { fclose(f); return -1; }
+  for(i=0;i<count;i++) {
+    if (fread(rec, 16, 1, f)!=1) { free(p); fclose(f); return -1; }
+    memcpy(&pos, &rec[0], 4);
+    p[i].pos=pos;
+    memcpy(&p[i].synth, &rec[4], 2);
+    memcpy(&p[i].patch, &rec[6], 2);
+    memcpy(&p[i].module, &rec[8], 2);
+    memcpy(&p[i].smooth, &rec[10], 2);
+    memcpy(&p[i].value, &rec[12], 4);
+  }
+  fclose(f);
+  *start=hdr[0];
+  *measures=hdr[1];
+  *list=p;
+  *n=count;
+  return 0;
+}
+
+
+
+
+//
+// signal path following
+//
+static int engine_trace(kengine *e, int synth, int pm, int top)
+{
+  int n;
+
+  // if this module is deleted or already tagged, return back
+  if (pm<0 || pm>=MAX_MODULES) return top;
+  if (e->mod[synth][pm].type<0 || e->mod[synth][pm].tag) return top;
+
+  // tag this module and follow all patches which bring signals in
+  e->mod[synth][pm].tag=1;
+  for(n=0;n<modInputCount[e->mod[synth][pm].type];n++)
+    top=engine_trace(e, synth, e->mod[synth][pm].input[n], top);
+
+  // push this module to the fifo and return
+  e->signalfifo[synth][top++]=pm;
+  return top;
+}
+
+void engine_stackify(kengine *e, int synth)
+{
+  int m;
+
+  for(m=0;m<MAX_MODULES;m++) { e->signalfifo[synth][m]=-1; e->mod[synth][m].tag=0; }
+
+  // find the output module and start working backwards from it
+  for(m=0;m<MAX_MODULES;m++)
+    if (e->mod[synth][m].type==MOD_OUTPUT) { engine_trace(e, synth, m, 0); break; }
+  engine_fold(e, synth);
+}
+
+void engine_fold(kengine *e, int synth)
+{
+  int m, mi, mt, i, ii;
+
+  memset(e->constmod[synth], 0, MAX_MODULES);
+  e->hasdelay[synth]=0;
+  for(m=0; m<MAX_MODULES && e->signalfifo[synth][m]>=0; m++) {
+    mi=e->signalfifo[synth][m];
+    mt=e->mod[synth][mi].type;
+    if (mt==MOD_DELAY) e->hasdelay[synth]=1;
+    if (mt<0 || !modFoldable[mt]) continue;
+    e->constmod[synth][mi]=1;
+    for(i=0;i<4;i++) {
+      ii=e->mod[synth][mi].input[i];
+      if (ii>=0 && !e->constmod[synth][ii]) e->constmod[synth][mi]=0;
+    }
+  }
+  for(i=0;i<MAX_CHANNELS;i++) e->constdirty[i]=1;
+}
+
+
+
+
+//
+// voice control
+//
+
+// run one sample through the signal stack of a voice, returns the
+// output of the last module in the stack
+float engine_runvoice(kengine *e, int voice, int synth)
+{
+  int m, mi, mt, ii, i;
+  float signals[4], out;
+  void *buf;
+
+  out=0.0f;
+  if (synth!=e->voicesynth[voice]) e->constdirty[voice]=1;
+  for(m=0; m<MAX_MODULES && e->signalfifo[synth][m]>=0; m++) {
+    mi=e->signalfifo[synth][m];
+    mt=e->mod[synth][mi].type;
+    if (mt<0) continue;
+
+    // constant modules keep their output until the parameters change
+    if (e->constmod[synth][mi] && !e->constdirty[voice]) {
+      out=e->output[voice][mi];
+      continue;
+    }
+
+    // hold the last value of control signals between control rate
+    // steps, except when restarting
+    if (e->quality>=ENGINE_QUALITY_CONTROLRATE && (modControlRateInputs[mt]&MOD_CONTROLRATE) &&
+        e->ctlphase[voice] && !e->restart[voice]) {
+      out=e->output[voice][mi];
+      continue;
+    }
+
+    for(i=0;i<4;i++) {
+      ii=e->mod[synth][mi].input[i];
+      signals[i] = (ii>=0) ? e->output[voice][ii] : 0.0f;
+    }
+    if (e->quality>=ENGINE_QUALITY_CONTROLRATE) {
+      // rates are scaled up to cover the whole period
+      for(i=0;i<4;i++) if (modControlRateInputs[mt]&(1<<i)) signals[i]*=ENGINE_CONTROLRATE;
+    }
+
+    if (modDataBufferLength[mt]) {
+      memcpy(&buf, &e->localdata[voice][mi][0], sizeof(void*));
+      if (!buf) {
+        buf=kmm_alloc(e, modDataBufferLength[mt], voice, synth, mi, mt);
+        memcpy(&e->localdata[voice][mi][0], &buf, sizeof(void*));
+      }
+    }
+
+    out=e->output[voice][mi]=mod_functable[mt](e, voice, &e->modulator[voice][mi], (void*)&e->localdata[voice][mi], (float*)&signals);
+  }
+  e->restart[voice]=0; // did restart on this sample
+  e->constdirty[voice]=0;
+  if (e->quality>=ENGINE_QUALITY_CONTROLRATE) e->ctlphase[voice]=(e->ctlphase[voice]+1)%ENGINE_CONTROLRATE;
+  return out;
+}
+
+
+// loads a patch from the bank to the synth voice
+void engine_loadpatch(kengine *e, int voice, int synth, int patch)
+{
+  int j;
+
+  // copy modulator values form patch to synth modules
+  for(j=0;j<MAX_MODULES;j++) if (e->mod[synth][j].type)
+    e->modulator[voice][j]=e->modvalue[synth][patch][j];
+  e->voicesynth[voice]=synth;
+  e->voicepatch[voice]=patch;
+  e->constdirty[voice]=1;
+  engine_stopsmooth(e, voice);
+}
+
+
+// move the float modulators of a voice to the values of a patch over
+// frames samples, in steps taken by engine_smooth(). other modulators
+// switch at once
+void engine_glidepatch(kengine *e, int voice, int synth, int patch, int frames)
+{
+  int j, mt;
+
+  for(j=0;j<MAX_MODULES;j++) {
+    mt=e->mod[synth][j].type;
+    if (!mt) continue;
+    engine_glide(e, voice, j, e->modvalue[synth][patch][j],
+      (mt>0 && modModulatorTypes[mt]==1) ? frames/ENGINE_SMOOTHBLOCK : 0);
+  }
+  e->voicesynth[voice]=synth;
+  e->voicepatch[voice]=patch;
+  e->constdirty[voice]=1;
+}
+
+
+// trigger a note
+void engine_trignote(kengine *e, int voice, int note)
+{
+  if (note<0) note=0;
+  if (note>=ENGINE_NOTES) note=ENGINE_NOTES-1;
+  e->pitch[voice]=engine_notefreq[note];
+  e->gate[voice]=1;
+  e->restart[voice]=e->seq_restart[voice];
+}
+
+
+// reset a synth voice so that it no longer produces sound
+void engine_resetvoice(kengine *e, int voice)
+{
+  int m, mi, mt, synth;
+  long i;
+  float *lbuf;
+
+  e->gate[voice]=0;
+  e->pitch[voice]=110.0/OUTPUTFREQ;
+  e->noisekey[voice]=engine_noisehash(e->noiseseed + voice*0x9e3779b9);
+  e->noisectr[voice]=0;
+  e->noiseend[voice]=0;
+  e->constdirty[voice]=1;
+  synth=e->seq_synth[voice];
+  for(m=0; m<MAX_MODULES && e->signalfifo[synth][m]>=0; m++) {
+    mi=e->signalfifo[synth][m];
+    mt=e->mod[synth][mi].type;
+    e->output[voice][mi]=0;
+    switch(mt) {
+      case MOD_WAVEFORM:
+        mod_fdata(voice, mi)[0]=0; // osc accu
+        mod_fdata(voice, mi)[1]=0; // subosc accu
+        break;
+      case MOD_ADSR:
+        mod_fdata(voice, mi)[0]=0; // accu
+        mod_ldata(voice, mi)[1]=0; // old gate
+        break;
+      case MOD_LFO:
+        mod_fdata(voice, mi)[0]=0; // accu
+        break;
+      case MOD_DELAY:
+        memcpy(&lbuf, &e->localdata[voice][mi][0], sizeof(void*));
+        if (lbuf) memset(lbuf, 0, modDataBufferLength[MOD_DELAY]*sizeof(float));
+        mod_ldata(voice, mi)[2]=0; // write position
+        break;
+      case MOD_FILTER:
+        mod_fdata(voice, mi)[0]=0; //lp
+        mod_fdata(voice, mi)[1]=0; //bp
+        mod_fdata(voice, mi)[2]=0; //hp
+        break;
+      case MOD_LPF24:
+        for(i=0;i<8;i++) mod_ddata(voice, mi)[i]=0;
+        break;
+      case MOD_RESAMPLE:
+        mod_fdata(voice, mi)[0]=0; // accu
+        mod_fdata(voice, mi)[1]=0; // held sample
+        break;
+      case MOD_SUPERSAW:
+        for(i=0;i<8;i++) mod_fdata(voice, mi)[i]=0;
+        mod_fdata(voice, mi)[8]=0; //lp
+        mod_fdata(voice, mi)[9]=0; //bp
+        mod_fdata(voice, mi)[10]=0; //hp
+        break;
+    }
+  }
+}
+
+
+// the counters of a block are independent, so this vectorizes
+void engine_noisefill(kengine *e, int voice, u32 ctr)
+{
+  int i;
+  u32 key;
+
+  key=e->noisekey[voice];
+  for(i=0;i<ENGINE_NOISEBLOCK;i++) e->noisebuf[voice][i]=engine_noisevalue(key, ctr+i);
+  e->noiseend[voice]=ctr+ENGINE_NOISEBLOCK;
+}
+
+
+// panic reset - completely resets all voices
+void engine_panic(kengine *e)
+{
+  int voice;
+  for(voice=0;voice<e->seqch;voice++) engine_resetvoice(e, voice);
+}
+
+
+
+
+//
+// song rendering
+//
+
+// starting position of the pattern playing on a channel at the given
+// measure, or -1 if there's nothing playing there
+static int engine_patternstart(kengine *e, int ch, int measure)
+{
+  int i, p;
+
+  for(i=measure;i>=0;i--) {
+    p=e->seq_pattern[ch][i];
+    if (p>=0) {
+      if (measure < (i+e->pattlen[p]*e->seq_repeat[ch][i])) return i;
+    }
+  }
+  return -1;
+}
+
+
+int engine_songlength(kengine *e)
+{
+  int i, ch, n, m;
+
+  for(i=0,m=0;i<e->seqsonglen;i++) for(ch=0;ch<e->seqch;ch++) {
+    if (e->seq_pattern[ch][i]>=0) {
+      n=i+e->seq_repeat[ch][i]*e->pattlen[e->seq_pattern[ch][i]];
+      if (n>m) m=n;
+    }
+  }
+  return m;
+}
+
+
+// add an event to the timeline of a voice
+static void engine_addevent(kengine *e, int ch, long pos, int type, int value, int accent)
+{
+  kevent *ev;
+
+  ev=&e->events[ch][e->eventcount[ch]++];
+  ev->pos=pos;
+  ev->type=type;
+  ev->value=value;
+  ev->accent=accent;
+}
+
+
+// walks the sequencer once and lays out everything that happens on each
+// voice during the render run as a list of sample-stamped events. the
+// events fall on the first sample of the ticks at which they used to be
+// picked up by following the patterns sample by sample
+int engine_compile(kengine *e)
+{
+  int ch, step, measure, pattstart, pattern, pattpos, m, steps;
+  long tickdiv, pos;
+  u32 note;
+  kevent *ev;
+
+  tickdiv=OUTPUTFREQ/(e->bpm*256/60);
+  if (tickdiv<1) tickdiv=1;
+
+  // at most a patch, a note and a gate event per step
+  steps=(e->len+tickdiv*64-1)/(tickdiv*64) + 1;
+
+  for(ch=0;ch<MAX_CHANNELS;ch++) {
+    e->eventcount[ch]=0;
+    e->eventpos[ch]=0;
+    if (ch>=e->seqch) continue;
+
+    ev=realloc(e->events[ch], sizeof(kevent)*steps*3);
+    if (!ev) return -1;
+    e->events[ch]=ev;
+
+    measure=-1; pattstart=-1;
+    for(step=e->start*16; ; step++) {
+      pos=((long)step*64 - (e->start<<10))*tickdiv;
+      if (pos>=e->len) break;
+      if ((step>>4)!=measure) {
+        measure=step>>4;
+        pattstart=engine_patternstart(e, ch, measure);
+      }
+      if (pattstart<0) continue;
+
+      pattern=e->seq_pattern[ch][pattstart];
+      pattpos=step - (pattstart*16);
+      while (pattpos>=(e->pattlen[pattern]*16)) pattpos-=(e->pattlen[pattern]*16);
+
+      // tick 0 on new pattern or first sample of a render run -> load patch to synth
+      if (pattpos==0 || pos==0)
+        engine_addevent(e, ch, pos, EVENT_PATCH, e->seq_patch[ch][pattstart], 0);
+
+      // tick 0/64/128/192 : trigger notes
+      note=e->pattdata[pattern][pattpos];
+      if (note && !(note&NOTE_LEGATO))
+        engine_addevent(e, ch, pos, EVENT_NOTE, (note&0x7f)+e->seq_transpose[ch][pattstart], (note&NOTE_ACCENT) ? 1 : 0);
+
+      // tick 60/124/188/252 : drop gate if following note is not legato
+      pos+=60*tickdiv;
+      if (pos<e->len) {
+        m=pattpos+1;
+        engine_addevent(e, ch, pos, EVENT_GATE,
+          (m<(e->pattlen[pattern]*16) && (e->pattdata[pattern][m]&NOTE_LEGATO)) ? 1 : 0, 0);
+      }
+    }
+  }
+
+  engine_seek(e, e->pos);
+  return 0;
+}
+
+
+void engine_seek(kengine *e, long pos)
+{
+  int ch, i;
+
+  e->pos=pos;
+  for(ch=0;ch<MAX_CHANNELS;ch++) {
+    for(i=0;i<e->eventcount[ch] && e->events[ch][i].pos<pos;i++);
+    e->eventpos[ch]=i;
+  }
+}
+
+
+// plays the events of a voice that are due at the current position.
+// returns the position of the next event on the voice
+static long engine_events(kengine *e, int voice)
+{
+  kevent *ev;
+
+  while (e->eventpos[voice] < e->eventcount[voice]) {
+    ev=&e->events[voice][e->eventpos[voice]];
+    if (ev->pos > e->pos) return ev->pos;
+    switch (ev->type) {
+      case EVENT_PATCH:
+        engine_loadpatch(e, voice, e->seq_synth[voice], ev->value);
+        break;
+      case EVENT_NOTE:
+        engine_trignote(e, voice, ev->value);
+        e->accent[voice]=ev->accent;
+        break;
+      case EVENT_GATE:
+        e->gate[voice]=ev->value;
+        break;
+    }
+    e->eventpos[voice]++;
+  }
+  return LONG_MAX;
+}
+
+
+long engine_start(kengine *e, int start, int measures)
+{
+  int voice;
+
+  // reset all synths and load patch 0
+  for(voice=0;voice<e->seqch;voice++) {
+    engine_resetvoice(e, voice);
+    engine_loadpatch(e, voice, e->seq_synth[voice], 0);
+  }
+  e->start=start;
+  e->pos=0;
+  e->len=((long)OUTPUTFREQ*60*measures*4)/e->bpm;
+  e->replaypos=0;
+  e->recordlen=0;
+
+  // changes queued before the run are in the song it starts from
+  __atomic_store_n(&e->paramhead, __atomic_load_n(&e->paramtail, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+  if (engine_compile(e)) {
+    // nothing to render without a timeline
+    e->len=0;
+    return -1;
+  }
+  return e->len;
+}
+
+
+void engine_setquality(kengine *e, int quality)
+{
+  int voice;
+
+  if (quality<ENGINE_QUALITY_FULL) quality=ENGINE_QUALITY_FULL;
+  if (quality>ENGINE_QUALITY_LOWEST) quality=ENGINE_QUALITY_LOWEST;
+
+  // voices must play a block before they can be found silent
+  if (e->quality<ENGINE_QUALITY_SKIPSILENT)
+    for(voice=0;voice<MAX_CHANNELS;voice++) e->silent[voice]=0;
+  e->quality=quality;
+}
+
+
+// monotonic time in seconds for profiling
+static double engine_seconds(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec/1000000000.0;
+}
+
+
+// renders in blocks that end at the next event on any voice, so the
+// voices run without checking the sequencer between events. the voices
+// are mixed in order, so the sums are the same as mixing sample by sample
+long engine_render(kengine *e, short *buffer, long frames)
+{
+  int voice, synth;
+  long i, n, done, next, ev;
+  float mix[ENGINE_BLOCK], p, vp;
+  short s;
+  double t=0, t0;
+
+  if (frames > (e->len - e->pos)) frames=e->len - e->pos;
+  for(done=0;done<frames;done+=n) {
+    // play due events and find the end of the block
+    next=e->pos + ENGINE_BLOCK;
+    if (next > e->pos+(frames-done)) next=e->pos+(frames-done);
+    for(voice=0;voice<e->seqch;voice++) {
+      ev=engine_events(e, voice);
+      if (ev<next) next=ev;
+    }
+
+    // parameter changes due now, and glide on the smoothing grid
+    ev=engine_params(e);
+    if (ev<next) next=ev;
+    if (e->smoothing) {
+      if (!(e->pos%ENGINE_SMOOTHBLOCK)) engine_smooth(e);
+      ev=(e->pos/ENGINE_SMOOTHBLOCK+1)*ENGINE_SMOOTHBLOCK;
+      if (ev<next) next=ev;
+    }
+    n=next - e->pos;
+
+    for(i=0;i<n;i++) mix[i]=0;
+    if (e->profile) t=engine_seconds();
+    for(voice=0;voice<e->seqch;voice++) {
+      synth=e->seq_synth[voice];
+      if (e->quality>=ENGINE_QUALITY_SKIPSILENT) {
+        // leave out voices that went quiet until the next note
+        if (e->silent[voice] && !e->gate[voice]) continue;
+        vp=0;
+        for(i=0;i<n;i++) {
+          p=engine_runvoice(e, voice, synth);
+          if (!e->seq_mute[voice]) mix[i]+=p;
+          if (fabs(p) > vp) vp=fabs(p);
+        }
+        e->silent[voice]=(vp < ENGINE_SILENCE && !e->hasdelay[synth]);
+      } else if (e->seq_mute[voice]) {
+        // keep muted voices running so they're in sync when unmuted
+        for(i=0;i<n;i++) engine_runvoice(e, voice, synth);
+      } else {
+        for(i=0;i<n;i++) mix[i]+=engine_runvoice(e, voice, synth);
+      }
+      if (e->profile) {
+        t0=t; t=engine_seconds();
+        e->voicetime[voice]+=t-t0;
+      }
+    }
+
+    for(i=0;i<n;i++) {
+      p=mix[i];
+      if (fabs(p) > e->peak) e->peak=fabs(p);
+      s=(short)(32766*engine_shape(p));
+      buffer[(done+i)*2]=s; buffer[(done+i)*2+1]=s; // output stream is in stereo
+    }
+    e->pos+=n;
+  }
+
+  return frames;
+}
@@ -0,0 +1,364 @@
+/*
+ * Komposter
+ *
+ * Copyright (c) 2010 Noora Halme et al. (see AUTHORS)
+ *
+ * This code is licensed under the GNU General Public
+ * License version 2. See LICENSE for full text.
+ *
+ * Reentrant synthesis engine
+ *
+ */
+
+#ifndef __ENGINE_H__
+#define __ENGINE_H__
+
+#include "constants.h"
+#include "modules.h"
+
+// bumped whenever a change to the engine alters the rendered output
+#define ENGINE_VERSION	4
+
+// error codes from loading a song, shared with the editor's chunk loaders
+#define		FILE_ERROR_FWRITE	1
+#define		FILE_ERROR_FREAD	2
+#define		FILE_ERROR_CHUNKTYPE	3
+#define		FILE_ERROR_FOPEN	4
+#define		FILE_ERROR_CORRUPT	5
+
+// dword size depending on platform - same as in arch.h, which can't
+// be included here because it pulls in the gl and al headers
+#ifndef u32
+#if __x86_64__
+  #define u32 unsigned int
+  #define s32 int
+#else
+  #define u32 unsigned long
+  #define s32 long
+#endif
+#endif
+
+// flags for notes
+#define NOTE_LEGATO     0x0100 // tie notes together, ie. gate stays up continuously
+#define NOTE_ACCENT     0x0200 // accent the note - synth determines the effect
+#define NOTE_STACCATO   0x0400 // drop gate with env trig at the end of attack (not implemented)
+#define NOTE_PORTAMENTO 0x0800 // slide to this note in the given duration (not implemented)
+
+// channel restart flags in seq
+#define SEQ_RESTART_ENV	1
+#define	SEQ_RESTART_VCO	2
+#define SEQ_RESTART_LFO	4
+
+// sequencer event types in the compiled timeline
+#define EVENT_PATCH	0 // load patch <value> to the synth of the voice
+#define EVENT_NOTE	1 // trigger note <value> with accent
+#define EVENT_GATE	2 // set gate to <value>
+
+// frames rendered at most between two looks at the timeline
+#define ENGINE_BLOCK	256
+
+// parameter changes glide in steps taken every ENGINE_SMOOTHBLOCK
+// frames from the start of the render run
+#define ENGINE_SMOOTHBLOCK	64
+
+// reduced quality levels for rendering in realtime on a slow machine.
+// each level includes the ones below it
+#define ENGINE_QUALITY_FULL		0
+#define ENGINE_QUALITY_SKIPSILENT	1 // don't run voices that are silent with the gate down
+#define ENGINE_QUALITY_FASTMATH		2 // approximate sines in oscillators and filters
+#define ENGINE_QUALITY_CONTROLRATE	3 // run envelopes and lfos every ENGINE_CONTROLRATE samples
+#define ENGINE_QUALITY_LOWEST		3
+
+#define ENGINE_CONTROLRATE	4
+
+// peak level below which a voice counts as silent
+#define ENGINE_SILENCE		(1.0f/65536)
+
+// number of notes in the note frequency table, c-0 to g-10
+#define ENGINE_NOTES		128
+
+// size of the parameter change queue, must be a power of two
+#define ENGINE_PARAMQUEUE	256
+
+// noise values hashed at a time for each voice
+#define ENGINE_NOISEBLOCK	64
+
+
+// an event on the timeline of one voice, at a sample position from the
+// start of the render run
+typedef struct {
+  long pos;
+  short type;
+  short accent;
+  int value;
+} kevent;
+
+
+// a change to a patch parameter at a sample position from the start of
+// the render run, or -1 for the start of the next block. the voices
+// playing the patch glide to the new value over smooth frames
+typedef struct {
+  long pos;
+  short synth;
+  short patch;
+  short module;
+  short smooth;
+  float value;
+} kparam;
+
+
+// song data laid out the same way as in the editor, for engines that
+// own their song and for snapshots of the editor's song
+typedef struct {
+  synthmodule mod[MAX_SYNTH][MAX_MODULES];
+  int signalfifo[MAX_SYNTH][MAX_MODULES];
+  float modvalue[MAX_SYNTH][MAX_PATCHES][MAX_MODULES];
+  u32 pattdata[MAX_PATTERN][MAX_PATTLENGTH];
+  u32 pattlen[MAX_PATTERN];
+  int seq_pattern[MAX_CHANNELS][MAX_SONGLEN];
+  int seq_repeat[MAX_CHANNELS][MAX_SONGLEN];
+  int seq_transpose[MAX_CHANNELS][MAX_SONGLEN];
+  int seq_patch[MAX_CHANNELS][MAX_SONGLEN];
+  int seq_synth[MAX_CHANNELS];
+  int seq_restart[MAX_CHANNELS];
+  int seq_mute[MAX_CHANNELS];
+} ksong;
+
+
+/*
+  the engine context holds everything needed to render a song. the song
+  data is reached through pointers so that the editor can point an engine
+  at its own global arrays, while engine_new() allocates private storage
+  for standalone use. voice state and the render position are always
+  owned by the context, so any number of engines can render in parallel
+  as long as each one is only used from one thread at a time.
+*/
+typedef struct kengine {
+  // song data
+  synthmodule (*mod)[MAX_MODULES];
+  int (*signalfifo)[MAX_MODULES];
+  float (*modvalue)[MAX_PATCHES][MAX_MODULES];
+  u32 (*pattdata)[MAX_PATTLENGTH];
+  u32 *pattlen;
+  int (*seq_pattern)[MAX_SONGLEN];
+  int (*seq_repeat)[MAX_SONGLEN];
+  int (*seq_transpose)[MAX_SONGLEN];
+  int (*seq_patch)[MAX_SONGLEN];
+  int *seq_synth;
+  int *seq_restart;
+  int *seq_mute;
+  int seqch;
+  int seqsonglen;
+  int bpm;
+
+  // module instance data - module index is its mod structure index number, NOT signal stack position
+  float modulator[MAX_CHANNELS][MAX_MODULES];  // current modulator value
+  float output[MAX_CHANNELS][MAX_MODULES];     // output "voltage" from each module
+  float localdata[MAX_CHANNELS][MAX_MODULES][16];  // 16 dwords of local data for each module
+
+  // per-voice sequencer state, pitch as a phase increment per sample
+  float pitch[MAX_CHANNELS];
+  int accent[MAX_CHANNELS];
+  int gate[MAX_CHANNELS]; // these are just 1-bit flags
+  int restart[MAX_CHANNELS]; // flags for the different restart types
+
+  // patch loaded on each voice
+  int voicesynth[MAX_CHANNELS];
+  int voicepatch[MAX_CHANNELS];
+
+  // parameter changes queued from another thread. the queueing thread
+  // only writes paramtail and paramflush and the rendering thread only
+  // paramhead. changes before paramflush are dropped unapplied
+  kparam paramqueue[ENGINE_PARAMQUEUE];
+  unsigned int paramhead;
+  unsigned int paramtail;
+  unsigned int paramflush;
+
+  // parameter changes played back from a recording, and the buffer
+  // the changes made during a render are recorded to
+  kparam *replay;
+  int replaylen, replaypos;
+  kparam *record;
+  int recordlen, recordmax;
+
+  // parameters gliding to a new value, and how many of them there are
+  float smoothtarget[MAX_CHANNELS][MAX_MODULES];
+  int smoothleft[MAX_CHANNELS][MAX_MODULES];
+  int smoothing;
+
+  // noise generator state. each voice has its own counter-based stream
+  // so the noise doesn't depend on the number or order of other voices
+  u32 noiseseed;
+  u32 noisekey[MAX_CHANNELS];
+  u32 noisectr[MAX_CHANNELS];
+
+  // the values of the stream up to counter noiseend, hashed in blocks
+  float noisebuf[MAX_CHANNELS][ENGINE_NOISEBLOCK];
+  u32 noiseend[MAX_CHANNELS];
+
+  // render position in samples from the start measure, and the
+  // length of the render run set by engine_start()
+  int start;
+  long pos;
+  long len;
+
+  // sequencer timeline built by engine_compile() for each voice and
+  // the index of the next event to play
+  kevent *events[MAX_CHANNELS];
+  int eventcount[MAX_CHANNELS];
+  int eventpos[MAX_CHANNELS];
+
+  // largest absolute sample value mixed since last cleared
+  float peak;
+
+  // modules of each synth whose output is constant for a patch, set by
+  // engine_stackify() and engine_setsong(). they only run on a voice
+  // when its parameters have changed since the last sample
+  unsigned char constmod[MAX_SYNTH][MAX_MODULES];
+  int constdirty[MAX_CHANNELS];
+
+  // synths with a delay line, which can be quiet between echoes, so
+  // their voices are never left out as silent. set with constmod
+  unsigned char hasdelay[MAX_SYNTH];
+
+  // quality level, a voice's peak was below ENGINE_SILENCE in the last
+  // block, and position of each voice in its control rate period
+  int quality;
+  int silent[MAX_CHANNELS];
+  int ctlphase[MAX_CHANNELS];
+
+  // seconds spent running each voice since last cleared, measured by
+  // engine_render() when profile is set
+  int profile;
+  double voicetime[MAX_CHANNELS];
+
+  // storage allocated by engine_new(), NULL if pointing to external arrays
+  void *storage;
+} kengine;
+
+
+// noise value for a counter in the stream of a voice, in [-1.0, 1.0)
+static inline u32 engine_noisehash(u32 x)
+{
+  x^=x>>16; x*=0x7feb352d;
+  x^=x>>15; x*=0x846ca68b;
+  x^=x>>16;
+  return x;
+}
+static inline float engine_noisevalue(u32 key, u32 ctr)
+{
+  return (float)((s32)engine_noisehash(engine_noisehash(ctr)^key)) * (1.0f/2147483648.0f);
+}
+
+// fill the noise block of a voice from counter ctr on
+void engine_noisefill(kengine *e, int voice, u32 ctr);
+
+// next noise value for a voice
+static inline float engine_noise(kengine *e, int voice)
+{
+  u32 ctr=e->noisectr[voice]++;
+
+  if (e->noiseend[voice]-ctr-1 >= ENGINE_NOISEBLOCK) engine_noisefill(e, voice, ctr);
+  return e->noisebuf[voice][ENGINE_NOISEBLOCK-(e->noiseend[voice]-ctr)];
+}
+
+
+// phase increment per sample for each note at OUTPUTFREQ, built by
+// engine_init() and shared by all engines
+extern float engine_notefreq[ENGINE_NOTES];
+
+// build the lookup tables shared by all engines. called by engine_new()
+// and engine_setsong(), safe to call any number of times from any thread
+void engine_init(void);
+
+// create and destroy an engine with its own song storage
+kengine *engine_new(void);
+void engine_free(kengine *e);
+
+// point an engine at song data. the song must stay valid for as long
+// as the engine renders from it
+void engine_setsong(kengine *e, ksong *song);
+
+// load a .ksong file into an engine from engine_new(). returns 0 or
+// one of the FILE_ERROR_* codes
+int engine_load(kengine *e, const char *filename);
+int engine_loadmem(kengine *e, unsigned char *data, long len);
+
+// crc32 of a memory block, continuing from a previous crc (0 to start)
+u32 engine_crc32(u32 crc, const unsigned char *data, long len);
+
+// checksum of a .ksong image - the one embedded by save_ksong() or,
+// for files saved before it was implemented, calculated from the data
+u32 engine_songcrc(const unsigned char *data, long len);
+
+// song length in measures up to the end of the last pattern
+int engine_songlength(kengine *e);
+
+// prepare a render run of the given measures. parameter changes still
+// queued are dropped. returns length in samples, or -1 if out of memory
+// for the timeline
+long engine_start(kengine *e, int start, int measures);
+
+// rebuild the timeline of the current render run after the sequencer
+// or pattern data has changed. returns 0 or -1 if out of memory
+int engine_compile(kengine *e);
+
+// move the render position of the current run
+void engine_seek(kengine *e, long pos);
+
+// render up to frames 16-bit stereo samples. returns number rendered
+long engine_render(kengine *e, short *buffer, long frames);
+
+// set the quality level to render at, ENGINE_QUALITY_FULL by default
+void engine_setquality(kengine *e, int quality);
+
+// set a patch parameter in the song; takes effect on the next patch load
+void engine_setparam(kengine *e, int synth, int patch, int module, float value);
+
+// queue a parameter change from another thread than the one rendering.
+// changes with a position must be queued in order. returns 0 or -1 if
+// the queue is full. the changes glide the voices playing the patch and
+// leave the song alone
+int engine_queueparam(kengine *e, kparam *p);
+
+// drop the queued changes that haven't been applied yet, e.g. before
+// falling back to reloading the patch when the queue is full
+void engine_flushparams(kengine *e);
+
+// apply the queued changes now, for callers running voices themselves
+void engine_applyparams(kengine *e);
+
+// take a step on the parameters gliding to new values
+void engine_smooth(kengine *e);
+
+// record the parameter changes made during the render run to a buffer,
+// or play back changes recorded earlier. recording stops when the
+// buffer is full and the count is kept in recordlen
+void engine_record(kengine *e, kparam *buf, int max);
+void engine_replay(kengine *e, kparam *list, int n);
+
+// save and load recorded parameter changes along with the render run
+// they were recorded in. returns 0 or -1 on error
+int engine_saveparams(const char *filename, int start, int measures, kparam *list, int n);
+int engine_loadparams(const char *filename, int *start, int *measures, kparam **list, int *n);
+
+// voice control
+float engine_runvoice(kengine *e, int voice, int synth);
+void engine_loadpatch(kengine *e, int voice, int synth, int patch);
+void engine_glidepatch(kengine *e, int voice, int synth, int patch, int frames);
+void engine_trignote(kengine *e, int voice, int note);
+void engine_resetvoice(kengine *e, int voice);
+void engine_panic(kengine *e);
+
+// build the signal stack of a synth from its module graph
+void engine_stackify(kengine *e, int synth);
+
+// find the modules of a synth that are constant for a patch and whether
+// it has a delay line. called by engine_stackify(), call after changing
+// the graph some other way
+void engine_fold(kengine *e, int synth);
+
+// waveshaper to limit audio range
+float engine_shape(float input);
+
+#endif
@@ -15,6 +15,7 @@
 #include <string.h>
 #include <errno.h>
 #include "constants.h"
+#include "engine.h"
 #include "fileops.h"
 #include "modules.h"
 #include "patch.h"
@@ -114,6 +115,7 @@ int save_ksong(char *filename)
   u32 crc;
   int datasize, t;
   int c_kpat, c_ksyn;
+  unsigned char *data;
   FILE *f;
   int r, i, nm, n, m, mm;
   
@@ -171,7 +173,7 @@ int save_ksong(char *filename)
   }
   datasize+=4; // checksum
   
-  f=fopen(filename, "wb");
+  f=fopen(filename, "w+b");
   if (!f) return FILE_ERROR_FOPEN;
 
   r=fwrite("KSNG", sizeof(char), 4, f);
@@ -194,8 +196,16 @@ int save_ksong(char *filename)
     save_chunk_kbnk(i, f);
   }
 
-  // checksum
-  crc=0; // TODO
+  // checksum of the chunk data written so far, read back from the file
+  crc=0;
+  fflush(f);
+  data=malloc(datasize-4);
+  if (data) {
+    fseek(f, 8, SEEK_SET);
+    if (fread(data, 1, datasize-4, f) == datasize-4) crc=engine_crc32(0, data, datasize-4);
+    free(data);
+  }
+  fseek(f, 0, SEEK_END);
   fwrite(&crc, sizeof(u32), 1, f);
   
   fclose(f);
@@ -258,6 +268,7 @@ int load_chunk_kbnk(int syn, FILE *f)
     memcpy(&modquantifier[syn][p], &chunkdata[fpos+128+sl*8], sl*4);    
   }
   free(chunkdata);
+  audio_patchchanged(1);
   return 0;
 }
 
@@ -524,6 +535,9 @@ void synth_stackify(int syn)
   for(m=0;m<MAX_MODULES;m++)
     if (mod[syn][m].type==MOD_OUTPUT) { top=synth_trace(syn, m, top); break; }
 
+  // modules may have come and gone, reload the patch being edited
+  audio_patchchanged(1);
+
   // set colors with a similar recursion
   synth_colorize(syn);
 
@@ -620,4 +634,5 @@ void synth_update_bpm(int newbpm) {
 
   // done, activate new bpm
   bpm=newbpm;
+  audio_patchchanged(0);
 }
\ No newline at end of file
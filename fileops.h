@@ -13,13 +13,8 @@
 #ifndef __FILEOPS_H__
 #define __FILEOPS_H__
 
-
-// error codes from chunk loaders
-#define		FILE_ERROR_FWRITE	1
-#define		FILE_ERROR_FREAD	2
-#define		FILE_ERROR_CHUNKTYPE	3
-#define		FILE_ERROR_FOPEN	4
-#define		FILE_ERROR_CORRUPT	5
+// the FILE_ERROR_* codes returned by the chunk loaders
+#include "engine.h"
 
 
 //
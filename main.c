@@ -36,6 +36,7 @@
 #include "modules.h"
 #include "pattern.h"
 #include "patch.h"
+#include "rtlog.h"
 #include "widgets.h"
 #include "sequencer.h"
 #include "shader.h"
@@ -49,12 +50,21 @@
 #define MAIN_PAGE4 4
 #define MAIN_VU	5
 #define MAIN_PANIC 6
+#define MAIN_DSP 7
 
 int cpage=1;
-int main_ui[7];
+int main_ui[8];
 
 float lastrf=0.0f;
 
+// dsp load meter with peak hold
+float lastload=0.0f, holdload=0.0f;
+int holdframes=0;
+unsigned long lastrenders=0;
+
+// audio dropouts already reported on the console
+unsigned long main_underruns=0, main_late=0;
+
 // posix threads for audio playback and rendering
 pthread_t audiothread;
 pthread_t renderthread;
@@ -62,6 +72,9 @@ pthread_t renderthread;
 // path to resources
 char respath[512];
 
+// from sequencer.c
+extern int seqch;
+
 // from audio.c
 extern int audiomode;
 extern short *render_buffer;
@@ -91,6 +104,7 @@ void mouse_hoverfunc(int x, int y)
   main_ui[MAIN_ABOUT]=hovertest_box(x,y,DS_WIDTH-42,DS_HEIGHT-14, 16, 73);
   main_ui[MAIN_PANIC]=hovertest_box(x, y, DS_WIDTH-206, DS_HEIGHT-14, 16, 16);
   main_ui[MAIN_VU]=hovertest_box(x,y,728, DS_HEIGHT-14, 16, 100);
+  main_ui[MAIN_DSP]=hovertest_box(x,y,618, DS_HEIGHT-14, 16, 100);
   
   // call the hover function of the currently active page
   switch(cpage) {
@@ -139,6 +153,7 @@ void mouse_clickfunc(int button, int state, int x, int y)
         panic=255;
       }
       if (main_ui[MAIN_VU]) { audio_peak=0.0f; console_post("VU meter peak reset"); return; }
+      if (main_ui[MAIN_DSP]) { holdload=0.0f; audio_resetstats(); console_post("DSP load peak reset"); return; }
     }
   }
 
@@ -209,8 +224,48 @@ void specialkeyfunc(int key, int x, int y)
 }
 
 
+// print a message posted by the audio threads
+void main_rtlog(int flags, const char *msg)
+{
+  printf("%s\n", msg);
+  if (flags&RTLOG_CONSOLE) console_post((char*)msg);
+}
+
+
 void update(int value)
 {
+  char tmps[128];
+  float lat, avg;
+  unsigned int dropped;
+  audio_stats st;
+
+  // hand the edits made since the last frame to the audio threads
+  audio_commit();
+
+  rtlog_drain(main_rtlog);
+  dropped=rtlog_dropped();
+  if (dropped) {
+    sprintf(tmps, "Audio log full, %u messages dropped", dropped);
+    console_post(tmps);
+  }
+
+  // tell why live playback stutters
+  audio_getstats(&st);
+  if (st.underruns!=main_underruns || st.late!=main_late) {
+    if (st.late!=main_late) {
+      sprintf(tmps, "Render fell behind playback - %.0f%% of realtime (peak %.0f%%)", st.renderavg*100, st.rendermax*100);
+    } else {
+      sprintf(tmps, "Audio underrun, %lu so far", st.underruns);
+    }
+    console_post(tmps);
+    main_underruns=st.underruns;
+    main_late=st.late;
+  }
+
+  if (audio_auditionlatency(&lat, &avg)) {
+    sprintf(tmps, "Audition latency %.1f ms (average %.1f ms)", lat, avg);
+    console_post(tmps);
+  }
   console_advanceframe();
   if (panic > 0) { panic-=20; if (panic<0) panic=0; }
   glutTimerFunc(20, update, value+1); // frame number in callback parameter
@@ -223,6 +278,7 @@ void *audio_playback(void *param)
 {
   int rc;
 
+  audio_threadsetup(AUDIO_THREAD_PLAYBACK);
   while(1) {
     audio_update(0);
     rc=usleep(1000); // 1ms sleep
@@ -234,8 +290,11 @@ void *audio_renderer(void *param)
 {
   int rc;
 
+  audio_threadsetup(AUDIO_THREAD_RENDER);
   while(1) {
-    if (render_state==RENDER_IN_PROGRESS || render_state==RENDER_LIVE) {
+    // runs are started here too, once the song is played
+    if ((render_state==RENDER_START && audiomode==AUDIOMODE_PLAY) ||
+        render_state==RENDER_IN_PROGRESS || render_state==RENDER_LIVE) {
       audio_render();
     } else {
       rc=usleep(10000);
@@ -245,6 +304,61 @@ void *audio_renderer(void *param)
 }
 
 
+// dsp load next to the vu meter, and the load of each channel when hovered
+void draw_dspload(void)
+{
+  char tmps[128];
+  audio_stats st;
+  float rf, maxload;
+  int i, n, busiest;
+
+  audio_getstats(&st);
+  rf=(st.renders!=lastrenders) ? st.renderavg : 0.0f; // idle if nothing was rendered
+  lastrenders=st.renders;
+  rf=(0.8*lastload) + (0.2*rf); // damping
+  lastload=rf;
+  if (rf >= holdload) { holdload=rf; holdframes=100; }
+  else if (holdframes>0) holdframes--;
+  else holdload*=0.98f;
+
+  draw_textbox(618, DS_HEIGHT-14, 16, 100, "", main_ui[MAIN_DSP]);
+  if (rf > 0.8f) glColor4f(0.7f, 0.1f, 0.1f, 0.94f); else glColor4f(0.68f, 0.33f, 0.0f, 0.94f);
+  glBegin(GL_QUADS);
+  glVertex2f(568, DS_HEIGHT-22);
+  glVertex2f(568 + fmin(1.0f, rf)*100, DS_HEIGHT-22);
+  glVertex2f(568 + fmin(1.0f, rf)*100, DS_HEIGHT-6);
+  glVertex2f(568, DS_HEIGHT-6);
+  glEnd();
+  glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+  glBegin(GL_LINES);
+  glVertex2f(568 + fmin(1.0f, holdload)*100, DS_HEIGHT-22);
+  glVertex2f(568 + fmin(1.0f, holdload)*100, DS_HEIGHT-6);
+  glEnd();
+  sprintf(tmps, "DSP %d%%", (int)(rf*100));
+  render_text(tmps, 618, DS_HEIGHT-11, 2, (holdload > 1.0f) ? 0xffff8080 : 0xffffffff, 1);
+
+  if (!(main_ui[MAIN_DSP]&1)) return;
+
+  // per-channel breakdown above the meter, scaled to the busiest channel
+  n=(audiomode==AUDIOMODE_PLAY) ? seqch : 1;
+  maxload=0.0f; busiest=0;
+  for(i=0;i<n;i++) if (st.voiceload[i] > maxload) { maxload=st.voiceload[i]; busiest=i; }
+  draw_textbox(618, DS_HEIGHT-60, 60, 200, "", 0);
+  for(i=0;i<n;i++) {
+    rf=(maxload > 0.0f) ? st.voiceload[i]/maxload : 0.0f;
+    glColor4f(0.68f, 0.33f, 0.0f, 0.94f);
+    glBegin(GL_QUADS);
+    glVertex2f(522+i*8, DS_HEIGHT-38);
+    glVertex2f(528+i*8, DS_HEIGHT-38);
+    glVertex2f(528+i*8, DS_HEIGHT-38-rf*36);
+    glVertex2f(522+i*8, DS_HEIGHT-38-rf*36);
+    glEnd();
+  }
+  sprintf(tmps, "busiest ch %d: %.1f%%", busiest+1, maxload*100);
+  render_text(tmps, 618, DS_HEIGHT-80, 2, 0xffffffff, 1);
+}
+
+
 void display(void)
 {
   char tmps[128];
@@ -306,6 +420,9 @@ void display(void)
   sprintf(tmps, "%1.2f", audio_peak);
   render_text(tmps, 728, DS_HEIGHT-11, 2, (audio_peak > 1.0f) ? 0xffff8080 : 0xffffffff, 1);
 
+  // draw dsp load meter - render time per buffer relative to its length
+  draw_dspload();
+
   if (panic > 0) {
     unsigned int color=0x00b05500|(panic<<24);
     render_text("PANIC!", DS_WIDTH/2, DS_HEIGHT/2, 4, color, 1);
@@ -357,8 +474,8 @@ int main(int argc, char **argv)
   // load config file from user's homedir
   dotfile_load();
 
-  // calculate tables for supersaw
-  calc_supersaw_tables();
+  // note frequency and supersaw tables
+  engine_init();
 
   // init data on all pages to defaults
   synth_init();
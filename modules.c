@@ -15,11 +15,8 @@
 #include <math.h>
 
 #define _MODULES_C_
-#include "audio.h"
-#include "buffermm.h"
+#include "engine.h"
 #include "modules.h"
-#include "synthesizer.h"
-#include "sequencer.h"
 
 // macros for typecasting the localdata void ptr
 #define mod_fdata  ((float*)data)
@@ -30,9 +27,6 @@
 
 #define clamp(X)   fmax(fmin(X, 1.0f), 0.0f)
 
-int noise_x1=0x67452301, noise_x2=0xefcdab89;
-
-
 // jp8000 supersaw oscillator offsets and detune curve coefficents (thanks to adam szabo!)
 double osc_offset[7]={0, 0.01991221, -0.01952356, 0.06216538, -0.06288439, 0.10745242, -0.11002313};
 double coeftable[12]={
@@ -44,19 +38,6 @@ float supersaw_detune[128][7];
 float supersaw_mix[128][7];
 
 
-float pitch[MAX_SYNTH];
-float accent[MAX_SYNTH];
-
-// these are just 1-bit flags
-int gate[MAX_SYNTH];
-
-// this has flags for different restart types
-int restart[MAX_SYNTH];
-
-// from sequencer.c
-extern int seqch;
-
-
 ////////////////////////////////////////////////
 //
 // module definitions
@@ -283,6 +264,55 @@ const char* modModulatorNames[MODTYPES]={
 "channel"
 };
 
+// modules that can run at a reduced control rate. MOD_CONTROLRATE is
+// set for those and the low bits are a mask of the inputs that are
+// rates per sample and must be scaled to match
+const int modControlRateInputs[MODTYPES]={
+	MOD_CONTROLRATE, //CV
+	MOD_CONTROLRATE|0x0b, //ADSR - attack, decay, release
+	0, //wave
+	MOD_CONTROLRATE|0x01, //lfo - frequency
+	MOD_CONTROLRATE, //knob
+	0, //amp
+	0, //mixer
+	0, //filter
+	0, //lpf24
+	0, //delay
+	0, //attenuator
+	0, //resample
+	0, //supersaw
+	0, //distort
+	MOD_CONTROLRATE, //accent
+	0, //output
+	0, // bitcrush
+        0, // slew
+        MOD_CONTROLRATE  // modulator
+};
+
+// modules whose output only depends on their inputs and modulator. when
+// all of their inputs are constant for a patch, so is their output
+const int modFoldable[MODTYPES]={
+	0, //CV
+	0, //ADSR
+	0, //wave
+	0, //lfo
+	1, //knob
+	1, //amp
+	1, //mixer
+	0, //filter
+	0, //lpf24
+	0, //delay
+	1, //attenuator
+	0, //resample
+	0, //supersaw
+	1, //distort
+	0, //accent
+	0, //output
+	0, // bitcrush
+        0, // slew
+        0  // modulator
+};
+
 // modulator value type. 0=no modulator, 1=float, 2=integer
 const int modModulatorTypes[MODTYPES]={
 	1, //CV
@@ -375,14 +405,27 @@ void calc_supersaw_tables() {
 ///////////////////////////////////////////////
 
 
-MODULE_FUNC(kbd) { return *mod=pitch[v]/OUTPUTFREQ; }
+// sin(2*pi*x) from a parabola with one correction step, good to about
+// 0.1% - used instead of sin() when the engine runs at reduced quality
+static inline float mod_fastsin(float x)
+{
+  float y;
+
+  x-=floor(x+0.5f);
+  y=8*x - 16*x*fabs(x);
+  return 0.225f*(y*fabs(y)-y) + y;
+}
+#define mod_sin2pi(e, x)	(((e)->quality>=ENGINE_QUALITY_FASTMATH) ? mod_fastsin(x) : sin(2*3.1415926*(x)))
+
+
+MODULE_FUNC(kbd) { return *mod=e->pitch[v]; }
 
 MODULE_FUNC(modulator) {
   int mod_src=(int)(*mod);
-  if (mod_src < 0 || mod_src >= seqch) {
+  if (mod_src < 0 || mod_src >= e->seqch) {
     mod_src=v;
   }
-  float cv=pitch[mod_src]/OUTPUTFREQ;
+  float cv=e->pitch[mod_src];
   //printf("modulator: channelnum %d mod source %d cv %f\n", v, mod_src, cv);
   return cv;
 }
@@ -391,7 +434,7 @@ MODULE_FUNC(output) { return ms[0]*(*mod); }
 
 
 MODULE_FUNC(accent) {
-  return accent[v] ? *mod : 0.0;
+  return e->accent[v] ? *mod : 0.0;
 }
 
 
@@ -407,14 +450,14 @@ MODULE_FUNC(vco) // phase-accumulating oscillator w/ suboscillator
   mod_fdata[1]-=floor(mod_fdata[1]);
 
   // hard restart
-  if (restart[v]&SEQ_RESTART_VCO) { mod_fdata[0]=0; mod_fdata[1]=0; }
+  if (e->restart[v]&SEQ_RESTART_VCO) { mod_fdata[0]=0; mod_fdata[1]=0; }
 
   switch((int)(*mod))
   {
     case VCO_PULSE:    out=(mod_fdata[0] < ms[1]) ? -1.0 : 1.0; break;
     case VCO_SAW:      out=(mod_fdata[0] * 2 - 1.0f); break;
     case VCO_TRIANGLE: out=(mod_fdata[0]<0.75) ? 1-fabs(mod_fdata[0]*4-1) : 1-fabs(mod_fdata[0]*4-5); break;
-    case VCO_SINE:     out=sin(2*3.1415926* mod_fdata[0]); break;
+    case VCO_SINE:     out=mod_sin2pi(e, mod_fdata[0]); break;
     break;
   }
 
@@ -422,9 +465,7 @@ MODULE_FUNC(vco) // phase-accumulating oscillator w/ suboscillator
   out+=ms[2]*((ms[1]<mod_fdata[1])?-1.0:1.0);
 
   // noise
-  noise_x1^=noise_x2;
-  out+=ms[3]*(noise_x2*(2.0f/0xffffffff));
-  noise_x2+=noise_x1;
+  if (ms[3]!=0.0f) out+=ms[3]*engine_noise(e, v);
   
   return out;
 }
@@ -434,14 +475,14 @@ MODULE_FUNC(lfo) { // low-frequency oscillator, input is freq in hz, cv output (
   float out=0.0;
 
   // hard restart
-  if (restart[v]&SEQ_RESTART_LFO) { mod_fdata[0]=0; mod_fdata[1]=0; }
+  if (e->restart[v]&SEQ_RESTART_LFO) { mod_fdata[0]=0; mod_fdata[1]=0; }
   
   mod_fdata[0]+=ms[0];
   mod_fdata[0]-=floor(mod_fdata[0]);
 
   switch((int)(*mod)) {
     case LFO_TRIANGLE: out=2*mod_fdata[0]; if (out>1.0) out=2-out; break;
-    case LFO_SINE:     out=-0.5*(cos(2*3.1415926*mod_fdata[0])-1); break;
+    case LFO_SINE:     out=-0.5*(((e->quality>=ENGINE_QUALITY_FASTMATH) ? mod_fastsin(mod_fdata[0]+0.25f) : cos(2*3.1415926*mod_fdata[0]))-1); break;
   }
   out*=ms[1];
   out+=ms[2];
@@ -453,9 +494,9 @@ MODULE_FUNC(lfo) { // low-frequency oscillator, input is freq in hz, cv output (
 MODULE_FUNC(env) // linear adsr envelope generator
 {
   // hard restart
-  if (restart[v]&SEQ_RESTART_ENV) { mod_fdata[0]=0; mod_ldata[1]=0; }
+  if (e->restart[v]&SEQ_RESTART_ENV) { mod_fdata[0]=0; mod_ldata[1]=0; }
   
-  if (gate[v]) {
+  if (e->gate[v]) {
     if (!mod_ldata[1]) mod_ldata[2]=1; // trig if gate went 0->1
   if (mod_ldata[2]) {
       mod_fdata[0]+=ms[0]; if (mod_fdata[0]>=1.0) {
@@ -467,7 +508,7 @@ MODULE_FUNC(env) // linear adsr envelope generator
   } else {
     mod_fdata[0]-=ms[3]; if (mod_fdata[0]<0.0) mod_fdata[0]=0.0; // release
   }
-  mod_ldata[1]=gate[v]; // save current gate
+  mod_ldata[1]=e->gate[v]; // save current gate
   return mod_fdata[0];
 }
 
@@ -484,7 +525,7 @@ MODULE_FUNC(vcf) // 12db/oct resonant state variable low-/high-/bandpass filter
   if (ms[2]<0.0) ms[2]=0.0;
 
   // float *data -> 0=lpf, 1=hpf, 2=bpf
-  f = 2*sin(3.14159 * ms[1]); // cutoff in [0.0, 1.0]
+  f = (e->quality>=ENGINE_QUALITY_FASTMATH) ? 2*mod_fastsin(ms[1]/2) : 2*sin(3.14159 * ms[1]); // cutoff in [0.0, 1.0]
   q=1.0-ms[2];
   r=sqrt(q);
   mod_fdata[0] = mod_fdata[0] + f * mod_fdata[2];
@@ -701,7 +742,7 @@ MODULE_FUNC(supersaw) {
   }
 
   // highpass
-  f = 2*sin(3.14159 * m_pitch); // cutoff in [0.0, 1.0]
+  f = (e->quality>=ENGINE_QUALITY_FASTMATH) ? 2*mod_fastsin(m_pitch/2) : 2*sin(3.14159 * m_pitch); // cutoff in [0.0, 1.0]
   q=1.0 - 0.2; // resonance is 0.2
   r=sqrt(q);
   mod_fdata[8] = mod_fdata[8] + f * mod_fdata[10];
@@ -716,7 +757,7 @@ MODULE_FUNC(supersaw) {
 
 
 // module function call table
-float (*mod_functable[MODTYPES])(unsigned char, float*, void*, float*)={
+float (*mod_functable[MODTYPES])(struct kengine*, unsigned char, float*, void*, float*)={
 		modfunc_kbd,
 		modfunc_env,
 		modfunc_vco,
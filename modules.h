@@ -26,7 +26,7 @@
 #define 	OUTPUT_OFFSET -12.0f
 
 // template macro for module update functions
-#define 	MODULE_FUNC(X)	float modfunc_ ##X (unsigned char v, float *mod, void *data, float *ms)
+#define 	MODULE_FUNC(X)	float modfunc_ ##X (struct kengine *e, unsigned char v, float *mod, void *data, float *ms)
 
 // module types defined
 #define 	MODTYPES		19
@@ -62,6 +62,9 @@
 #define		MOD_SLEW		17
 #define		MOD_MODULATOR		18
 
+// flag in modControlRateInputs
+#define		MOD_CONTROLRATE		0x10
+
 // oscillator waveform type defines
 #define		VCO_PULSE        0
 #define		VCO_SAW          1
@@ -111,6 +114,8 @@ extern const int modInputScale[MODTYPES][4];
 extern const int modOutputScale[MODTYPES];
 extern const char* modModulatorNames[MODTYPES];
 extern const int modModulatorTypes[MODTYPES];
+extern const int modControlRateInputs[MODTYPES];
+extern const int modFoldable[MODTYPES];
 extern const char* modVcoWaveforms[VCO_WAVEFORMS];
 extern const char* modLfoWaveforms[LFO_WAVEFORMS];
 extern const char* modVcfModes[VCF_MODES];
@@ -146,7 +151,8 @@ typedef struct {
 
 
 // module function call table
-extern float (*mod_functable[MODTYPES])(unsigned char, float*, void*, float*);
+struct kengine;
+extern float (*mod_functable[MODTYPES])(struct kengine*, unsigned char, float*, void*, float*);
 
 // supersaw init function - called from main
 void calc_supersaw_tables();
@@ -47,10 +47,8 @@ extern char synthname[MAX_SYNTH][128]; // from synthesizer.c
 extern synthmodule mod[MAX_SYNTH][MAX_MODULES]; // ditto
 extern int signalfifo[MAX_SYNTH][MAX_MODULES]; // module execution stack
 
-// from modules.c
-extern float pitch[MAX_SYNTH];
-extern int accent[MAX_SYNTH];
-extern int gate[MAX_SYNTH];
+// from audio.c
+extern kengine audition_engine;
 
 // from pattern.c
 extern int coct;
@@ -221,20 +219,14 @@ void patch_mouse_click(int button, int state, int x, int y)
         audio_loadpatch(0, csynth, cpatch[csynth]);       
         return; }
       if (patch_ui[B_PREVSYN]) { if (csynth>0) { 
-          synth_lockaudio();
           csynth--; 
           synth_stackify(csynth);
-          kmm_gcollect();
-          synth_releaseaudio();
           }
           audio_loadpatch(0, csynth, cpatch[csynth]);      
         return; }
       if (patch_ui[B_NEXTSYN]) { if (csynth<(MAX_SYNTH-1)) { 
-          synth_lockaudio();
           csynth++; 
           synth_stackify(csynth); 
-          kmm_gcollect();
-          synth_releaseaudio();
         }
         audio_loadpatch(0, csynth, cpatch[csynth]);      
         return;
@@ -270,6 +262,7 @@ void patch_mouse_click(int button, int state, int x, int y)
             modquantifier[csynth][cpatch[csynth]][mi]=patch_clipboard_quantifier[m];
             m++;
           }
+          audio_patchchanged(0);
           console_post("Patch pasted from clipboard");
         }
       }
@@ -346,6 +339,7 @@ void patch_mouse_click(int button, int state, int x, int y)
               dialog_bindspecial(&patch_modulator_special);
               break;
           }
+          audio_patchchanged(0);
           return;
         } else {
           console_post("No settings for this module!");
@@ -355,7 +349,7 @@ void patch_mouse_click(int button, int state, int x, int y)
     }
     if (state==GLUT_UP) {
       if (cpkeydown>=0) // && kpkeydown<0)
-        { cpkeydown=-1; gate[0]=0; }
+        { cpkeydown=-1; audio_noteoff(0); }
 
       patch_mouse_hover(x, y);
     } 
@@ -406,7 +400,7 @@ void patch_keyboardup(unsigned char key, int x, int y)
     if (pianokeys[i]==key) {
       // if this key is still down, drop gate and trig
       if (kpkeydown==(i+coct*12)) {
-        gate[0]=0;
+        audio_noteoff(0);
         kpkeydown=-1;
       }
     }
@@ -492,7 +486,7 @@ void patch_draw(void)
       case 7: sprintf(tmps, "%s", modSlewModes[(int)(modvalue[csynth][cpatch[csynth]][mi])]);break; // slew mode
       case 8: sprintf(tmps, "ch %02d", 1+(int)(modvalue[csynth][cpatch[csynth]][mi]));break; // modulation source channel
     }
-    if (mt==MOD_CV) sprintf(tmps, "%f hz", pitch[0]);
+    if (mt==MOD_CV) sprintf(tmps, "%f hz", audition_engine.pitch[0]*OUTPUTFREQ);
     render_text(tmps, x+250, 20+mm*16-yd, 2, 0xffc0c0c0, 0);
     m++; mm++;
   }
@@ -625,6 +619,7 @@ void patch_modulator_click(int button, int state, int x, int y)
           while(j>modquantifier[csynth][cpatch[csynth]][mi]) { fmask<<=1; j--; }
           *fptr&=fmask;
           modvalue[csynth][cpatch[csynth]][mi]=f;
+          audio_paramchanged(csynth, cpatch[csynth], mi);
         }
         break;
       case 2: // integer
@@ -711,6 +706,7 @@ void patch_modulator_special(int key, int x, int y)
     
     // apply value to module
     modvalue[ csynth ][cpatch[csynth]][ mi ]=knob_scale2float(mod[csynth][mi].scale, f);
+    audio_paramchanged(csynth, cpatch[csynth], mi);
     sprintf(modeditbox, "%g", f);
   }
 }
@@ -742,6 +738,7 @@ void patch_modulator_keyboard(unsigned char key, int x, int y)
           while(j>modquantifier[csynth][cpatch[csynth]][mi]) { fmask<<=1; j--; }
           *fptr&=fmask;
           modvalue[csynth][cpatch[csynth]][mi]=f;
+          audio_paramchanged(csynth, cpatch[csynth], mi);
         }
         break;
       case 2: // integer
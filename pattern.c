@@ -46,11 +46,6 @@
 #define PIANOROLL_OCTAVES 6
 
 
-// from modules.c
-extern float pitch[MAX_SYNTH];
-extern int accent[MAX_SYNTH];
-extern int gate[MAX_SYNTH];
-
 extern int audiomode; // from audio.c
 extern unsigned long playpos;
 extern unsigned int audiomode_flags;
@@ -124,7 +119,7 @@ void pattern_toggleplayback()
   patt_ui[B_PATTPLAY]&=1;
   patt_ui[B_PATTPLAY]|=(patt_playing<<1);
   playpos=0;
-  gate[0]=0;
+  audio_noteoff(0);
   if (patt_playing) { 
     audiomode=AUDIOMODE_PATTERNPLAY; audiomode_flags|=1;
   } else {
@@ -234,6 +229,7 @@ void pattern_mouse_drag(int x, int y)
         pattdata[cpatt][piano_start+piano_porta_drag+i]|=note&0xff;
       }
       piano_note=note&0xff;
+      audio_songchanged();
       //audio_trignote(0, piano_note); // audio feedback      
     }
   }
@@ -257,6 +253,7 @@ void pattern_mouse_click(int button, int state, int x, int y)
           while(pattdata[cpatt][i]&NOTE_LEGATO) i--;
           do { pattdata[cpatt][i++]=0;
           } while(pattdata[cpatt][i]&NOTE_LEGATO);
+          audio_songchanged();
           return;
         }
       }
@@ -265,6 +262,7 @@ void pattern_mouse_click(int button, int state, int x, int y)
       if (patt_ui[B_PATTCLEAR]&1) {
         if (patt_ui[B_PATTCLEAR]&8) {
           for(i=0;i<MAX_PATTLENGTH;i++) pattdata[cpatt][i]=0;
+          audio_songchanged();
           sprintf(tmps, "Pattern %02d cleared", cpatt);
           console_post(tmps);
           patt_ui[B_PATTCLEAR]&=0xff-8;
@@ -290,6 +288,7 @@ void pattern_mouse_click(int button, int state, int x, int y)
           }
           
           pattlen[cpatt]/=2;
+          audio_songchanged();
           
           while (piano_start > 
             ( 1+pattlen[cpatt]*(beats_per_measure*beatdiv) - ( (DS_WIDTH-(PIANOROLL_X))/PIANOROLL_CELLWIDTH ) ) ) piano_start--;
@@ -307,6 +306,7 @@ void pattern_mouse_click(int button, int state, int x, int y)
           if (m==GLUT_ACTIVE_SHIFT) {
             for(i=0; i<((pattlen[cpatt]*(beats_per_measure*beatdiv))/2); i++) pattdata[cpatt][i+((pattlen[cpatt]*(beats_per_measure*beatdiv))/2)]=pattdata[cpatt][i];
           }
+          audio_songchanged();
         }
         return;
       }
@@ -332,6 +332,7 @@ void pattern_mouse_click(int button, int state, int x, int y)
       
       if (patt_ui[B_PASTE] && patt_clipboard_len>0) {
         for(i=0; i<patt_clipboard_len; i++) pattdata[cpatt][i]=patt_clipboard[i];
+        audio_songchanged();
       }
       
       // click on the piano roll?
@@ -350,6 +351,7 @@ void pattern_mouse_click(int button, int state, int x, int y)
         } else {
           // create a new note - set the 1/16th note on the pattern
           pattdata[cpatt][piano_start+piano_hover]=piano_note;
+          audio_songchanged();
           piano_drag=piano_hover; //drag note stating from this cell
           piano_dragto=piano_hover;
         
@@ -372,16 +374,17 @@ void pattern_mouse_click(int button, int state, int x, int y)
         for(m=piano_drag;m<=piano_dragto;m++) pattdata[cpatt][piano_start+m]=pattdata[cpatt][piano_start+piano_drag]|NOTE_LEGATO;
         pattdata[cpatt][piano_start+piano_drag]&=0xff; // legato off from the first note
         pattdata[cpatt][piano_start+piano_dragto+1]&=0xff; // legato off from the note which follows
+        audio_songchanged();
         piano_drag=-1;
         piano_dragto=-1;
 
-        gate[0]=0; // note off
+        audio_noteoff(0); // note off
       }
       if (piano_porta_drag>=0) {
         piano_porta_drag=-1;
         piano_porta_drag_len=0;
 
-        gate[0]=0; // note off        
+        audio_noteoff(0); // note off        
       }
     } 
   }            
@@ -398,6 +401,7 @@ void pattern_mouse_click(int button, int state, int x, int y)
           } else {
             // first note, so mark it with an accent
             pattdata[cpatt][piano_start+piano_hover]^=NOTE_ACCENT;
+            audio_songchanged();
           }
         }
       }
@@ -490,7 +494,7 @@ void pattern_keyboardup(unsigned char key, int x, int y)
     if (pianokeys[i]==key) {
       // if this key is still down, drop gate and trig
       if (kpkeydown==(i+coct*12)) {
-        gate[0]=0;
+        audio_noteoff(0);
         kpkeydown=-1;
       }
     }
@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+# Renders each example song with the 32-bit player, the x86-64 player,
+# the x86-64 player built with PACKED_VOICES, the C player and the C
+# player with the synths compiled from "converter -g", and prints
+# the render times and the largest difference from the 32-bit output in
+# 16-bit sample steps. Needs the converter built in
+# ../converter and a multilib gcc for the 32-bit player.
+#
+
+SONGS=${*:-../examples/songs/*.ksong}
+
+cp song.inc song.inc.bench
+for song in $SONGS; do
+  ../converter/converter "$song" > song.inc 2>/dev/null || continue
+  ../converter/converter -c "$song" > song.h 2>/dev/null || continue
+  ../converter/converter -g "$song" > synths.h 2>/dev/null || continue
+  rm -f player.o player64.o player64x4.o renderc renderg
+  make -s render32 render64 render64x4 renderc renderg >/dev/null || continue
+  t32=`./render32 bench32.raw`
+  t64=`./render64 bench64.raw`
+  t64x4=`./render64x4 bench64x4.raw`
+  tc=`./renderc benchc.raw`
+  tg=`./renderg benchg.raw`
+  od -An -v -td2 -w2 bench32.raw > bench32.txt
+  diff=`od -An -v -td2 -w2 bench64.raw | paste bench32.txt - | awk '
+    { d = $1-$2; if (d<0) d=-d; if (d>m) m=d } END { print m+0 }'`
+  diffx4=`od -An -v -td2 -w2 bench64x4.raw | paste bench32.txt - | awk '
+    { d = $1-$2; if (d<0) d=-d; if (d>m) m=d } END { print m+0 }'`
+  diffc=`od -An -v -td2 -w2 benchc.raw | paste bench32.txt - | awk '
+    { d = $1-$2; if (d<0) d=-d; if (d>m) m=d } END { print m+0 }'`
+  diffg=`od -An -v -td2 -w2 benchg.raw | paste bench32.txt - | awk '
+    { d = $1-$2; if (d<0) d=-d; if (d>m) m=d } END { print m+0 }'`
+  printf "%-20s 32-bit %7ss  64-bit %7ss (diff %d)  packed %7ss (diff %d)  C %7ss (diff %d)  gen %7ss (diff %d)\n" \
+    `basename $song .ksong` $t32 $t64 $diff $t64x4 $diffx4 $tc $diffc $tg $diffg
+done
+mv song.inc.bench song.inc
+rm -f player.o player64.o player64x4.o renderc renderg song.h synths.h bench32.raw bench64.raw bench64x4.raw benchc.raw benchg.raw bench32.txt
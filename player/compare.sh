@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# Converts each example song and renders it with the 32-bit player and
+# with the editor's engine. Prints the render times, the engine's time
+# relative to the player's, and how far the player is from the engine:
+# the signal to error ratio, the rms and largest difference in 16-bit
+# sample steps and the length in frames of both renders. Songs using
+# modules the player doesn't have are marked. Needs the converter built
+# in ../converter and a multilib gcc for the 32-bit player.
+#
+
+SONGS=${*:-../examples/songs/*.ksong}
+
+cp song.inc song.inc.compare
+for song in $SONGS; do
+  name=`basename $song .ksong`
+  ../converter/converter "$song" > song.inc 2>compare.log || { echo "$name: conversion failed"; continue; }
+  rm -f player.o render32
+  make -s render32 renderk >/dev/null || continue
+  t32=`./render32 compare32.raw`
+  tk=`./renderk "$song" comparek.raw`
+  od -An -v -td2 -w2 comparek.raw > comparek.txt
+  od -An -v -td2 -w2 compare32.raw | paste comparek.txt - | awk -F'\t' -v name=$name -v t32=$t32 -v tk=$tk '
+    $1!="" && $2!="" { d=$2-$1; s+=$1*$1; e+=d*d; if (d<0) d=-d; if (d>m) m=d; n++; next }
+    $1!="" { nk++ }
+    $2!="" { np++ }
+    END {
+      snr="   exact"; if (e>0) snr=sprintf("%6.1f db", 10*log(s/e)/log(10));
+      ratio=0; if (t32>0) ratio=tk/t32;
+      rms=0; if (n) rms=sqrt(e/n);
+      printf "%-20s player %7ss  engine %7ss (%5.2fx)  snr %s  rms %8.1f  peak %5d  frames %d/%d\n",
+        name, t32, tk, ratio, snr, rms, m, n+np, n+nk
+    }'
+  grep "not supported" compare.log | sed "s/^warning: /  /"
+done
+mv song.inc.compare song.inc
+rm -f player.o render32 renderk compare.log compare32.raw comparek.raw comparek.txt
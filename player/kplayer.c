@@ -0,0 +1,582 @@
+/*
+ * Komposter player (c) 2010 Noora Halme et al. (see AUTHORS)
+ *
+ * This code is licensed under the MIT license:
+ * http://www.opensource.org/licenses/mit-license.php
+ *
+ * Portable C version of the playroutine. It plays the tables in song.h,
+ * written with "converter -c", and streams the song out in blocks of any
+ * size through kplayer_render(). There are no dependencies beyond libm.
+ *
+ * With SYNTH_CODE defined, the synths run as straight-line code for each
+ * synth and patch from synths.h, written with "converter -g", instead of
+ * going through the signal stack module by module.
+ *
+ * The modules do their math in the same order as in modules64.asm, so
+ * the output matches the x86-64 player sample for sample when compiled
+ * for SSE math without contracting multiply-adds (-ffp-contract=off).
+ *
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "kplayer.h"
+#include "song.h"
+
+// same as in player.asm
+#define OUTPUTFREQ		44100
+#define SONG_BUFFERLEN		(SONG_LEN*64*TICKDIVIDER)
+#define MAX_MODULES		64
+#define DELAYBUFFERSIZE		262144
+
+// flags in voice data byte
+#define FLAG_GATE		1
+#define FLAG_TRIG		2
+#define FLAG_ACCENT		4
+#define FLAG_NOTEOFF		8
+#define FLAG_RESTART_ENV	16
+#define FLAG_RESTART_VCO	32
+#define FLAG_RESTART_LFO	64
+#define FLAG_LOAD_PATCH		128
+
+// module types in modtypes, in the order of the player's jump table
+enum { KBD, ENV, VCO, LFO, CV, AMP, MIXER, VCF, LPF24, DELAY, ATT,
+       RESAMPLE, SUPERSAW, DIST, ACCENT, OUTPUT };
+
+#define VCO_PULSE	0
+#define VCO_SAW		1
+#define VCO_TRIANGLE	2
+
+// modulators are either floats or integers
+typedef union {
+  float f;
+  int i;
+} kword;
+
+// output, modulator and state of one module on a channel
+typedef struct {
+  float out;
+  kword mod;
+  union {
+    struct { float acc; unsigned char old; } env; // old flags w/ trig
+    struct { float acc, sub; } vco; // also the lfo accumulator
+    struct { float lp, hp, bp; } vcf;
+    struct { double in, out[4], state[4]; } lpf; // in double like on the x87
+    struct { float *buffer; int pos; } delay;
+    struct { float acc, held; } snh;
+  } d;
+} kmodule;
+
+static kmodule moddata[NUM_CHANNELS][MAX_MODULES];
+static float pitch[NUM_CHANNELS];
+static unsigned char flags[NUM_CHANNELS];
+static const unsigned int *patchptr[NUM_CHANNELS];
+static unsigned char patchnum[NUM_CHANNELS]; // patch loaded, zero for none
+
+#ifdef SONG_EVENTS
+// sequencer state for each channel
+static const unsigned char *orderpos[NUM_CHANNELS]; // next order list entry, zero before the first
+static const unsigned char *eventptr[NUM_CHANNELS]; // next note event in the pattern
+static short rowsleft[NUM_CHANNELS]; // rows left in the pattern pass
+static signed char repeatsleft[NUM_CHANNELS]; // passes left of the pattern
+static signed char eventwait[NUM_CHANNELS]; // rows to skip before the next event
+static unsigned char chpattern[NUM_CHANNELS]; // pattern playing on the channel
+static signed char transpose[NUM_CHANNELS];
+#endif
+
+#ifdef USE_MODULE_delay
+static int delaycount;
+static float delaybuffer[NUM_DELAYS][DELAYBUFFERSIZE];
+#endif
+
+static unsigned int noise_x1=0x67452301, noise_x2=0xefcdab89;
+static int samplepos;
+
+
+
+// add a float to an oscillator accumulator and drop the integer part.
+// the sum is rounded to single precision only once as on the x87
+static inline float accumulate(float a, float acc)
+{
+  double d=(double)a+(double)acc;
+
+  return (float)(d-(double)(int)d);
+}
+
+
+// sin(2*pi*x) from the taylor series to the 11th power on [-pi/2, pi/2]
+static inline float sin2pi(float x)
+{
+  float x2, p;
+
+  x-=(float)lrintf(x);
+  if (x>0.25f) x=0.5f-x; else if (x<-0.25f) x=-0.5f-x;
+  x*=6.2831853f;
+  x2=x*x;
+  p=-2.5052108e-8f*x2;
+  p=(p+2.7557319e-6f)*x2;
+  p=(p-1.9841270e-4f)*x2;
+  p=(p+8.3333333e-3f)*x2;
+  p=(p-1.6666667e-1f)*x2;
+  p=p+1.0f;
+  return x*p;
+}
+
+
+// the modules, split so that the code written with "converter -g" can
+// call the parts for a waveform or a filter mode directly. the player
+// below picks them from the modulators at run time instead
+
+static inline void next_noise(void)
+{
+  noise_x1^=noise_x2;
+  noise_x2+=noise_x1;
+}
+
+
+#ifdef USE_MODULE_env
+static inline float env(kmodule *m, float a, float d, float s, float r, unsigned char fl)
+{
+  unsigned char al=fl, cl;
+  float acc;
+
+  if (fl & FLAG_RESTART_ENV) { m->d.env.acc=0.0f; m->d.env.old=0; }
+  acc=m->d.env.acc;
+  if (fl & FLAG_GATE) {
+    // gate is up, was it down previously?
+    cl=m->d.env.old;
+    if (!(cl & FLAG_GATE)) al|=FLAG_TRIG;
+    al|=cl & FLAG_TRIG;
+    if (al & FLAG_TRIG) {
+      acc+=a;
+      if (acc>1.0f) { acc=1.0f; al&=~FLAG_TRIG; }
+    } else {
+      acc-=d;
+      if (!(acc>=s)) acc=s;
+    }
+  } else {
+    acc-=r;
+    acc=(acc>0.0f) ? acc : 0.0f;
+  }
+  m->d.env.acc=acc;
+  m->d.env.old=al;
+  return acc;
+}
+#endif
+
+
+#ifdef USE_MODULE_vco
+// advance the phase of the oscillator and its suboscillator, a square at
+// half the frequency. returns the phase and flips the sign of sub
+static inline float vco_phase(kmodule *m, float cv, float pw, float *sub, unsigned char fl)
+{
+  float acc, f;
+
+  if (fl & FLAG_RESTART_VCO) { m->d.vco.acc=0.0f; m->d.vco.sub=0.0f; }
+  acc=accumulate(cv, m->d.vco.acc);
+  m->d.vco.acc=acc;
+  f=accumulate(cv*0.5f, m->d.vco.sub);
+  m->d.vco.sub=f;
+  if (f>=pw) *sub*=-1.0f;
+  return acc;
+}
+
+static inline float vco_pulse(float acc, float pw)
+{
+  return (pw>=acc) ? -1.0f : 1.0f;
+}
+
+static inline float vco_saw(float acc)
+{
+  return (acc+acc)-1.0f;
+}
+
+static inline float vco_triangle(float acc)
+{
+  float out, f;
+
+  out=acc*4.0f;
+  if (acc>0.75f) out-=4.0f;
+  out-=1.0f;
+  f=out*-1.0f;
+  out=(out>f) ? out : f;
+  return 1.0f-out;
+}
+
+static inline float vco_noise(float amount)
+{
+  return (amount+amount)*(float)(int)noise_x2/4294967296.0f;
+}
+#endif
+
+
+#ifdef USE_MODULE_lfo
+static inline float lfo_phase(kmodule *m, float cv, unsigned char fl)
+{
+  if (fl & FLAG_RESTART_LFO) m->d.vco.acc=0.0f;
+  m->d.vco.acc=accumulate(cv, m->d.vco.acc);
+  return m->d.vco.acc;
+}
+
+static inline float lfo_sine(float acc)
+{
+  return (1.0f-sin2pi(acc+0.25f))*0.5f;
+}
+
+static inline float lfo_triangle(float acc)
+{
+  float out=acc+acc;
+
+  if (!(out<1.0f)) out=((out*-1.0f)+1.0f)+1.0f;
+  return out;
+}
+#endif
+
+
+#ifdef USE_MODULE_vcf
+// state variable filter. the outputs are left in the module data
+static inline void vcf(kmodule *m, float s, float fc, float q)
+{
+  float f;
+
+  f=sin2pi(fc*0.5f);
+  f=f+f;
+  q=1.0f-q;
+  m->d.vcf.lp=f*m->d.vcf.bp+m->d.vcf.lp;
+  m->d.vcf.hp=sqrtf(q)*s-m->d.vcf.lp-q*m->d.vcf.bp;
+  m->d.vcf.bp=m->d.vcf.hp*f+m->d.vcf.bp;
+}
+#endif
+
+
+#ifdef USE_MODULE_lpf24
+// 24db/oct four-pole low pass
+static inline float lpf24(kmodule *m, float input, float cutoff, float res)
+{
+  double in, fc, rq, f2, f4, fb, g, o;
+  int i;
+
+  in=input; fc=cutoff; rq=res;
+  fc=fc*(double)3.48f;
+  f2=fc*fc;
+  g=1.0-fc;
+  f4=f2*f2*(double)0.35013f;
+  fb=f2*(double)-0.15f+1.0;
+  rq=rq+rq;
+  rq=rq+rq;
+  fb=fb*rq*m->d.lpf.out[3];
+  m->d.lpf.in=(in-fb)*f4;
+  for(i=0;i<4;i++) {
+    o=m->d.lpf.out[i]*g+m->d.lpf.state[i]*(double)0.3f;
+    in=i ? m->d.lpf.out[i-1] : m->d.lpf.in;
+    m->d.lpf.state[i]=in;
+    m->d.lpf.out[i]=o+in;
+  }
+  return (float)m->d.lpf.out[3];
+}
+#endif
+
+
+#ifdef USE_MODULE_delay
+// interpolated comb/allpass filter delay
+static inline float delay(kmodule *m, float in, float time, float fb, int allpass)
+{
+  float out, f;
+  int dt, rp;
+
+  if (!m->d.delay.buffer) m->d.delay.buffer=delaybuffer[delaycount++];
+  dt=(int)lrintf(time);
+  f=time-(float)dt;
+  rp=(m->d.delay.pos-dt) & (DELAYBUFFERSIZE-1);
+  out=m->d.delay.buffer[rp]*f;
+  rp=(rp+1) & (DELAYBUFFERSIZE-1);
+  out+=(1.0f-f)*m->d.delay.buffer[rp];
+  if (allpass) out-=in*fb; // do a feedforward
+  m->d.delay.buffer[m->d.delay.pos]=out*fb+in;
+  m->d.delay.pos=(m->d.delay.pos+1) & (DELAYBUFFERSIZE-1);
+  return out;
+}
+#endif
+
+
+#ifdef USE_MODULE_resample
+static inline float resample(kmodule *m, float in, float rate)
+{
+  m->d.snh.acc-=rate;
+  if (!(m->d.snh.acc>0.0f)) {
+    m->d.snh.held=in; // sample the input
+    m->d.snh.acc=1.0f;
+  }
+  return m->d.snh.held;
+}
+#endif
+
+
+#ifdef USE_MODULE_dist
+// simple clipping distort
+static inline float dist(float in, float gain)
+{
+  float out, f;
+
+  out=in*gain;
+  f=out*-1.0f;
+  f=(f>out) ? f : out;
+  if (f>1.0f) out=out/f;
+  return out;
+}
+#endif
+
+
+#ifdef SYNTH_CODE
+#include "synths.h"
+#else
+// run one module of voice v. ms are the inputs and fl the channel flags
+static float module(int type, kmodule *m, float *ms, int v, unsigned char fl)
+{
+  float acc;
+  unsigned char wave;
+
+  wave=(unsigned char)m->mod.i;
+  switch (type) {
+#ifdef USE_MODULE_kbd
+    case KBD:
+      return pitch[v];
+#endif
+#ifdef USE_MODULE_env
+    case ENV:
+      return env(m, ms[0], ms[1], ms[2], ms[3], fl);
+#endif
+#ifdef USE_MODULE_vco
+    case VCO:
+      acc=vco_phase(m, ms[0], ms[1], &ms[2], fl);
+      switch (wave) {
+        case VCO_PULSE: return vco_pulse(acc, ms[1])+ms[2]+vco_noise(ms[3]);
+        case VCO_SAW: return vco_saw(acc)+ms[2]+vco_noise(ms[3]);
+        case VCO_TRIANGLE: return vco_triangle(acc)+ms[2]+vco_noise(ms[3]);
+        default: return sin2pi(acc)+ms[2]+vco_noise(ms[3]);
+      }
+#endif
+#ifdef USE_MODULE_lfo
+    case LFO:
+      acc=lfo_phase(m, ms[0], fl);
+      if (wave) return lfo_triangle(acc)*ms[1]+ms[2];
+      return lfo_sine(acc)*ms[1]+ms[2];
+#endif
+#ifdef USE_MODULE_accent
+    case ACCENT:
+      return (fl & FLAG_ACCENT) ? m->mod.f : ms[0]*ms[1];
+#endif
+#ifdef USE_MODULE_amp
+    case AMP:
+      return ms[0]*ms[1];
+#endif
+    case CV:
+      return m->mod.f;
+#ifdef USE_MODULE_att
+    case ATT:
+#endif
+    case OUTPUT:
+      return ms[0]*m->mod.f;
+#ifdef USE_MODULE_mixer
+    case MIXER:
+      return ms[0]+ms[1]+ms[2]+ms[3];
+#endif
+#ifdef USE_MODULE_vcf
+    case VCF:
+      switch (m->mod.i & 3) {
+        case 0: return ms[0]; // filter is off
+        case 1: vcf(m, ms[0], ms[1], ms[2]); return m->d.vcf.lp;
+        case 2: vcf(m, ms[0], ms[1], ms[2]); return m->d.vcf.hp;
+        default: vcf(m, ms[0], ms[1], ms[2]); return m->d.vcf.bp;
+      }
+#endif
+#ifdef USE_MODULE_lpf24
+    case LPF24:
+      return lpf24(m, ms[0], ms[1], ms[2]);
+#endif
+#ifdef USE_MODULE_delay
+    case DELAY:
+      return delay(m, ms[0], ms[1], ms[3], wave);
+#endif
+#ifdef USE_MODULE_resample
+    case RESAMPLE:
+      return resample(m, ms[0], ms[1]);
+#endif
+#ifdef USE_MODULE_dist
+    case DIST:
+      return dist(ms[0], ms[1]);
+#endif
+    case SUPERSAW: // not yet implemented in the players
+    default:
+      return ms[0];
+  }
+}
+#endif
+
+
+// play the notes on a tick
+static void play_tick(int tick)
+{
+  int v, note;
+  unsigned char fl, patch;
+#ifdef SONG_EVENTS
+  const unsigned char *p;
+#else
+  unsigned short w;
+#endif
+
+  for(v=0;v<NUM_CHANNELS;v++) {
+    fl=flags[v];
+    if (!(tick & 63)) {
+      patch=0;
+#ifdef SONG_EVENTS
+      // a new row. start the next pass of the pattern or the next entry
+      // on the order list if this one is over
+      if (--rowsleft[v]<0) {
+        if (--repeatsleft[v]<0) {
+          p=orderpos[v] ? orderpos[v] : &songorder[orderlist[v]];
+          chpattern[v]=p[0];
+          repeatsleft[v]=(signed char)p[1];
+          transpose[v]=(signed char)p[2];
+          if (p[3]) {
+            patchnum[v]=p[3];
+            patchptr[v]=&patchdata[patchstart[p[3]-1]];
+            patch=FLAG_LOAD_PATCH;
+          }
+          orderpos[v]=p+4;
+        }
+        p=&patterns[patternstart[chpattern[v]]];
+        rowsleft[v]=patternlen[chpattern[v]]*16-1;
+        eventwait[v]=*p++; // rows to skip before the first event
+        eventptr[v]=p;
+      }
+
+      // play the next event once its row comes up
+      if (--eventwait[v]<0) {
+        p=eventptr[v];
+        eventptr[v]=p+2;
+        eventwait[v]=p[1] & 0x7f;
+        note=p[0] & 0x7f;
+        if (note) {
+          pitch[v]=notetable[note+transpose[v]-NOTE_FIRST];
+          fl=seqmask[v];
+        }
+        if (p[1] & 0x80) fl|=FLAG_ACCENT;
+        if (p[0] & 0x80) fl|=FLAG_NOTEOFF;
+      }
+#else
+      w=songdata[v][tick>>6];
+      if (w & 0xff) {
+        pitch[v]=notetable[(w & 0xff)-NOTE_FIRST];
+        fl=seqmask[v];
+      }
+      if (w & 0x4000) fl|=FLAG_ACCENT;
+      if (w & 0x8000) fl|=FLAG_NOTEOFF;
+      if ((w>>8) & 0x3f) {
+        patchnum[v]=(w>>8) & 0x3f;
+        patchptr[v]=&patchdata[patchstart[((w>>8) & 0x3f)-1]];
+        patch=FLAG_LOAD_PATCH;
+      }
+#endif
+      fl|=patch;
+    }
+    if ((tick & 63)==60 && (fl & FLAG_NOTEOFF)) fl&=FLAG_TRIG|FLAG_ACCENT;
+    flags[v]=fl;
+  }
+}
+
+
+// run the synths on all channels for one sample and mix them
+static float render_sample(void)
+{
+  int v;
+  float out, sample;
+#ifndef SYNTH_CODE
+  int m, s, type;
+  float ms[4];
+  const unsigned char *in;
+  kmodule *md;
+#endif
+
+  sample=0.0f;
+  for(v=0;v<NUM_CHANNELS;v++) {
+#ifdef SYNTH_CODE
+    // straight to the code for the synth and patch
+    if (patchnum[v])
+      out=patchcode[patchnum[v]-1](moddata[v], v, flags[v]);
+    else
+      out=synthcode[seqvoice[v]](moddata[v], v, flags[v]);
+#else
+    s=synthstart[seqvoice[v]];
+    md=moddata[v];
+    m=0;
+    do {
+      // load a new patch?
+      if (flags[v] & FLAG_LOAD_PATCH) md[m].mod.i=patchptr[v][m];
+
+      in=modinputs[s+m];
+      ms[0]=md[in[0]].out;
+      ms[1]=md[in[1]].out;
+      ms[2]=md[in[2]].out;
+      ms[3]=md[in[3]].out;
+      type=modtypes[s+m];
+      out=module(type, &md[m], ms, v, flags[v]);
+      md[m].out=out;
+
+      // update noise generator on each module loop
+      next_noise();
+      m++;
+    } while (type!=OUTPUT);
+#endif
+    flags[v]&=0x0f; // clear hard restart flags
+    sample=out+sample;
+  }
+  return sample;
+}
+
+
+
+void kplayer_init(void)
+{
+  memset(moddata, 0, sizeof(moddata));
+  memset(pitch, 0, sizeof(pitch));
+  memset(flags, 0, sizeof(flags));
+  memset(patchptr, 0, sizeof(patchptr));
+  memset(patchnum, 0, sizeof(patchnum));
+#ifdef SONG_EVENTS
+  memset(orderpos, 0, sizeof(orderpos));
+  memset(eventptr, 0, sizeof(eventptr));
+  memset(rowsleft, 0, sizeof(rowsleft));
+  memset(repeatsleft, 0, sizeof(repeatsleft));
+  memset(eventwait, 0, sizeof(eventwait));
+  memset(chpattern, 0, sizeof(chpattern));
+  memset(transpose, 0, sizeof(transpose));
+#endif
+#ifdef USE_MODULE_delay
+  delaycount=0;
+  memset(delaybuffer, 0, sizeof(delaybuffer));
+#endif
+  noise_x1=0x67452301;
+  noise_x2=0xefcdab89;
+  samplepos=0;
+}
+
+
+int kplayer_render(float *out, int frames)
+{
+  int n;
+
+  for(n=0; n<frames && samplepos<SONG_BUFFERLEN; n++, samplepos++) {
+    if (!(samplepos%TICKDIVIDER)) play_tick(samplepos/TICKDIVIDER);
+    // scale to full 16 bits at 1.0, exactly as the players do
+    out[n]=render_sample()*samplemul*(1.0f/32768.0f);
+  }
+  return n;
+}
+
+
+int kplayer_length(void)
+{
+  return SONG_BUFFERLEN;
+}
@@ -0,0 +1,23 @@
+/*
+ * Komposter player (c) 2010 Noora Halme et al. (see AUTHORS)
+ *
+ * This code is licensed under the MIT license:
+ * http://www.opensource.org/licenses/mit-license.php
+ *
+ */
+
+#ifndef __KPLAYER_H__
+#define __KPLAYER_H__
+
+// restart the song from the beginning
+void kplayer_init(void);
+
+// render the next frames of the song to out as mono floats at 44100hz,
+// where 1.0 is full scale. returns the number of frames rendered, which
+// is less than asked for at the end of the song
+int kplayer_render(float *out, int frames);
+
+// length of the song in frames
+int kplayer_length(void);
+
+#endif
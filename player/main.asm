@@ -7,6 +7,11 @@
 ;; Here is the actual main program which renders the song, creates a
 ;; playback device and starts audio playback.
 ;;
+;; The song is rendered on a second thread. The main thread queues the
+;; rendered parts of the songbuffer to OpenAL as they're finished, and
+;; starts playback as soon as the renderer is far enough ahead to stay
+;; in front of it. Intro code can poll renderpos in the meantime.
+;;
 ;; This example code uses MacOS X ABI and OpenAL but adapting to other x86
 ;; systems should be trivial.
 ;;
@@ -18,8 +23,14 @@
 ; the frequency used to play the sample data 
 %define OUTPUTFREQ 44100
 
-; length of the data buffer - must be the same as in in player.asm
-%define SONG_BUFFERLEN 15*OUTPUTFREQ
+; the songbuffer is queued for playback in this many parts
+%define NUM_CHUNKS 64
+
+; how often to check on the renderer, in microseconds
+%define POLL_USEC 10000
+
+; samples to have rendered at least before playback starts
+%define MIN_LEAD OUTPUTFREQ
 
 ; openal constants
 %define AL_FORMAT_MONO16 0x1101
@@ -28,6 +39,9 @@
 
 
 extern _printf
+extern _pthread_create
+extern _usleep
+extern _gettimeofday
 
 extern _alutInit
 extern _alGenSources
@@ -36,6 +50,7 @@ extern _alBufferData
 extern _alSourcei
 extern _alSourcef
 extern _alSourcePlay
+extern _alSourceQueueBuffers
 
 extern _alcASASetListener
 extern _alcASASetSource
@@ -43,6 +58,8 @@ extern _alcASASetSource
 ; these are from player.asm
 extern render_song
 extern songbuffer
+extern songlength
+extern renderpos
 
 
 ;
@@ -56,6 +73,9 @@ reverb	dd	1
 reverbsend dd __float32__(0.1)
 reverbtype dd 12
 
+outputfreq dd OUTPUTFREQ
+usec	dd	0.000001
+
 
 %ifdef WRITE_TO_FILE
 extern _fopen
@@ -73,9 +93,15 @@ fmode db "w",0
 section .bss
 dev     resd    1 ;*ALCdevice
 con     resd    1 ;*ALCcontext
-buffer  resd    1
+buffers resd    NUM_CHUNKS
 source  resd    1
 
+thread	resd	1
+queued	resd	1 ; chunks queued for playback
+started	resd	1 ; nonzero once playback is on
+tvstart	resd	2 ; struct timeval when the render started
+tvnow	resd	2
+
 ppos	resd	1
 fpos	resd	1
 
@@ -107,11 +133,11 @@ _start:
         call    _printf
         add     esp, 16 
 
+%ifdef WRITE_TO_FILE
         ; fill buffer
 	call	render_song
 
 	; write message
-%ifdef WRITE_TO_FILE
 	sub	esp, 12
 	push 	writing
 	call	_printf
@@ -125,7 +151,7 @@ _start:
 	add	esp, 16
 	mov	[fhandle], eax
 	push	eax
-	push	dword SONG_BUFFERLEN
+	push	dword [songlength]
 	push	dword 2
 	push	songbuffer
 	call	_fwrite
@@ -147,31 +173,13 @@ _start:
         call    _alGenSources
         add     esp, 16
 
-        ; alGenBuffers(1, &buffer);
+        ; alGenBuffers(NUM_CHUNKS, buffers);
         sub     esp, 8
-        push    buffer
-        push    dword 1
+        push    buffers
+        push    dword NUM_CHUNKS
         call    _alGenBuffers
         add     esp, 16
 
-        ; alBufferData(buffer, AL_FORMAT_MONO16, buf, BUFFER_SIZE*2, 44100);
-        sub     esp, 12
-        push    dword OUTPUTFREQ
-        push    dword SONG_BUFFERLEN*2
-        push    songbuffer
-        push    AL_FORMAT_MONO16
-        push    dword [buffer]
-        call    _alBufferData
-        add     esp, 32
-
-        ; alSourcei(source, AL_BUFFER, buffer);
-        sub     esp, 4
-        push    dword [buffer]
-        push    dword AL_BUFFER
-        push    dword [source]
-        call    _alSourcei
-        add     esp, 16
-
 	; add reverb?
 %if 0
 	;alcASASetListener(const ALuint property, ALvoid *data, ALuint dataSize);
@@ -198,6 +206,102 @@ _start:
 	add	esp, 16
 %endif
 
+	; start rendering in the background
+	sub	esp, 8
+	push	dword 0
+	push	tvstart
+	call	_gettimeofday
+	add	esp, 16
+	push	dword 0
+	push	render_thread
+	push	dword 0
+	push	thread
+	call	_pthread_create
+	add	esp, 16
+
+.poll:
+	sub	esp, 12
+	push	dword POLL_USEC
+	call	_usleep
+	add	esp, 16
+
+	; queue the chunks finished since the last poll. esi = start and
+	; ebx = end of the chunk in samples
+.queue:
+	mov	eax, [queued]
+	cmp	eax, NUM_CHUNKS
+	jz	.lead
+	mul	dword [songlength]
+	mov	ecx, NUM_CHUNKS
+	div	ecx
+	mov	esi, eax
+	mov	eax, [queued]
+	inc	eax
+	mul	dword [songlength]
+	div	ecx
+	mov	ebx, eax
+	cmp	ebx, [renderpos]
+	ja	.lead
+
+        ; alBufferData(buffers[queued], AL_FORMAT_MONO16, buf+start, (end-start)*2, 44100);
+        sub     esp, 12
+        push    dword OUTPUTFREQ
+	sub	ebx, esi
+	add	ebx, ebx
+        push    ebx
+	lea	esi, [songbuffer+esi*2]
+        push    esi
+        push    AL_FORMAT_MONO16
+	mov	eax, [queued]
+        push    dword [buffers+eax*4]
+        call    _alBufferData
+        add     esp, 32
+
+	; alSourceQueueBuffers(source, 1, &buffers[queued]);
+	sub	esp, 4
+	mov	eax, [queued]
+	lea	eax, [buffers+eax*4]
+	push	eax
+	push	dword 1
+	push	dword [source]
+	call	_alSourceQueueBuffers
+	add	esp, 16
+	inc	dword [queued]
+	jmp	.queue
+
+	; start playing once the render, if it keeps its pace so far,
+	; finishes before the playback does. with t seconds elapsed that
+	; is when t*(songlength-renderpos)*OUTPUTFREQ <= renderpos*songlength
+.lead:
+	cmp	dword [started], 0
+	jnz	.poll_next
+	mov	eax, [renderpos]
+	cmp	eax, [songlength]
+	jz	.play
+	cmp	eax, MIN_LEAD
+	jb	.poll_next
+	sub	esp, 8
+	push	dword 0
+	push	tvnow
+	call	_gettimeofday
+	add	esp, 16
+	fild	dword [tvnow]
+	fisub	dword [tvstart]
+	fild	dword [tvnow+4]
+	fisub	dword [tvstart+4]
+	fmul	dword [usec]
+	faddp	st1		; t
+	fild	dword [songlength]
+	fisub	dword [renderpos]
+	fmulp	st1
+	fimul	dword [outputfreq]
+	fild	dword [renderpos]
+	fimul	dword [songlength]
+	fcomip	st1
+	fstp	st0
+	jb	.poll_next
+
+.play:
         ; alSourcePlay(source);
         sub     esp, 12
         push    dword [source]
@@ -210,10 +314,27 @@ _start:
         call    _printf
         add     esp, 16 
 
+	mov	dword [started], 1
+
+	; keep queueing until the whole song is rendered
+.poll_next:
+	cmp	dword [queued], NUM_CHUNKS
+	jb	.poll
+
 	; loop forever
 .loopin:
         jmp     .loopin
 
+
+; thread function for rendering the song. render_song doesn't save any
+; registers, so keep the ones pthreads expects preserved
+render_thread:
+	pushad
+	call	render_song
+	popad
+	xor	eax, eax
+	ret
+
 ;;
 ;; eof
 ;;
@@ -6,7 +6,8 @@
 ;;
 ;; This file contains all the implementations for the modules
 ;; used for sound synthesis. Note that some of the modules are
-;; not fully optimized for size yet.
+;; not fully optimized for size yet. Only the modules enabled
+;; with USE_MODULE_xxx in player.asm are assembled.
 ;;
 
 ;;
@@ -41,6 +42,7 @@
 
 
 
+%ifdef USE_HARDRESTART
 ; this is used to hard restart the accumulators on ADSR, VCO and LFO
 ; old flags in env are also zeroed on hard restart
 hardrestart:
@@ -51,16 +53,20 @@ hardrestart:
 	mov	[esi+4], ebx	; clear subosc accumulator for vco
 .restart_out:
 	ret
+%endif
 
 
 
+%ifdef USE_MODULE_kbd
 ; MODULE_FUNC(kbd)
 module_func_kbd:
 	fld	dword SONGBSS(pitch+edx*4) ; only place where channel nbr in edx is used
 	ret
+%endif
 
 
 
+%ifdef USE_MODULE_env
 ; MODULE_FUNC(env)
 module_func_env:
 	; st0=attack, st1=decay, st2=sustain, st3=release, st4=0
@@ -107,9 +113,11 @@ module_func_env:
 	fst	dword [esi]	;store new acc back and return as output
 	mov	[esi+4], al ; store old flags and trig
 	ret
+%endif
 
 
 
+%ifdef USE_MODULE_vco
 ; MODULE_FUNC(vco) {
 module_func_vco: ; phase-accumulating oscillator w/ suboscillator
 	shr	cl, 5
@@ -193,9 +201,11 @@ module_func_vco: ; phase-accumulating oscillator w/ suboscillator
 
 	; done, st0 has output
 	ret
+%endif
 
 
 
+%ifdef USE_MODULE_lfo
 ; MODULE_FUNC(lfo) { // low-frequency oscillator
 module_func_lfo:
 	; st0=freq, st1=ampl, st2=bias, st3=0, st4=junk
@@ -232,19 +242,24 @@ module_func_lfo:
 	fmul	st0, st2
 	fadd	st0, st3
 	ret
+%endif
 
 
 
 ; MODULE_FUNC(accent) { return accent[v] ? *mod : 0.0; }
 ; MODULE_FUNC(cv) { return *mod; }
 ; MODULE_FUNC(amp) { return ms[0]*ms[1]; }
+%ifdef USE_MODULE_accent
 module_func_accent:
 	; st0 to st3 are zero
 	test	cl, FLAG_ACCENT
 	jnz	module_func_cv
+%endif
+%ifdef USE_MODULE_amp
 module_func_amp:
 	fmul	st1	; return 0*0 on accent, amp*input on amp
 	ret
+%endif
 module_func_cv:
 	fxch	st4	; return modulator in st0
 	ret
@@ -254,12 +269,15 @@ module_func_cv:
 ; MODULE_FUNC(output) { return ms[0]*(*mod); }
 ; MODULE_FUNC(att) { return ms[0]*(*mod); }
 module_func_output:
+%ifdef USE_MODULE_att
 module_func_att:
+%endif
 	fmul	st4		; ms0 * mod
 	ret
 
 
 
+%ifdef USE_MODULE_mixer
 ; MODULE_FUNC(mixer) { return ms[0]+ms[1]+ms[2]+ms[3]; }
 module_func_mixer:
         ; s0 s1 s2 s3 mod
@@ -267,9 +285,11 @@ module_func_mixer:
 	faddp	st1  ; s0+s1+s2  s3  mod
 	faddp	st1  ; s0+s1+s2+s3  mod
 	ret
+%endif
 
 
 
+%ifdef USE_MODULE_vcf
 ; MODULE_FUNC(vcf) // 12db/oct resonant state variable low-/high-/bandpass filter
 module_func_vcf:
 	; esi = lp, esi+8 = bp, esi+4 = hp
@@ -306,9 +326,11 @@ module_func_vcf:
 	fld 	dword [esi+eax] ; out    q      s      0
 .vcf_out:
 	ret
+%endif
 
 
 
+%ifdef USE_MODULE_lpf24
 ;MODULE_FUNC(lpf24) { // 24db/oct four-pole low pass
 module_func_lpf24:
         ;   in      fc     q      0      0
@@ -354,10 +376,11 @@ module_func_lpf24:
         loop    .lpf24_pole
         fld     qword [esi] ; return pole 4 output
         ret
+%endif
 
 
 
-
+%ifdef USE_MODULE_delay
 ;MODULE_FUNC(delay) // interpolated comb/allpass filter delay
 module_func_delay:
 	; st0=in, st1=time, st2=loop, st3=fb
@@ -441,18 +464,20 @@ module_func_delay:
 	mov	[esi+4], edx
 
 	ret
+%endif
 
 
 
-
-
+%ifdef USE_MODULE_supersaw
 ; MODULD_FUNC(supersaw)  {  // jp8000-like detunable 7-sawtooth VCO
 module_func_supersaw:
 	; not yet implemented. requires some setup prior to playback.
 	ret
+%endif
 
 
 
+%ifdef USE_MODULE_resample
 module_func_resample:
 	; st0=in, st1=rate, st2=0. st3=0, st4=0
 	fxch	st0, st1	;rate, in, 0, 0, 0
@@ -469,9 +494,11 @@ module_func_resample:
 .snh_out:
 	fld	dword [esi+4]	; return held sample
 	ret
+%endif
 
 
 
+%ifdef USE_MODULE_dist
 ; MODULE_FUNC(dist)  { // simple clipping distort, input 1 is amplification
 module_func_dist:
 	; in  amp  0.0  0.0  0.0
@@ -485,5 +512,4 @@ module_func_dist:
 	fdiv	st0, st1
 .dist_noclip:
 	ret
-
-
+%endif
@@ -0,0 +1,514 @@
+;;
+;; Komposter player (c) 2010 Noora Halme et al. (see AUTHORS)
+;;
+;; This code is licensed under the MIT license:
+;; http://www.opensource.org/licenses/mit-license.php
+;;
+;; This file contains the synthesizer modules of the x86-64 player.
+;; They do the same math as the ones in modules.asm, only on scalar
+;; SSE. Only the modules enabled with USE_MODULE_xxx are assembled.
+;;
+
+;
+; the synthesizer modules are always called with the registers set up as
+; follows:
+;
+; flags      = cl
+; voice	     = edx
+; *data      = rsi
+; mod	     = eax (as integer)
+;            = xmm4 (as single float)
+; ms[0]      = xmm0
+; ms[1]	     = xmm1
+; ms[2]      = xmm2
+; ms[3]      = xmm3
+;
+; the module returns its output in xmm0. modules may trash rax, rcx,
+; rdx, rsi, rdi, r8-r11 and all of the xmm registers.
+;
+
+
+
+
+; vco waveforms
+%define         VCO_PULSE               0
+%define         VCO_SAW                 1
+%define         VCO_TRIANGLE            2
+%define         VCO_SINE                3
+
+
+; add a float to an oscillator accumulator and drop the integer part
+; like fprem does. the sum is rounded to single precision only once as
+; on the x87, so the phase doesn't drift from the 32-bit player.
+; trashes r8d and xmm6
+%macro accumulate 2
+	cvtss2sd	%1, %1
+	cvtss2sd	xmm6, %2
+	addsd	%1, xmm6
+	cvttsd2si	r8d, %1
+	cvtsi2sd	xmm6, r8d
+	subsd	%1, xmm6
+	cvtsd2ss	%1, %1
+%endmacro
+
+
+
+%ifdef USE_HARDRESTART
+; this is used to hard restart the accumulators on ADSR, VCO and LFO
+; old flags in env are also zeroed on hard restart
+hardrestart:
+	test	cl, 1 		; module shifts its restart flag to lsb
+	jz	.restart_out
+	xor	r8d, r8d
+	mov	[rsi], r8d  	; clear accumulator
+	mov	[rsi+4], r8d	; clear subosc accumulator for vco
+.restart_out:
+	ret
+%endif
+
+
+
+%ifdef USE_SIN
+; returns sin(2*pi*xmm0) in xmm0, trashes r8d, xmm6 and xmm7
+sin2pi:
+	cvtss2si	r8d, xmm0	; wrap to [-0.5, 0.5]
+	cvtsi2ss	xmm6, r8d
+	subss	xmm0, xmm6
+	comiss	xmm0, [quarter]		; and mirror to [-0.25, 0.25]
+	jbe	.sin_notpos
+	movss	xmm6, [half]
+	jmp	.sin_mirror
+.sin_notpos:
+	comiss	xmm0, [minus_quarter]
+	jae	.sin_reduced
+	movss	xmm6, [minus_half]
+.sin_mirror:
+	subss	xmm6, xmm0
+	movaps	xmm0, xmm6
+.sin_reduced:
+	mulss	xmm0, [twopi]		; x in [-pi/2, pi/2]
+	movaps	xmm6, xmm0
+	mulss	xmm6, xmm6		; x^2
+	movss	xmm7, [sin_coef]
+	mulss	xmm7, xmm6
+	addss	xmm7, [sin_coef+4]
+	mulss	xmm7, xmm6
+	addss	xmm7, [sin_coef+8]
+	mulss	xmm7, xmm6
+	addss	xmm7, [sin_coef+12]
+	mulss	xmm7, xmm6
+	addss	xmm7, [sin_coef+16]
+	mulss	xmm7, xmm6
+	addss	xmm7, [sin_coef+20]
+	mulss	xmm0, xmm7
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_kbd
+; MODULE_FUNC(kbd)
+module_func_kbd:
+	movss	xmm0, [pitch+rdx*4] ; only place where channel nbr in edx is used
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_env
+; MODULE_FUNC(env)
+module_func_env:
+	; xmm0=attack, xmm1=decay, xmm2=sustain, xmm3=release
+	; [rsi] = accumulator, byte [rsi+4]=old flags w/ trig
+	mov	edi, ecx
+	shr	cl, 4
+	call 	hardrestart
+	mov	eax, edi
+	movss	xmm5, [rsi]	; accumulator
+	test	al, FLAG_GATE
+	jz	.env_release
+	; gate is up, was it down previously?
+	mov 	cl, [rsi+4]
+	test 	cl, FLAG_GATE
+	jnz 	.env_notrig
+	or 	al, FLAG_TRIG
+.env_notrig:
+	and 	cl, FLAG_TRIG
+	or 	al, cl
+	test	al, FLAG_TRIG
+	jz	.env_decay_sustain
+	addss	xmm5, xmm0	; add attack rate to acc
+	comiss	xmm5, [one]
+	jbe	.env_done	; return current acc
+	movss	xmm5, [one]	; return 1.0
+	and	al, 0xff-FLAG_TRIG	; trig off
+	jmp	.env_done
+.env_decay_sustain:
+	subss	xmm5, xmm1
+	comiss	xmm5, xmm2	; compare to sustain
+	jae	.env_done
+	movaps	xmm5, xmm2	; return sustain level
+	jmp	.env_done
+.env_release:
+	subss	xmm5, xmm3	; dec by release
+	maxss	xmm5, [zero]	; return zero if acc was < 0
+.env_done:
+	movss	[rsi], xmm5	; store new acc back and return as output
+	mov	[rsi+4], al	; store old flags and trig
+	movaps	xmm0, xmm5
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_vco
+; MODULE_FUNC(vco) {
+module_func_vco: ; phase-accumulating oscillator w/ suboscillator
+	; xmm0=cv, xmm1=pwm, xmm2=sub, xmm3=noise
+	shr	cl, 5
+	call	hardrestart
+
+	movaps	xmm5, xmm0
+	accumulate	xmm5, [rsi]
+	movss	[rsi], xmm5		;;; store main oscillator accumulator
+	mulss	xmm0, [half]
+	accumulate	xmm0, [rsi+4]
+	movss	[rsi+4], xmm0		;;; store subosc accumulator
+
+	; suboscillator is a square at half the frequency
+	comiss	xmm0, xmm1
+	jb	.vco_subpos
+	mulss	xmm2, [minus_one]
+.vco_subpos:
+
+	; modulator is already in eax
+	; xmm5=acc, xmm1=pwm, xmm2=sub, xmm3=noise
+	movss	xmm0, [one]
+	cmp	al, VCO_PULSE
+	jnz	.vco_saw
+.vco_pulse:
+	comiss	xmm1, xmm5		; compare pwm vs accumulator
+	jb	.vco_oscdone
+	movss	xmm0, [minus_one]
+	jmp	.vco_oscdone
+.vco_saw:
+	cmp	al, VCO_SAW
+	jnz	.vco_triangle
+	movaps	xmm0, xmm5
+	addss	xmm0, xmm0
+	subss	xmm0, [one]		; 2*acc-1
+	jmp	.vco_oscdone
+.vco_triangle:
+	cmp	al, VCO_TRIANGLE
+	jnz	.vco_sine
+	movaps	xmm0, xmm5
+	mulss	xmm0, [four]		; 4*acc
+	comiss	xmm5, [threefourths]
+	jbe	.vco_tricalc
+	subss	xmm0, [four]
+.vco_tricalc:
+	subss	xmm0, [one]		; acc*4 - [1 or 5]
+	movaps	xmm6, xmm0
+	mulss	xmm6, [minus_one]
+	maxss	xmm0, xmm6		; fabs
+	movss	xmm6, [one]
+	subss	xmm6, xmm0
+	movaps	xmm0, xmm6		; 1-fabs(acc*4 - [1 or 5])
+	jmp	.vco_oscdone
+.vco_sine:
+	; none of the others matched, so it has to be sine
+	movaps	xmm0, xmm5
+	call	sin2pi
+.vco_oscdone:
+	addss	xmm0, xmm2
+
+	; noise
+	;out=noise*(noise_x2*(2.0f/0xffffffff));
+	addss	xmm3, xmm3
+	cvtsi2ss	xmm6, dword [noise_x2]
+	mulss	xmm3, xmm6
+	divss	xmm3, [noise_div]
+	addss	xmm0, xmm3
+
+	; done, xmm0 has output
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_lfo
+; MODULE_FUNC(lfo) { // low-frequency oscillator
+module_func_lfo:
+	; xmm0=freq, xmm1=ampl, xmm2=bias
+	shr	cl, 6
+	call	hardrestart
+.lfo_osc:
+	accumulate	xmm0, [rsi]
+	movss	[rsi], xmm0
+.lfo_triangle:
+	and	al, al
+	jz	.lfo_sine
+	addss	xmm0, xmm0	; 2*acc
+	comiss	xmm0, [one]
+	jb	.lfo_done
+	mulss	xmm0, [minus_one]
+	addss	xmm0, [one]
+	addss	xmm0, [one]	; 2-2*acc
+	jmp	.lfo_done
+.lfo_sine:
+	addss	xmm0, [quarter]
+	call	sin2pi		; cos(2*pi*acc)
+	movss	xmm6, [one]
+	subss	xmm6, xmm0
+	mulss	xmm6, [half]
+	movaps	xmm0, xmm6
+.lfo_done:
+	mulss	xmm0, xmm1
+	addss	xmm0, xmm2
+	ret
+%endif
+
+
+
+; MODULE_FUNC(accent) { return accent[v] ? *mod : 0.0; }
+; MODULE_FUNC(cv) { return *mod; }
+; MODULE_FUNC(amp) { return ms[0]*ms[1]; }
+%ifdef USE_MODULE_accent
+module_func_accent:
+	; xmm0 to xmm3 are zero
+	test	cl, FLAG_ACCENT
+	jnz	module_func_cv
+%endif
+%ifdef USE_MODULE_amp
+module_func_amp:
+	mulss	xmm0, xmm1	; return 0*0 on accent, amp*input on amp
+	ret
+%endif
+module_func_cv:
+	movaps	xmm0, xmm4	; return modulator
+	ret
+
+
+
+; MODULE_FUNC(output) { return ms[0]*(*mod); }
+; MODULE_FUNC(att) { return ms[0]*(*mod); }
+module_func_output:
+%ifdef USE_MODULE_att
+module_func_att:
+%endif
+	mulss	xmm0, xmm4	; ms0 * mod
+	ret
+
+
+
+%ifdef USE_MODULE_mixer
+; MODULE_FUNC(mixer) { return ms[0]+ms[1]+ms[2]+ms[3]; }
+module_func_mixer:
+	addss	xmm0, xmm1
+	addss	xmm0, xmm2
+	addss	xmm0, xmm3
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_vcf
+; MODULE_FUNC(vcf) // 12db/oct resonant state variable low-/high-/bandpass filter
+module_func_vcf:
+	; rsi = lp, rsi+8 = bp, rsi+4 = hp
+	and	eax, 3
+	jz	.vcf_out	; filter is off, return unmodified input
+	dec	eax 		; 0=lp, 1=hp, 2=bp
+	shl	eax, 2
+
+	movaps	xmm3, xmm0	; s
+	movaps	xmm0, xmm1
+	mulss	xmm0, [half]
+	call	sin2pi		; sin(pi*fc)
+	addss	xmm0, xmm0	; f
+	movss	xmm5, [one]
+	subss	xmm5, xmm2	; q = 1.0 - q  -- no resonance when res input is not connected
+	movss	xmm1, [rsi+8]	; bp
+	movaps	xmm2, xmm0
+	mulss	xmm2, xmm1
+	addss	xmm2, [rsi]
+	movss	[rsi], xmm2	; lp+=f*bp
+	sqrtss	xmm6, xmm5
+	mulss	xmm6, xmm3
+	subss	xmm6, xmm2	; sqrt(q)*s-lp
+	mulss	xmm5, xmm1
+	subss	xmm6, xmm5
+	movss	[rsi+4], xmm6	; hp=sqrt(q)*s-lp-q*bp
+	mulss	xmm6, xmm0
+	addss	xmm6, xmm1
+	movss	[rsi+8], xmm6	; bp+=f*hp
+	movss	xmm0, [rsi+rax]
+.vcf_out:
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_lpf24
+;MODULE_FUNC(lpf24) { // 24db/oct four-pole low pass
+module_func_lpf24:
+	; the poles are kept in double precision like in modules.asm
+	cvtss2sd	xmm0, xmm0	; in
+	cvtss2sd	xmm1, xmm1	; fc
+	cvtss2sd	xmm2, xmm2	; q
+	cvtss2sd	xmm8, [three_point_foureight]
+	cvtss2sd	xmm9, [lpf_feedback_coef]
+	cvtss2sd	xmm10, [minus_point_onefive]
+	cvtss2sd	xmm11, [point_three]
+	cvtss2sd	xmm12, [one]
+
+	mulsd	xmm1, xmm8	; f=fc*3.48
+	movapd	xmm5, xmm1
+	mulsd	xmm5, xmm5	; f^2
+	movapd	xmm6, xmm5
+	mulsd	xmm6, xmm6	; f^4
+	mulsd	xmm6, xmm9	; 0.35013*f^4
+	mulsd	xmm5, xmm10
+	addsd	xmm5, xmm12	; 1.0-0.15*f^2
+	addsd	xmm2, xmm2
+	addsd	xmm2, xmm2	; q*4
+	mulsd	xmm5, xmm2	; fb
+	mulsd	xmm5, [rsi+4*8]
+	subsd	xmm0, xmm5
+	mulsd	xmm0, xmm6
+	movsd	[rsi], xmm0	; feed pole 1
+
+	; calculate all four poles
+	; p_inputs from rsi+0, p_outputs from rsi+8, p_states from rsi+40
+	subsd	xmm12, xmm1	; 1-f
+	mov	ecx, 4
+.lpf24_pole:
+	movsd	xmm0, [rsi+8]
+	mulsd	xmm0, xmm12	; (1-f)*p_out
+	movsd	xmm3, [rsi+40]
+	mulsd	xmm3, xmm11
+	addsd	xmm0, xmm3	; 0.3*p_state + (1-f)*p_out
+	movsd	xmm3, [rsi]
+	movsd	[rsi+40], xmm3
+	addsd	xmm0, xmm3	; p_input + 0.3*p_state + (1-f)*p_out
+	movsd	[rsi+8], xmm0
+	add	rsi, 8
+	loop	.lpf24_pole
+	cvtsd2ss	xmm0, xmm0	; return pole 4 output
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_delay
+;MODULE_FUNC(delay) // interpolated comb/allpass filter delay
+module_func_delay:
+	; xmm0=in, xmm1=time, xmm2=loop, xmm3=fb
+	mov	edi, [rsi]
+	test	edi, edi	; do we have a buffer already
+	jnz	.delay_bufok
+	movzx	edi, byte [delaycount]
+	shl	edi, 18+2 ; = imul edi, edi, DELAYBUFFERSIZE*4
+	lea	edi, [delaybuffer+rdi]
+	inc	byte [delaycount]
+	mov	[rsi], edi
+.delay_bufok:
+	mov	r9d, [rsi+4]
+	; rdi is ptr to delay buffer
+	; r9 is write offset
+
+	;  ptrdelta=(long)(ms[1]);
+	;  spfrac=ms[1]-(float)(ptrdelta);
+	cvtss2si	edx, xmm1	; rounds like fistp
+	cvtsi2ss	xmm5, edx
+	movaps	xmm6, xmm1
+	subss	xmm6, xmm5	; spfrac
+
+	;  readptr=(writeptr - ptrdelta);
+	;  while (readptr<0) readptr+=loopend;
+	mov	r8d, r9d
+	sub	r8d, edx	; r8 = readptr
+	jns	.delay_inrange
+	add	r8d, DELAYBUFFERSIZE
+.delay_inrange:
+
+	; interpolation
+	;  out=buffer[readptr]*spfrac;
+	;  readptr++;
+	;  readptr%=loopend;
+	;  out+= buffer[readptr]*(1-spfrac);
+	movss	xmm5, [rdi+r8*4]
+	mulss	xmm5, xmm6
+	inc	r8d
+	and	r8d, DELAYBUFFERSIZE-1
+	movss	xmm7, [one]
+	subss	xmm7, xmm6
+	mulss	xmm7, [rdi+r8*4]
+	addss	xmm5, xmm7	; out
+
+	and	al, al
+	jz	.delay_comb
+	; allpass mode, do a feedforward
+	; out+=ms[0]*(-ms[3]);
+	movaps	xmm6, xmm0
+	mulss	xmm6, xmm3
+	subss	xmm5, xmm6
+.delay_comb:
+
+	;  buffer[writeptr]=ms[0] + out*ms[3];
+	movaps	xmm6, xmm5
+	mulss	xmm6, xmm3
+	addss	xmm6, xmm0
+	movss	[rdi+r9*4], xmm6
+
+	;  mod_ldata[1]=(writeptr+1)%loopend;
+	inc	r9d
+	and	r9d, DELAYBUFFERSIZE-1
+	mov	[rsi+4], r9d
+
+	movaps	xmm0, xmm5
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_supersaw
+; MODULD_FUNC(supersaw)  {  // jp8000-like detunable 7-sawtooth VCO
+module_func_supersaw:
+	; not yet implemented. requires some setup prior to playback.
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_resample
+module_func_resample:
+	; xmm0=in, xmm1=rate
+	movss	xmm5, [rsi]
+	subss	xmm5, xmm1	; acc-rate
+	movss	[rsi], xmm5
+	comiss	xmm5, [zero]
+	ja	.snh_out
+	movss	[rsi+4], xmm0	; sample the input
+	movss	xmm5, [one]
+	movss	[rsi], xmm5	; reset acc back to 1.0
+.snh_out:
+	movss	xmm0, [rsi+4]	; return held sample
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_dist
+; MODULE_FUNC(dist)  { // simple clipping distort, input 1 is amplification
+module_func_dist:
+	mulss	xmm0, xmm1	; in*amp
+	movaps	xmm5, xmm0
+	mulss	xmm5, [minus_one]
+	maxss	xmm5, xmm0	; abs(out)
+	comiss	xmm5, [one]
+	jbe	.dist_noclip
+	divss	xmm0, xmm5
+.dist_noclip:
+	ret
+%endif
@@ -0,0 +1,423 @@
+;;
+;; Komposter player (c) 2010 Noora Halme et al. (see AUTHORS)
+;;
+;; This code is licensed under the MIT license:
+;; http://www.opensource.org/licenses/mit-license.php
+;;
+;; Packed versions of the synthesizer modules for the x86-64 player
+;; built with PACKED_VOICES. Each SSE lane runs the module for one of
+;; up to four channels playing the same synth. The math is done in the
+;; same order as in modules64.asm, so every lane gets exactly the same
+;; result as the scalar module would.
+;;
+;; Modules without a packed version here run through lanes_func, which
+;; calls the scalar module once for each channel in the group.
+;;
+
+;
+; the packed modules are called with the registers set up as follows:
+;
+; *data      = rsi (output at +0, modulators at +16, state from +32)
+; module     = r13 (index within the synth)
+; group      = r12
+; mod	     = xmm4 (as single floats, or integers)
+; ms[0]      = xmm0
+; ms[1]	     = xmm1
+; ms[2]      = xmm2
+; ms[3]      = xmm3
+;
+; the flags and pitch of each lane are in the lane* vectors. the module
+; returns its output in xmm0 and may trash rax, rcx, rdx, rsi, rdi,
+; r8-r11 and all of the xmm registers.
+;
+
+
+; %1 = %3 ? %2 : %1 on each lane, trashes %2 and %3
+%macro blend 3
+	andps	%2, %3
+	andnps	%3, %1
+	orps	%2, %3
+	movaps	%1, %2
+%endmacro
+
+
+; packed version of the accumulate macro in modules64.asm. the lanes
+; are added to the vector at memory address %2 and wrapped two at a
+; time in double precision. trashes xmm6 and xmm7
+%macro accumulate4 2
+	cvtps2pd	xmm6, %1
+	movhlps	%1, %1
+	cvtps2pd	%1, %1
+	cvtps2pd	xmm7, [%2]
+	addpd	xmm6, xmm7
+	cvtps2pd	xmm7, [%2+8]
+	addpd	%1, xmm7
+	cvttpd2dq	xmm7, xmm6
+	cvtdq2pd	xmm7, xmm7
+	subpd	xmm6, xmm7
+	cvttpd2dq	xmm7, %1
+	cvtdq2pd	xmm7, xmm7
+	subpd	%1, xmm7
+	cvtpd2ps	xmm6, xmm6
+	cvtpd2ps	%1, %1
+	movlhps	xmm6, %1
+	movaps	%1, xmm6
+%endmacro
+
+
+
+; run a module without a packed version on each lane in turn. the
+; scalar module keeps its data for lane n at +32+n*120
+lanes_func:
+	movaps	[lanein], xmm0
+	movaps	[lanein+16], xmm1
+	movaps	[lanein+32], xmm2
+	movaps	[lanein+48], xmm3
+	push	rbp
+	xor	ebp, ebp
+.lane:
+	movss	xmm0, [lanein+rbp*4]
+	movss	xmm1, [lanein+16+rbp*4]
+	movss	xmm2, [lanein+32+rbp*4]
+	movss	xmm3, [lanein+48+rbp*4]
+	movss	xmm4, [r14+16+rbp*4]
+	mov	eax, [r14+16+rbp*4]
+	mov	cl, [laneflags+rbp]
+	lea	rdx, [r12*4+rbp]
+	mov	edx, [groupchan+rdx*4]
+	imul	esi, ebp, 120
+	lea	rsi, [r14+32+rsi]
+	call	[modfunctable+rbx*8]
+	movss	[laneout+rbp*4], xmm0
+	inc	ebp
+	cmp	ebp, [grouplanes+r12*4]
+	jb	.lane
+	pop	rbp
+	movaps	xmm0, [laneout]
+	ret
+
+
+
+%ifdef USE_SIN
+; returns sin(2*pi*xmm0) on each lane in xmm0, trashes xmm6-xmm9
+psin2pi:
+	cvtps2dq	xmm6, xmm0	; wrap to [-0.5, 0.5]
+	cvtdq2ps	xmm6, xmm6
+	subps	xmm0, xmm6
+	movaps	xmm6, [quarter4]	; and mirror to [-0.25, 0.25]
+	cmpltps	xmm6, xmm0
+	movaps	xmm7, xmm0
+	cmpltps	xmm7, [minus_quarter4]
+	movaps	xmm8, [half4]
+	andps	xmm8, xmm6
+	movaps	xmm9, [minus_half4]
+	andps	xmm9, xmm7
+	orps	xmm8, xmm9
+	orps	xmm6, xmm7
+	subps	xmm8, xmm0
+	blend	xmm0, xmm8, xmm6
+	mulps	xmm0, [twopi4]		; x in [-pi/2, pi/2]
+	movaps	xmm6, xmm0
+	mulps	xmm6, xmm6		; x^2
+	movaps	xmm7, [sin_coef4]
+	mulps	xmm7, xmm6
+	addps	xmm7, [sin_coef4+16]
+	mulps	xmm7, xmm6
+	addps	xmm7, [sin_coef4+32]
+	mulps	xmm7, xmm6
+	addps	xmm7, [sin_coef4+48]
+	mulps	xmm7, xmm6
+	addps	xmm7, [sin_coef4+64]
+	mulps	xmm7, xmm6
+	addps	xmm7, [sin_coef4+80]
+	mulps	xmm0, xmm7
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_kbd
+packed_func_kbd:
+	movaps	xmm0, [lanepitch]
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_env
+packed_func_env:
+	; [rsi+32] = accumulator, [rsi+48] = gate was up, [rsi+64] = trig
+	movaps	xmm8, [lanerenv]
+	movaps	xmm5, xmm8
+	andnps	xmm5, [rsi+32]
+	movaps	xmm6, xmm8
+	andnps	xmm6, [rsi+48]
+	andnps	xmm8, [rsi+64]
+	pcmpeqd	xmm7, xmm7
+	xorps	xmm6, xmm7
+	orps	xmm8, xmm6		; trig if the gate was down before
+
+	movaps	xmm9, xmm5
+	addps	xmm9, xmm0		; attack
+	movaps	xmm10, [one4]
+	cmpltps	xmm10, xmm9
+	minps	xmm9, [one4]
+	andnps	xmm10, xmm8		; trig off once the top is reached
+	movaps	xmm11, xmm5
+	subps	xmm11, xmm1
+	maxps	xmm11, xmm2		; decay to sustain
+	subps	xmm5, xmm3
+	xorps	xmm12, xmm12
+	maxps	xmm5, xmm12		; release
+
+	blend	xmm11, xmm9, xmm8
+	movaps	xmm6, [lanegate]
+	movaps	xmm7, xmm6
+	blend	xmm5, xmm11, xmm7
+	andps	xmm10, xmm6
+	movaps	[rsi+32], xmm5
+	movaps	[rsi+48], xmm6
+	movaps	[rsi+64], xmm10
+	movaps	xmm0, xmm5
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_vco
+packed_func_vco:
+	; [rsi+32] = accumulator, [rsi+48] = subosc accumulator
+	movaps	xmm5, [lanervco]
+	movaps	xmm6, xmm5
+	andnps	xmm5, [rsi+32]
+	andnps	xmm6, [rsi+48]
+	movaps	[rsi+32], xmm5
+	movaps	[rsi+48], xmm6
+
+	movaps	xmm5, xmm0
+	accumulate4	xmm5, rsi+32
+	movaps	[rsi+32], xmm5
+	mulps	xmm0, [half4]
+	accumulate4	xmm0, rsi+48
+	movaps	[rsi+48], xmm0
+
+	; suboscillator
+	cmpltps	xmm0, xmm1
+	movaps	xmm6, xmm2
+	xorps	xmm6, [signmask4]
+	blend	xmm6, xmm2, xmm0
+	movaps	xmm2, xmm6
+
+	; all of the waveforms, sine for the lanes that match none
+	movaps	xmm0, xmm5
+	call	psin2pi
+
+	movaps	xmm6, xmm5
+	mulps	xmm6, [four4]
+	movaps	xmm7, [threefourths4]
+	cmpltps	xmm7, xmm5
+	andps	xmm7, [four4]
+	subps	xmm6, xmm7
+	subps	xmm6, [one4]
+	andps	xmm6, [absmask4]
+	movaps	xmm7, [one4]
+	subps	xmm7, xmm6		; triangle
+	movaps	xmm6, [int2_4]
+	pcmpeqd	xmm6, xmm4
+	blend	xmm0, xmm7, xmm6
+
+	movaps	xmm7, xmm5
+	addps	xmm7, xmm7
+	subps	xmm7, [one4]		; saw
+	movaps	xmm6, [int1_4]
+	pcmpeqd	xmm6, xmm4
+	blend	xmm0, xmm7, xmm6
+
+	cmpltps	xmm1, xmm5
+	movaps	xmm7, [minus_one4]
+	movaps	xmm6, [one4]
+	blend	xmm7, xmm6, xmm1	; pulse
+	pxor	xmm6, xmm6
+	pcmpeqd	xmm6, xmm4
+	blend	xmm0, xmm7, xmm6
+	addps	xmm0, xmm2
+
+	; noise, from the generator state each channel would have had
+	; at this module in the scalar player
+	xor	edx, edx
+.vco_noise:
+	lea	rcx, [rdx+r12*4]
+	mov	eax, [groupnoise+rcx*4]
+	add	eax, r13d
+	mov	eax, [noisebuf+rax*4]
+	mov	[lanenoise+rdx*4], eax
+	inc	edx
+	cmp	edx, 4
+	jb	.vco_noise
+	cvtdq2ps	xmm6, [lanenoise]
+	addps	xmm3, xmm3
+	mulps	xmm3, xmm6
+	divps	xmm3, [noise_div4]
+	addps	xmm0, xmm3
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_lfo
+packed_func_lfo:
+	; [rsi+32] = accumulator
+	movaps	xmm5, [lanerlfo]
+	andnps	xmm5, [rsi+32]
+	movaps	[rsi+32], xmm5
+	accumulate4	xmm0, rsi+32
+	movaps	[rsi+32], xmm0
+
+	movaps	xmm10, xmm0
+	addps	xmm10, xmm10
+	movaps	xmm11, xmm10
+	mulps	xmm11, [minus_one4]
+	addps	xmm11, [one4]
+	addps	xmm11, [one4]
+	movaps	xmm12, xmm10
+	cmpltps	xmm12, [one4]
+	blend	xmm11, xmm10, xmm12	; triangle
+
+	addps	xmm0, [quarter4]
+	call	psin2pi
+	movaps	xmm6, [one4]
+	subps	xmm6, xmm0
+	mulps	xmm6, [half4]		; sine
+	pxor	xmm7, xmm7
+	pcmpeqd	xmm7, xmm4
+	blend	xmm11, xmm6, xmm7
+
+	mulps	xmm11, xmm1
+	addps	xmm11, xmm2
+	movaps	xmm0, xmm11
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_accent
+packed_func_accent:
+	andps	xmm4, [laneaccent]
+	movaps	xmm0, xmm4
+	ret
+%endif
+%ifdef USE_MODULE_amp
+packed_func_amp:
+	mulps	xmm0, xmm1
+	ret
+%endif
+packed_func_cv:
+	movaps	xmm0, xmm4
+	ret
+
+
+
+packed_func_output:
+%ifdef USE_MODULE_att
+packed_func_att:
+%endif
+	mulps	xmm0, xmm4
+	ret
+
+
+
+%ifdef USE_MODULE_mixer
+packed_func_mixer:
+	addps	xmm0, xmm1
+	addps	xmm0, xmm2
+	addps	xmm0, xmm3
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_vcf
+packed_func_vcf:
+	; [rsi+32] = lp, [rsi+48] = hp, [rsi+64] = bp. the lanes with the
+	; filter off pass the input through and keep their state
+	movaps	xmm10, xmm0
+	andps	xmm4, [int3_4]
+	movaps	xmm0, xmm1
+	mulps	xmm0, [half4]
+	call	psin2pi
+	addps	xmm0, xmm0		; f
+	movaps	xmm5, [one4]
+	subps	xmm5, xmm2		; q
+	movaps	xmm1, [rsi+64]
+	movaps	xmm2, xmm0
+	mulps	xmm2, xmm1
+	addps	xmm2, [rsi+32]		; lp+=f*bp
+	sqrtps	xmm6, xmm5
+	mulps	xmm6, xmm10
+	subps	xmm6, xmm2
+	mulps	xmm5, xmm1
+	subps	xmm6, xmm5		; hp=sqrt(q)*s-lp-q*bp
+	movaps	xmm7, xmm6
+	mulps	xmm7, xmm0
+	addps	xmm7, xmm1		; bp+=f*hp
+
+	pxor	xmm8, xmm8
+	pcmpeqd	xmm8, xmm4
+	movaps	xmm9, [rsi+32]
+	movaps	xmm11, xmm8
+	blend	xmm2, xmm9, xmm11
+	movaps	xmm9, [rsi+48]
+	movaps	xmm11, xmm8
+	blend	xmm6, xmm9, xmm11
+	movaps	xmm9, [rsi+64]
+	blend	xmm7, xmm9, xmm8
+	movaps	[rsi+32], xmm2
+	movaps	[rsi+48], xmm6
+	movaps	[rsi+64], xmm7
+
+	movaps	xmm9, [int1_4]
+	pcmpeqd	xmm9, xmm4
+	blend	xmm10, xmm2, xmm9
+	movaps	xmm9, [int2_4]
+	pcmpeqd	xmm9, xmm4
+	blend	xmm10, xmm6, xmm9
+	movaps	xmm9, [int3_4]
+	pcmpeqd	xmm9, xmm4
+	blend	xmm10, xmm7, xmm9
+	movaps	xmm0, xmm10
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_resample
+packed_func_resample:
+	; [rsi+32] = accumulator, [rsi+48] = held sample
+	movaps	xmm5, [rsi+32]
+	subps	xmm5, xmm1
+	xorps	xmm6, xmm6
+	cmpltps	xmm6, xmm5		; keep holding while acc > 0
+	movaps	xmm7, xmm6
+	movaps	xmm8, [one4]
+	blend	xmm8, xmm5, xmm7
+	movaps	[rsi+32], xmm8
+	movaps	xmm9, [rsi+48]
+	blend	xmm0, xmm9, xmm6
+	movaps	[rsi+48], xmm0
+	ret
+%endif
+
+
+
+%ifdef USE_MODULE_dist
+packed_func_dist:
+	mulps	xmm0, xmm1
+	movaps	xmm5, xmm0
+	andps	xmm5, [absmask4]
+	movaps	xmm6, xmm0
+	divps	xmm6, xmm5
+	movaps	xmm7, [one4]
+	cmpltps	xmm7, xmm5
+	blend	xmm0, xmm6, xmm7
+	ret
+%endif
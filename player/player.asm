@@ -18,8 +18,9 @@
 ; output sample rate
 %define 	OUTPUTFREQ	44100
 
-; how many samples of audio we're rendering
-%define		SONG_BUFFERLEN	15*OUTPUTFREQ
+; how many samples of audio we're rendering, from the song length in
+; rows of 64 ticks
+%define		SONG_BUFFERLEN	(SONG_LEN*64*TICKDIVIDER)
 
 ; maximum number of modules per synth. 64 means 256 bytes of modulator data per channel.
 %define		MAX_MODULES		64
@@ -45,53 +46,106 @@
 ;
 section .data
 
-outputfreq	dd	44100.0  ; outputfreq as a float value
+; include the song itself from an external file
+%include "song.inc"
+
+; the converter defines USE_MODULE_xxx for each module type the song
+; uses and the rest are left out of modules.asm and the jump table.
+; song files without the definitions get all of the modules
+%ifndef USE_MODULES
+%define USE_MODULE_kbd
+%define USE_MODULE_env
+%define USE_MODULE_vco
+%define USE_MODULE_lfo
+%define USE_MODULE_cv
+%define USE_MODULE_amp
+%define USE_MODULE_mixer
+%define USE_MODULE_vcf
+%define USE_MODULE_lpf24
+%define USE_MODULE_delay
+%define USE_MODULE_att
+%define USE_MODULE_resample
+%define USE_MODULE_supersaw
+%define USE_MODULE_dist
+%define USE_MODULE_accent
+%define USE_MODULE_output
+%endif
+
+; code and data shared between modules
+%ifdef USE_MODULE_accent
+%define USE_MODULE_amp		; accent falls through to amp
+%endif
+%ifdef USE_MODULE_env
+%define USE_HARDRESTART
+%endif
+%ifdef USE_MODULE_vco
+%define USE_HARDRESTART
+%define USE_HALF
+%endif
+%ifdef USE_MODULE_lfo
+%define USE_HARDRESTART
+%define USE_HALF
+%endif
+
+; length of the songbuffer in samples
+global songlength
+songlength	dd	SONG_BUFFERLEN
+
 noise_x1	dd	0x67452301
 noise_x2	dd	0xefcdab89
+%ifdef USE_MODULE_vco
 noise_div	dd	4294967296.0
-midi0           dd      8.1757989156 ; C0
-midisemi        dd      1.059463094 ; ratio between notes a semitone apart
+%endif
 
 ; small constants used around the code
 zero		dd	0.0
 one		dd	1.0
 minus_one	dd	-1.0
+%ifdef USE_HALF
 half		dd	0.5
+%endif
+%ifdef USE_MODULE_vco
 threefourths	dd	0.75
 four		dd	4.0
 five		dd	5.0
+%endif
 
-; these are for the 24db/oct lpf, comment out if not used
+; these are for the 24db/oct lpf
+%ifdef USE_MODULE_lpf24
 three_point_foureight   dd      3.48
 minus_point_onefive     dd      -0.15
 lpf_feedback_coef       dd      0.35013  
 point_three             dd      0.3
+%endif
 
 
 
-; jump table to module functions. if you know that your song doesn't use
-; some module, delete the function from modules.asm and set the jump table
-; address here to zero. probably saves a few bytes.
-modfunctable:
-	dd	module_func_kbd
-	dd	module_func_env
-	dd	module_func_vco
-	dd	module_func_lfo
-	dd	module_func_cv
-	dd	module_func_amp
-	dd	module_func_mixer
-	dd	module_func_vcf
-	dd	module_func_lpf24
-	dd	module_func_delay
-	dd	module_func_att
-	dd	module_func_resample
-	dd	module_func_supersaw
-	dd	module_func_dist
-	dd	module_func_accent
-	dd	module_func_output
+; jump table to module functions, zero for the modules left out
+%macro modfunc 1
+%ifdef USE_MODULE_%1
+	dd	module_func_%1
+%else
+	dd	0
+%endif
+%endmacro
 
-; include the song itself from an external file
-%include "song.inc"
+modfunctable:
+	modfunc	kbd
+	modfunc	env
+	modfunc	vco
+	modfunc	lfo
+	modfunc	cv
+	modfunc	amp
+	modfunc	mixer
+	modfunc	vcf
+	modfunc	lpf24
+	modfunc	delay
+	modfunc	att
+	modfunc	resample
+	modfunc	supersaw
+	modfunc	dist
+	modfunc	accent
+	modfunc	output
 
 ;
 ; BSS
@@ -107,12 +161,32 @@ pitch		resd	NUM_CHANNELS
 flags		resb	NUM_CHANNELS
 patchptr	resd	NUM_CHANNELS
 
+%ifdef NOTE_OCTAVE
+notetable	resd	NOTE_COUNT ; expanded from the octave in noteoctave
+%endif
+
+%ifdef SONG_EVENTS
+; sequencer state for each channel
+orderpos	resd	NUM_CHANNELS ; next order list entry, zero before the first
+eventptr	resd	NUM_CHANNELS ; next note event in the pattern
+rowsleft	resw	NUM_CHANNELS ; rows left in the pattern pass
+repeatsleft	resb	NUM_CHANNELS ; passes left of the pattern
+eventwait	resb	NUM_CHANNELS ; rows to skip before the next event
+chpattern	resb	NUM_CHANNELS ; pattern playing on the channel
+transpose	resb	NUM_CHANNELS
+%endif
+
 delaycount	resb	1
 delaybuffer	resd	NUM_DELAYS*DELAYBUFFERSIZE
 
 global songbuffer
 songbuffer	resw	SONG_BUFFERLEN
 
+; samples rendered so far, for playing or showing progress while
+; render_song runs on another thread
+global renderpos
+renderpos	resd	1
+
 ;output		resd	NUM_CHANNELS*MAX_MODULES
 ;localdata	resd	NUM_CHANNELS*MAX_MODULES*16
 
@@ -133,6 +207,24 @@ section .text
 global render_song
 render_song:
 
+%ifdef NOTE_OCTAVE
+	; the note table is stored for the lowest octave, double it for
+	; the octaves above
+	mov	esi, noteoctave
+	mov	edi, notetable
+	mov	ecx, NOTE_OCTAVE
+	rep	movsd
+%if NOTE_COUNT > NOTE_OCTAVE
+	mov	cl, NOTE_COUNT-NOTE_OCTAVE
+.note_octaves:
+	fld	dword [edi-12*4]
+	fadd	st0
+	fstp	dword [edi]
+	add	edi, 4
+	loop	.note_octaves
+%endif
+%endif
+
 	; start the loop to fill the outputbuffer with rendered audio
 	xor	ebx, ebx ; ebx = sample number
 .sample_loop:
@@ -143,13 +235,86 @@ render_song:
 	and	edx, edx
 	jnz 	.synth
 	mov	ecx, eax ; tick number in ecx
+%ifndef SONG_EVENTS
 	shr	eax, 6 ; songpos is tick/64
 	add	eax, eax
 	lea	esi, [songdata+eax]
+%endif
 
 	; play notes
 	xor	edx, edx
 .channel_loop:
+%ifdef SONG_EVENTS
+	movzx	ebx, byte [flags+edx] ; get flags to bl, bh gets the patch load flag
+        and     cl, 63
+        jnz     .tick0_end
+
+	; a new row. start the next pass of the pattern or the next entry
+	; on the order list if this one is over
+	dec	word [rowsleft+edx*2]
+	jns	.next_event
+	dec	byte [repeatsleft+edx]
+	jns	.pattern_start
+	mov	esi, [orderpos+edx*4]
+	and	esi, esi
+	jnz	.order_entry
+	mov	esi, [orderlist+edx*4]
+.order_entry:
+	lodsb
+	mov	[chpattern+edx], al
+	lodsb
+	mov	[repeatsleft+edx], al
+	lodsb
+	mov	[transpose+edx], al
+	xor	eax, eax
+	lodsb
+	mov	[orderpos+edx*4], esi
+	and	al, al
+	jz	.pattern_start
+	mov	ax, [patchstart+eax*2-2]
+	lea	eax, [patchdata+eax*4]
+	mov	[patchptr+edx*4], eax
+	mov	bh, FLAG_LOAD_PATCH
+.pattern_start:
+	movzx	eax, byte [chpattern+edx]
+	movzx	esi, word [patternstart+eax*2]
+	add	esi, patterns
+	movzx	eax, byte [patternlen+eax]
+	shl	eax, 4
+	dec	eax
+	mov	[rowsleft+edx*2], ax
+	lodsb				; rows to skip before the first event
+	mov	[eventwait+edx], al
+	mov	[eventptr+edx*4], esi
+
+	; play the next event once its row comes up
+.next_event:
+	dec	byte [eventwait+edx]
+	jns	.test_patch
+	mov	esi, [eventptr+edx*4]
+	lodsw				; al = note, ah = rows to skip after it
+	mov	[eventptr+edx*4], esi
+	mov	[eventwait+edx], ah
+	and	byte [eventwait+edx], 0x7f
+	mov	edi, eax
+	and	edi, 0x7f
+	jz	.test_accent
+	movsx	ebp, byte [transpose+edx]
+	add	edi, ebp
+	mov	edi, [notetable+edi*4-NOTE_FIRST*4] ; phase increment for the note
+	mov	[pitch+edx*4], edi
+	mov	bl, [seqmask+edx]
+.test_accent:
+	test	ah, ah
+	jns	.test_noteoff
+	or	bl, FLAG_ACCENT
+.test_noteoff:
+	test	al, al
+	jns	.test_patch
+	or	bl, FLAG_NOTEOFF
+.test_patch:
+	or	bl, bh
+%else
 	mov	bl, byte [flags+edx] ; get flags to bl
         and     cl, 63
         jnz     .tick0_end
@@ -157,17 +322,9 @@ render_song:
 	lodsw
 	and	al, al
         jz      .test_accent
-;        fld     dword [midi0]
-movss xmm0, dword [midi0]
-.pitchmul:
-;        fmul    dword [midisemi]
-mulss xmm0, dword [midisemi]
-        dec     al
-        jnz     .pitchmul
-;        fdiv    dword [outputfreq]
-divss xmm0, [outputfreq]
-;        fstp    dword [pitch+edx*4]
-movss [pitch+edx*4], xmm0
+	movzx	edi, al
+	mov	edi, [notetable+edi*4-NOTE_FIRST*4] ; phase increment for the note
+	mov	[pitch+edx*4], edi
         mov     bl, [seqmask+edx]
 .test_accent:
 	xchg 	al, ah
@@ -181,10 +338,12 @@ movss [pitch+edx*4], xmm0
 .test_patch:
         and     al, 0x3f
         jz      .tick0_end
+	movzx	eax, al ; ah still has the note
         mov     ax, [patchstart+eax*2-2]
         lea     eax, [patchdata+eax*4]
         mov     [patchptr+edx*4], eax
 	or	bl, FLAG_LOAD_PATCH
+%endif
 .tick0_end:
         cmp     cl, 60
         jnz     .channel_done
@@ -193,7 +352,9 @@ movss [pitch+edx*4], xmm0
 	and	bl, FLAG_TRIG|FLAG_ACCENT
 .channel_done:
 	mov	[flags+edx], bl ; put flags back
+%ifndef SONG_EVENTS
 	add	esi, (SONG_LEN-1)*2
+%endif
         inc     edx
         cmp     edx, NUM_CHANNELS
 	jnz	.channel_loop
@@ -297,6 +458,7 @@ movss xmm7, dword [zero]
 ;mov word [songbuffer+ebx*2], dx
 
 	inc	ebx
+	mov	SONGBSS(renderpos), ebx
 	cmp	ebx, SONG_BUFFERLEN
 	jl	.sample_loop
 
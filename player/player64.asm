@@ -0,0 +1,787 @@
+;;
+;; Komposter player (c) 2010 Noora Halme et al. (see AUTHORS)
+;;
+;; This code is licensed under the MIT license:
+;; http://www.opensource.org/licenses/mit-license.php
+;;
+;; This is the x86-64 version of the reference playroutine. It plays
+;; the same song.inc as player.asm, but runs the modules on scalar SSE
+;; instead of the x87 stack. render_song can be called from C.
+;;
+;; The song data is addressed with 32-bit absolute offsets, so link
+;; the player into a non-PIE executable (gcc -no-pie).
+;;
+;; Define PACKED_VOICES to process the channels playing the same synth
+;; four at a time, one channel in each SSE lane (see modules64x4.asm).
+;; The output is the same as with the scalar loop.
+;;
+
+bits 64
+default rel
+
+; output sample rate
+%define 	OUTPUTFREQ	44100
+
+; how many samples of audio we're rendering, from the song length in
+; rows of 64 ticks
+%define		SONG_BUFFERLEN	(SONG_LEN*64*TICKDIVIDER)
+
+; maximum number of modules per synth. 64 means 256 bytes of modulator data per channel.
+%define		MAX_MODULES		64
+
+; delay buffer addresses are max. 18bit offsets
+%define 	DELAYBUFFERSIZE		262144
+
+
+; flags in voice data byte
+%define		FLAG_GATE		1
+%define		FLAG_TRIG		2
+%define		FLAG_ACCENT		4
+%define		FLAG_NOTEOFF		8
+%define		FLAG_RESTART_ENV	16
+%define		FLAG_RESTART_VCO	32
+%define		FLAG_RESTART_LFO	64
+%define		FLAG_LOAD_PATCH		128
+
+
+
+;
+; DATA
+;
+section .data
+
+; include the song itself from an external file
+%include "song.inc"
+
+; the same module selection as in player.asm
+%ifndef USE_MODULES
+%define USE_MODULE_kbd
+%define USE_MODULE_env
+%define USE_MODULE_vco
+%define USE_MODULE_lfo
+%define USE_MODULE_cv
+%define USE_MODULE_amp
+%define USE_MODULE_mixer
+%define USE_MODULE_vcf
+%define USE_MODULE_lpf24
+%define USE_MODULE_delay
+%define USE_MODULE_att
+%define USE_MODULE_resample
+%define USE_MODULE_supersaw
+%define USE_MODULE_dist
+%define USE_MODULE_accent
+%define USE_MODULE_output
+%endif
+
+; code and data shared between modules
+%ifdef USE_MODULE_accent
+%define USE_MODULE_amp		; accent falls through to amp
+%endif
+%ifdef USE_MODULE_env
+%define USE_HARDRESTART
+%endif
+%ifdef USE_MODULE_vco
+%define USE_HARDRESTART
+%define USE_HALF
+%define USE_SIN
+%endif
+%ifdef USE_MODULE_lfo
+%define USE_HARDRESTART
+%define USE_HALF
+%define USE_SIN
+%endif
+%ifdef USE_MODULE_vcf
+%define USE_HALF
+%define USE_SIN
+%endif
+
+; length of the songbuffer in samples
+global songlength
+songlength	dd	SONG_BUFFERLEN
+
+noise_x1	dd	0x67452301
+noise_x2	dd	0xefcdab89
+%ifdef USE_MODULE_vco
+noise_div	dd	4294967296.0
+%endif
+
+; small constants used around the code
+zero		dd	0.0
+one		dd	1.0
+minus_one	dd	-1.0
+%ifdef USE_HALF
+half		dd	0.5
+%endif
+%ifdef USE_MODULE_vco
+threefourths	dd	0.75
+four		dd	4.0
+%endif
+
+; taylor series of sin(x) to the 11th power for x in [-pi/2, pi/2],
+; highest power first
+%ifdef USE_SIN
+quarter		dd	0.25
+minus_quarter	dd	-0.25
+minus_half	dd	-0.5
+twopi		dd	6.2831853
+sin_coef	dd	-2.5052108e-8, 2.7557319e-6, -1.9841270e-4
+		dd	8.3333333e-3, -1.6666667e-1, 1.0
+%endif
+
+; these are for the 24db/oct lpf
+%ifdef USE_MODULE_lpf24
+three_point_foureight   dd      3.48
+minus_point_onefive     dd      -0.15
+lpf_feedback_coef       dd      0.35013
+point_three             dd      0.3
+%endif
+
+
+
+; jump table to module functions, zero for the modules left out
+%macro modfunc 1
+%ifdef USE_MODULE_%1
+	dq	module_func_%1
+%else
+	dq	0
+%endif
+%endmacro
+
+modfunctable:
+	modfunc	kbd
+	modfunc	env
+	modfunc	vco
+	modfunc	lfo
+	modfunc	cv
+	modfunc	amp
+	modfunc	mixer
+	modfunc	vcf
+	modfunc	lpf24
+	modfunc	delay
+	modfunc	att
+	modfunc	resample
+	modfunc	supersaw
+	modfunc	dist
+	modfunc	accent
+	modfunc	output
+
+%ifdef PACKED_VOICES
+; packed module functions, with lanes_func running the scalar module on
+; each lane for the modules that have no packed version
+%macro packfunc 1
+%ifdef USE_MODULE_%1
+	dq	packed_func_%1
+%else
+	dq	0
+%endif
+%endmacro
+%macro lanefunc 1
+%ifdef USE_MODULE_%1
+	dq	lanes_func
+%else
+	dq	0
+%endif
+%endmacro
+
+packfunctable:
+	packfunc	kbd
+	packfunc	env
+	packfunc	vco
+	packfunc	lfo
+	packfunc	cv
+	packfunc	amp
+	packfunc	mixer
+	packfunc	vcf
+	lanefunc	lpf24
+	lanefunc	delay
+	packfunc	att
+	packfunc	resample
+	lanefunc	supersaw
+	packfunc	dist
+	packfunc	accent
+	packfunc	output
+
+; the constants above four times over for the packed modules
+align 16
+one4		times 4 dd 1.0
+minus_one4	times 4 dd -1.0
+signmask4	times 4 dd 0x80000000
+absmask4	times 4 dd 0x7fffffff
+int1_4		times 4 dd 1
+int2_4		times 4 dd 2
+int3_4		times 4 dd 3
+%ifdef USE_HALF
+half4		times 4 dd 0.5
+%endif
+%ifdef USE_MODULE_vco
+threefourths4	times 4 dd 0.75
+four4		times 4 dd 4.0
+noise_div4	times 4 dd 4294967296.0
+%endif
+%ifdef USE_SIN
+quarter4	times 4 dd 0.25
+minus_quarter4	times 4 dd -0.25
+minus_half4	times 4 dd -0.5
+twopi4		times 4 dd 6.2831853
+sin_coef4	times 4 dd -2.5052108e-8
+		times 4 dd 2.7557319e-6
+		times 4 dd -1.9841270e-4
+		times 4 dd 8.3333333e-3
+		times 4 dd -1.6666667e-1
+		times 4 dd 1.0
+%endif
+%endif
+
+;
+; BSS
+;
+section .bss
+
+sample		resd	1
+
+moddata		resd	NUM_CHANNELS*MAX_MODULES*32 ; output,mod,moddata*16,reserved*14
+
+pitch		resd	NUM_CHANNELS
+flags		resb	NUM_CHANNELS
+patchptr	resd	NUM_CHANNELS
+
+%ifdef NOTE_OCTAVE
+notetable	resd	NOTE_COUNT ; expanded from the octave in noteoctave
+%endif
+
+%ifdef SONG_EVENTS
+; sequencer state for each channel
+orderpos	resd	NUM_CHANNELS ; next order list entry, zero before the first
+eventptr	resd	NUM_CHANNELS ; next note event in the pattern
+rowsleft	resw	NUM_CHANNELS ; rows left in the pattern pass
+repeatsleft	resb	NUM_CHANNELS ; passes left of the pattern
+eventwait	resb	NUM_CHANNELS ; rows to skip before the next event
+chpattern	resb	NUM_CHANNELS ; pattern playing on the channel
+transpose	resb	NUM_CHANNELS
+%endif
+
+%ifdef PACKED_VOICES
+; channels playing the same synth are grouped four to a lane vector.
+; unused lanes repeat the first channel of the group
+groupcount	resd	1
+grouplanes	resd	NUM_CHANNELS ; channels in the group
+groupsynth	resd	NUM_CHANNELS ; start of the synth in modtypes
+groupchan	resd	NUM_CHANNELS*4 ; channel in each lane
+groupnoise	resd	NUM_CHANNELS*4 ; noise offset of each lane
+changroup	resb	NUM_CHANNELS ; nonzero once the channel is in a group
+chnoise		resd	NUM_CHANNELS ; modules before the channel's synth
+chanout		resd	NUM_CHANNELS ; output of each channel for the mix
+%ifdef USE_MODULE_vco
+; noise generator state before each module the scalar loop would run
+noisecount	resd	1
+noisebuf	resd	NUM_CHANNELS*MAX_MODULES
+%endif
+laneflags	resb	4
+
+alignb 16
+; flags of the current group as lane masks
+lanegate	resd	4
+laneaccent	resd	4
+lanerenv	resd	4
+lanervco	resd	4
+lanerlfo	resd	4
+lanepitch	resd	4
+lanenoise	resd	4
+; scratch for lanes_func
+lanein		resd	16
+laneout		resd	4
+; output, modulator and 480 bytes of state per module and group
+packdata	resb	NUM_CHANNELS*MAX_MODULES*512
+%endif
+
+delaycount	resb	1
+delaybuffer	resd	NUM_DELAYS*DELAYBUFFERSIZE
+
+global songbuffer
+songbuffer	resw	SONG_BUFFERLEN
+
+; samples rendered so far, for playing or showing progress while
+; render_song runs on another thread
+global renderpos
+renderpos	resd	1
+
+
+
+;
+; TEXT
+;
+section .text
+
+
+; code for the synth modules
+%include "modules64.asm"
+%ifdef PACKED_VOICES
+%include "modules64x4.asm"
+%endif
+
+
+%ifdef PACKED_VOICES
+; sets lane rcx of vector %2 to all ones if bit %1 of the flags in eax is set
+%macro lanemask 2
+	mov	r8d, eax
+	shl	r8d, 31-%1
+	sar	r8d, 31
+	mov	[%2+rcx*4], r8d
+%endmacro
+%endif
+
+
+; this function renders the actual audio into the songbuffer in BSS
+; with SONG_BUFFERLEN samples
+global render_song
+render_song:
+	push	rbx
+	push	rbp
+	push	r12
+	push	r13
+	push	r14
+	push	r15
+
+%ifdef NOTE_OCTAVE
+	; the note table is stored for the lowest octave, double it for
+	; the octaves above
+	mov	esi, noteoctave
+	mov	edi, notetable
+	mov	ecx, NOTE_OCTAVE
+	rep	movsd
+%if NOTE_COUNT > NOTE_OCTAVE
+	mov	cl, NOTE_COUNT-NOTE_OCTAVE
+.note_octaves:
+	movss	xmm0, [rdi-12*4]
+	addss	xmm0, xmm0
+	movss	[rdi], xmm0
+	add	rdi, 4
+	loop	.note_octaves
+%endif
+%endif
+
+%ifdef PACKED_VOICES
+%ifdef USE_MODULE_vco
+	; count the modules the scalar loop would run before each channel
+	; to find the noise each vco lane sees
+	xor	ecx, ecx
+	xor	r8d, r8d
+.noise_init:
+	mov	[chnoise+rcx*4], r8d
+	movzx	eax, byte [seqvoice+rcx]
+	movzx	eax, byte [synthstart+rax*2]
+.noise_count:
+	inc	r8d
+	cmp	byte [modtypes+rax], 0fh
+	lea	rax, [rax+1]
+	jnz	.noise_count
+	inc	ecx
+	cmp	ecx, NUM_CHANNELS
+	jb	.noise_init
+	mov	[noisecount], r8d
+%endif
+
+	; group the channels by synth, up to four to a group
+	xor	ecx, ecx
+.group_chan:
+	cmp	byte [changroup+rcx], 0
+	jnz	.group_next
+	mov	r9d, [groupcount]
+	inc	dword [groupcount]
+	movzx	eax, byte [seqvoice+rcx]
+	movzx	r10d, byte [synthstart+rax*2]
+	mov	[groupsynth+r9*4], r10d
+	xor	r11d, r11d ; r11 = lanes used
+	mov	edx, ecx
+.group_lane:
+	cmp	byte [changroup+rdx], 0
+	jnz	.group_skip
+	cmp	al, [seqvoice+rdx]
+	jnz	.group_skip
+	mov	byte [changroup+rdx], 1
+	lea	r10, [r11+r9*4]
+	mov	[groupchan+r10*4], edx
+	mov	r8d, [chnoise+rdx*4]
+	mov	[groupnoise+r10*4], r8d
+	inc	r11d
+	cmp	r11d, 4
+	jz	.group_full
+.group_skip:
+	inc	edx
+	cmp	edx, NUM_CHANNELS
+	jb	.group_lane
+.group_full:
+	mov	[grouplanes+r9*4], r11d
+	lea	r10, [r9*4]
+	mov	r8d, [groupchan+r10*4]
+	mov	edx, [groupnoise+r10*4]
+.group_pad:
+	cmp	r11d, 4
+	jz	.group_next
+	lea	r10, [r11+r9*4]
+	mov	[groupchan+r10*4], r8d
+	mov	[groupnoise+r10*4], edx
+	inc	r11d
+	jmp	.group_pad
+.group_next:
+	inc	ecx
+	cmp	ecx, NUM_CHANNELS
+	jb	.group_chan
+%endif
+
+	; start the loop to fill the outputbuffer with rendered audio
+	xor	ebx, ebx ; ebx = sample number
+.sample_loop:
+	push	rbx ; save sample number
+	xor	edx, edx
+	mov	eax, ebx
+	idiv	dword [tickdivider]
+	and	edx, edx
+	jnz 	.synth
+	mov	ecx, eax ; tick number in ecx
+%ifndef SONG_EVENTS
+	shr	eax, 6 ; songpos is tick/64
+	add	eax, eax
+	lea	esi, [songdata+rax]
+%endif
+
+	; play notes
+	xor	edx, edx
+.channel_loop:
+%ifdef SONG_EVENTS
+	movzx	ebx, byte [flags+rdx] ; get flags to bl, bh gets the patch load flag
+        and     cl, 63
+        jnz     .tick0_end
+
+	; a new row. start the next pass of the pattern or the next entry
+	; on the order list if this one is over
+	dec	word [rowsleft+rdx*2]
+	jns	.next_event
+	dec	byte [repeatsleft+rdx]
+	jns	.pattern_start
+	mov	esi, [orderpos+rdx*4]
+	and	esi, esi
+	jnz	.order_entry
+	mov	esi, [orderlist+rdx*4]
+.order_entry:
+	lodsb
+	mov	[chpattern+rdx], al
+	lodsb
+	mov	[repeatsleft+rdx], al
+	lodsb
+	mov	[transpose+rdx], al
+	xor	eax, eax
+	lodsb
+	mov	[orderpos+rdx*4], esi
+	and	al, al
+	jz	.pattern_start
+	mov	ax, [patchstart+rax*2-2]
+	lea	eax, [patchdata+rax*4]
+	mov	[patchptr+rdx*4], eax
+	mov	bh, FLAG_LOAD_PATCH
+.pattern_start:
+	movzx	eax, byte [chpattern+rdx]
+	movzx	esi, word [patternstart+rax*2]
+	add	esi, patterns
+	movzx	eax, byte [patternlen+rax]
+	shl	eax, 4
+	dec	eax
+	mov	[rowsleft+rdx*2], ax
+	lodsb				; rows to skip before the first event
+	mov	[eventwait+rdx], al
+	mov	[eventptr+rdx*4], esi
+
+	; play the next event once its row comes up
+.next_event:
+	dec	byte [eventwait+rdx]
+	jns	.test_patch
+	mov	esi, [eventptr+rdx*4]
+	lodsw				; al = note, ah = rows to skip after it
+	mov	[eventptr+rdx*4], esi
+	mov	[eventwait+rdx], ah
+	and	byte [eventwait+rdx], 0x7f
+	mov	edi, eax
+	and	edi, 0x7f
+	jz	.test_accent
+	movsx	ebp, byte [transpose+rdx]
+	add	edi, ebp
+	mov	edi, [notetable+rdi*4-NOTE_FIRST*4] ; phase increment for the note
+	mov	[pitch+rdx*4], edi
+	mov	bl, [seqmask+rdx]
+.test_accent:
+	test	ah, ah
+	jns	.test_noteoff
+	or	bl, FLAG_ACCENT
+.test_noteoff:
+	test	al, al
+	jns	.test_patch
+	or	bl, FLAG_NOTEOFF
+.test_patch:
+	or	bl, bh
+%else
+	mov	bl, byte [flags+rdx] ; get flags to bl
+        and     cl, 63
+        jnz     .tick0_end
+	xor	eax, eax
+	lodsw
+	and	al, al
+        jz      .test_accent
+	movzx	edi, al
+	mov	edi, [notetable+rdi*4-NOTE_FIRST*4] ; phase increment for the note
+	mov	[pitch+rdx*4], edi
+        mov     bl, [seqmask+rdx]
+.test_accent:
+	xchg 	al, ah
+	test	al, 0x40
+        jz      .test_noteoff
+	or	bl, FLAG_ACCENT
+.test_noteoff:
+	test 	al, 0x80
+        jz      .test_patch
+	or	bl, FLAG_NOTEOFF
+.test_patch:
+        and     al, 0x3f
+        jz      .tick0_end
+	movzx	eax, al ; ah still has the note
+        mov     ax, [patchstart+rax*2-2]
+        lea     eax, [patchdata+rax*4]
+        mov     [patchptr+rdx*4], eax
+	or	bl, FLAG_LOAD_PATCH
+%endif
+.tick0_end:
+        cmp     cl, 60
+        jnz     .channel_done
+	test	bl, FLAG_NOTEOFF
+        jz      .channel_done
+	and	bl, FLAG_TRIG|FLAG_ACCENT
+.channel_done:
+	mov	[flags+rdx], bl ; put flags back
+%ifndef SONG_EVENTS
+	add	esi, (SONG_LEN-1)*2
+%endif
+        inc     edx
+        cmp     edx, NUM_CHANNELS
+	jnz	.channel_loop
+
+	; process synthesizer voices. the loop keeps its state in the
+	; registers the modules leave alone:
+	;
+	; r12 = voice
+	; r13 = module index within the synth
+	; r14 = moddata of the module
+	; r15 = moddata of the voice
+	; rbp = start of the synth in modtypes and modinputs
+	; rbx = module type
+.synth:
+%ifdef PACKED_VOICES
+%ifdef USE_MODULE_vco
+	; run the noise generator ahead for the whole sample
+	mov	eax, [noise_x1]
+	mov	r8d, [noise_x2]
+	xor	ecx, ecx
+.noise_loop:
+	mov	[noisebuf+rcx*4], r8d
+	xor	eax, r8d
+	add	r8d, eax
+	inc	ecx
+	cmp	ecx, [noisecount]
+	jb	.noise_loop
+	mov	[noise_x1], eax
+	mov	[noise_x2], r8d
+%endif
+
+	; the same loop a group at a time with r12 = group, r15 = packdata
+	; of the group and 512 bytes per module
+	xor	r12d, r12d
+.group_loop:
+	mov	ebp, [groupsynth+r12*4]
+	mov	r15d, r12d
+	shl	r15d, 15
+	lea	r15, [packdata+r15]
+
+	; turn the lane flags into masks, and load the patches
+	xor	ecx, ecx
+.lane_loop:
+	lea	rax, [rcx+r12*4]
+	mov	edx, [groupchan+rax*4]
+	mov	eax, [pitch+rdx*4]
+	mov	[lanepitch+rcx*4], eax
+	movzx	eax, byte [flags+rdx]
+	mov	[laneflags+rcx], al
+	lanemask	0, lanegate
+	lanemask	2, laneaccent
+	lanemask	4, lanerenv
+	lanemask	5, lanervco
+	lanemask	6, lanerlfo
+	test	al, FLAG_LOAD_PATCH
+	jz	.lane_next
+	mov	edx, [patchptr+rdx*4]
+	lea	rdi, [r15+16+rcx*4]
+	lea	rsi, [modtypes+rbp]
+.lane_patch:
+	mov	r8d, [rdx]
+	mov	[rdi], r8d
+	add	rdx, 4
+	add	rdi, 512
+	lodsb
+	cmp	al, 0fh
+	jnz	.lane_patch
+.lane_next:
+	inc	ecx
+	cmp	ecx, 4
+	jb	.lane_loop
+
+	xor	r13d, r13d
+	mov	r14, r15
+.pmod_loop:
+	lea	rax, [rbp+r13]
+	mov	eax, [modinputs+rax*4]
+	movzx	ecx, al
+	shl	ecx, 9
+	movaps	xmm3, [r15+rcx]
+	movzx	ecx, ah
+	shl	ecx, 9
+	movaps	xmm2, [r15+rcx]
+	shr	eax, 16
+	movzx	ecx, al
+	shl	ecx, 9
+	movaps	xmm1, [r15+rcx]
+	movzx	ecx, ah
+	shl	ecx, 9
+	movaps	xmm0, [r15+rcx]
+
+	lea	rax, [rbp+r13]
+	movzx	ebx, byte [modtypes+rax]
+	movaps	xmm4, [r14+16]
+	mov	rsi, r14
+	call	[packfunctable+rbx*8]
+	movaps	[r14], xmm0
+
+	inc	r13d
+	add	r14, 512
+	cmp	bl, 0fh
+	jnz	.pmod_loop
+
+	; hand the lanes in use to their channels
+	xor	ecx, ecx
+.group_out:
+	lea	rax, [rcx+r12*4]
+	mov	edx, [groupchan+rax*4]
+	mov	eax, [r14-512+rcx*4]
+	mov	[chanout+rdx*4], eax
+	inc	ecx
+	cmp	ecx, [grouplanes+r12*4]
+	jb	.group_out
+
+	inc	r12d
+	cmp	r12d, [groupcount]
+	jb	.group_loop
+
+	; mix the channels in the scalar loop's order
+	xorps	xmm0, xmm0
+	xor	edx, edx
+.mix_loop:
+	addss	xmm0, [chanout+rdx*4]
+	and	byte [flags+rdx], 0x0f ; clear hard restart flags
+	inc	edx
+	cmp	edx, NUM_CHANNELS
+	jb	.mix_loop
+	movss	[sample], xmm0
+%else
+	xor	r12d, r12d ; r12=voice
+	mov	[sample], r12d ; set mixed sample to zero
+
+.voice_loop:
+	movzx	ebp, byte [seqvoice+r12]
+	movzx	ebp, byte [synthstart+rbp*2]
+
+	xor	r13d, r13d
+	mov	r15d, r12d
+	shl 	r15d, 13 ; 8192 bytes per channel, 128 bytes per module
+	lea 	r15, [moddata+r15] ; r15 = start of moddata for this channel
+	mov	r14, r15
+.mod_process_loop:
+	; load a new patch?
+	test	byte [flags+r12], FLAG_LOAD_PATCH
+	jz	.mod_process_prepare
+	; load value from patch to modulator
+	mov	eax, [patchptr+r12*4]
+	mov	eax, [rax+r13*4]
+	mov	[r14+4], eax
+
+	; collect input signal voltages, ms[0] is wired from the last byte
+.mod_process_prepare:
+	lea	rax, [rbp+r13]
+	mov	eax, [modinputs+rax*4]
+	movzx	ecx, al
+	shl	ecx, 7
+	movss	xmm3, [r15+rcx] ; output at offset 0
+	movzx	ecx, ah
+	shl	ecx, 7
+	movss	xmm2, [r15+rcx]
+	shr	eax, 16
+	movzx	ecx, al
+	shl	ecx, 7
+	movss	xmm1, [r15+rcx]
+	movzx	ecx, ah
+	shl	ecx, 7
+	movss	xmm0, [r15+rcx]
+
+	lea	rax, [rbp+r13]
+	movzx	ebx, byte [modtypes+rax] ; ebx=module type [0..127]
+	movss	xmm4, [r14+4]		; xmm4 = modulator
+	mov 	eax, [r14+4]		; eax = modulator as integer
+	mov	cl, [flags+r12]		; cl = flags
+	mov	edx, r12d		; edx = voice
+	lea 	rsi, [r14+8]		; rsi = data area starts at +8
+	call 	[modfunctable+rbx*8]
+	movss 	[r14], xmm0 ; store output
+
+	; update noise generator on each module loop
+	mov	eax, [noise_x1]
+	xor	eax, [noise_x2]
+	add	[noise_x2], eax
+	mov	[noise_x1], eax
+
+	; next module
+	inc	r13d
+	sub 	r14, byte -128
+	cmp	bl, 0fh
+	jnz	.mod_process_loop
+.mod_process_end:
+	and	byte [flags+r12], 0x0f ; clear hard restart flags
+
+	addss	xmm0, [sample]          ; mix previous channels in
+	movss	[sample], xmm0
+
+	inc	r12d			; next voice
+	cmp	r12d, NUM_CHANNELS
+	jl	.voice_loop
+%endif
+	; all voices done, sample now has the final channel mix
+
+	pop	rbx ; restore sample number
+	movss	xmm0, [sample]
+	mulss	xmm0, [samplemul]
+	cvtps2dq xmm0, xmm0		; round to nearest
+	packssdw xmm0, xmm0		; and saturate to 16 bits
+	movd	eax, xmm0
+	mov	[songbuffer+rbx*2], ax
+
+	inc	ebx
+	mov	[renderpos], ebx
+	cmp	ebx, SONG_BUFFERLEN
+	jl	.sample_loop
+
+	;done, the buffer is now full of music. :)
+	pop	r15
+	pop	r14
+	pop	r13
+	pop	r12
+	pop	rbp
+	pop	rbx
+	ret
+
+;;
+;; eof
+;;
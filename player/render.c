@@ -0,0 +1,136 @@
+/*
+ * Komposter player (c) 2010 Noora Halme et al. (see AUTHORS)
+ *
+ * This code is licensed under the MIT license:
+ * http://www.opensource.org/licenses/mit-license.php
+ *
+ * Renders the song linked in with player.o or player64.o, or with the
+ * C player in kplayer.c when built with -DKPLAYER, prints the time it
+ * took and optionally writes the 16-bit mono samples to a file. Used for
+ * benchmarking and validating the players against each other.
+ *
+ * Built with -DKENGINE it renders a .ksong given as the first argument
+ * with the editor's engine instead, to compare the players against it.
+ * With -e it plays back the knob turns saved by the editor to a .kprm
+ * file over the render run they were recorded in.
+ *
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#ifdef KPLAYER
+#include <stdlib.h>
+#include <math.h>
+#include "kplayer.h"
+
+#define BLOCKLEN 4096
+
+static short *songbuffer;
+static int songlength;
+
+// stream the song out in blocks and convert to 16 bits like the players do
+static void render_song(void)
+{
+  float block[BLOCKLEN];
+  long s;
+  int i, n, pos=0;
+
+  songlength=kplayer_length();
+  songbuffer=malloc(songlength*sizeof(short));
+  kplayer_init();
+  while ((n=kplayer_render(block, BLOCKLEN))>0) {
+    for(i=0;i<n;i++) {
+      s=lrintf(block[i]*32768.0f);
+      songbuffer[pos++]=(s>32767) ? 32767 : (s<-32768) ? -32768 : s;
+    }
+  }
+}
+#elif defined(KENGINE)
+#include <stdlib.h>
+#include <string.h>
+#include "engine.h"
+
+static short *songbuffer;
+static int songlength;
+static char *songfile, *editfile;
+
+// the engine renders in stereo with both channels the same
+static void render_song(void)
+{
+  kengine *e;
+  kparam *edits=NULL;
+  short *stereo;
+  long i, frames;
+  int start=0, measures, n;
+
+  e=engine_new();
+  if (!e || engine_load(e, songfile)) {
+    fprintf(stderr, "failed to load %s\n", songfile);
+    exit(1);
+  }
+  measures=engine_songlength(e);
+  if (editfile) {
+    if (engine_loadparams(editfile, &start, &measures, &edits, &n)) {
+      fprintf(stderr, "failed to load %s\n", editfile);
+      exit(1);
+    }
+    engine_replay(e, edits, n);
+  }
+  frames=engine_start(e, start, measures);
+  stereo=(frames<0) ? NULL : malloc(frames*4);
+  songbuffer=(frames<0) ? NULL : malloc(frames*sizeof(short));
+  if (!stereo || !songbuffer) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  engine_render(e, stereo, frames);
+  for(i=0;i<frames;i++) songbuffer[i]=stereo[i*2];
+  songlength=frames;
+  free(stereo);
+  engine_free(e);
+  free(edits);
+}
+#else
+// from player.asm
+extern short songbuffer[];
+extern int songlength;
+void render_song(void);
+#endif
+
+int main(int argc, char **argv)
+{
+  struct timespec t0, t1;
+  FILE *f;
+
+#ifdef KENGINE
+  if (argc>2 && !strcmp(argv[1], "-e")) {
+    editfile=argv[2];
+    argc-=2; argv+=2;
+  }
+  if (argc<2) {
+    fprintf(stderr, "usage: renderk [-e edits.kprm] song.ksong [output.raw]\n");
+    return 1;
+  }
+  songfile=argv[1];
+  argc--; argv++;
+#endif
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+#if defined(KPLAYER) || defined(KENGINE) || defined(__x86_64__)
+  render_song();
+#else
+  // the 32-bit player doesn't preserve any registers or the fpu stack
+  __asm__ __volatile__ ("push %%ebp\n\tcall render_song\n\tpop %%ebp\n\tfninit"
+    : : : "eax", "ebx", "ecx", "edx", "esi", "edi", "memory");
+#endif
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  printf("%.3f\n", (t1.tv_sec-t0.tv_sec) + (t1.tv_nsec-t0.tv_nsec)/1e9);
+
+  if (argc>1) {
+    f=fopen(argv[1], "wb");
+    if (!f) { perror(argv[1]); return 1; }
+    fwrite(songbuffer, 2, songlength, f);
+    fclose(f);
+  }
+  return 0;
+}
@@ -0,0 +1,383 @@
+/*
+ * Komposter
+ *
+ * Copyright (c) 2010 Noora Halme et al. (see AUTHORS)
+ *
+ * This code is licensed under the GNU General Public
+ * License version 2. See LICENSE for full text.
+ *
+ * Modulator precision search. Truncates the float modulators of the
+ * patches used in a song to as few bits as the rendered error bound
+ * allows, to make the patch data smaller and pack better in an intro
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "engine.h"
+
+// fewest bits the editor lets a modulator have, which leaves the sign,
+// exponent and three bits of mantissa
+#define PREC_MINBITS	12
+
+// frames rendered between looks at the error so far
+#define PREC_BLOCK	4096
+
+// times the error budget of each modulator is halved when the
+// modulators truncated together miss the bound
+#define PREC_ROUNDS	8
+
+// a float modulator of a patch used in the song
+typedef struct {
+  int synth, patch, module;
+  unsigned char *value;	// value and quantifier in the song image
+  unsigned char *quant;
+  u32 orig;	// value as stored
+  int origbits;	// quantifier as stored
+  int bits;	// quantifier found by the search
+  int renders;
+} precjob;
+
+// the song as loaded
+unsigned char *songdata;
+long songlen;
+int measures;
+
+// reference render of the song and the error bound
+short *reference;
+long frames;
+double signalenergy;
+double maxnoise;	// noise energy allowed for the snr bound, or < 0
+double maxpeak;		// peak error allowed in 16-bit steps, or < 0
+
+precjob *jobs;
+int jobcount;
+int nextjob;
+double budget;	// fraction of the bound each modulator may use
+pthread_mutex_t prec_lock=PTHREAD_MUTEX_INITIALIZER;
+
+
+// value truncated to the top bits
+static u32 prec_truncate(u32 v, int bits)
+{
+  return bits>=32 ? v : v & (0xffffffff << (32-bits));
+}
+
+static float prec_float(u32 v)
+{
+  float f;
+
+  memcpy(&f, &v, sizeof(float));
+  return f;
+}
+
+
+// render the song and measure the noise energy and peak error against the
+// reference. stops early and returns -1 once the error is over the bound
+// times the budget, otherwise 0
+static int prec_measure(kengine *e, short *buf, double budget, double *noise, double *peak)
+{
+  long pos, n, i;
+  double d;
+
+  *noise=0; *peak=0;
+  if (engine_start(e, 0, measures)<0) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  for(pos=0;pos<frames;pos+=n) {
+    n=frames-pos;
+    if (n>PREC_BLOCK) n=PREC_BLOCK;
+    engine_render(e, buf, n);
+
+    // the output is mono duplicated to both channels
+    for(i=0;i<n;i++) {
+      d=buf[i*2] - reference[(pos+i)*2];
+      *noise+=d*d;
+      if (fabs(d) > *peak) *peak=fabs(d);
+    }
+    if (maxnoise>=0 && *noise > maxnoise*budget) return -1;
+    if (maxpeak>=0 && *peak > maxpeak*budget) return -1;
+  }
+  return 0;
+}
+
+
+// binary search the fewest bits that keep the error within the budget.
+// assumes that the error grows as bits are taken away
+static void prec_search(kengine *e, short *buf, precjob *j, double budget)
+{
+  float *v=&e->modvalue[j->synth][j->patch][j->module];
+  double noise, peak;
+  u32 t;
+  int lo, hi, mid, ok;
+
+  lo=PREC_MINBITS; hi=j->origbits;
+  while (lo<hi) {
+    mid=(lo+hi)/2;
+    t=prec_truncate(j->orig, mid);
+    if (t==j->orig) {
+      ok=1; // the value fits in mid bits as it is
+    } else {
+      *v=prec_float(t);
+      ok=!prec_measure(e, buf, budget, &noise, &peak);
+      j->renders++;
+    }
+    if (ok) hi=mid; else lo=mid+1;
+  }
+  *v=prec_float(j->orig);
+  j->bits=hi;
+}
+
+
+// worker thread searching modulators one at a time on its own engine
+static void *prec_worker(void *param)
+{
+  kengine *e;
+  short *buf;
+  int i;
+
+  e=engine_new();
+  buf=malloc(PREC_BLOCK*4);
+  if (!e || !buf || engine_loadmem(e, songdata, songlen)) {
+    fprintf(stderr, "worker failed to load the song\n");
+    exit(1);
+  }
+
+  for(;;) {
+    pthread_mutex_lock(&prec_lock);
+    i=nextjob++;
+    pthread_mutex_unlock(&prec_lock);
+    if (i>=jobcount) break;
+    prec_search(e, buf, &jobs[i], budget);
+  }
+  free(buf);
+  engine_free(e);
+  return NULL;
+}
+
+
+static void prec_run(int threads)
+{
+  pthread_t *tid;
+  int i;
+
+  tid=malloc(threads*sizeof(pthread_t));
+  nextjob=0;
+  for(i=0;i<threads;i++) {
+    if (pthread_create(&tid[i], NULL, prec_worker, NULL)) { perror("pthread_create"); exit(1); }
+  }
+  for(i=0;i<threads;i++) pthread_join(tid[i], NULL);
+  free(tid);
+}
+
+
+
+
+//
+// song image
+//
+
+// find the float modulators of the patches loaded during the song and
+// where their values and quantifiers are in the image
+static int prec_findjobs(kengine *e)
+{
+  unsigned char used[MAX_SYNTH][MAX_PATCHES];
+  unsigned char *c;
+  long pos;
+  u32 chunklen, np, sl;
+  int ch, i, s, p, m, mi, mt, q;
+
+  // every voice starts with patch 0 and loads the rest from the timeline
+  memset(used, 0, sizeof(used));
+  if (engine_start(e, 0, measures)<0) return -1;
+  for(ch=0;ch<e->seqch;ch++) {
+    used[e->seq_synth[ch]][0]=1;
+    for(i=0;i<e->eventcount[ch];i++)
+      if (e->events[ch][i].type==EVENT_PATCH) used[e->seq_synth[ch]][e->events[ch][i].value]=1;
+  }
+
+  jobs=calloc(MAX_SYNTH*MAX_PATCHES*MAX_MODULES, sizeof(precjob));
+  if (!jobs) return -1;
+  jobcount=0;
+
+  // walk the chunks, the banks are numbered in the order they appear
+  s=0;
+  for(pos=16;pos+8<=songlen-4;pos+=8+chunklen) {
+    c=&songdata[pos];
+    memcpy(&chunklen, &c[4], sizeof(u32));
+    if (memcmp(c, "KBNK", 4)) continue;
+    memcpy(&np, &c[8], sizeof(u32));
+    memcpy(&sl, &c[12], sizeof(u32));
+    for(p=0;p<np;p++) {
+      if (!used[s][p]) continue;
+      for(m=0;m<MAX_MODULES && e->signalfifo[s][m]>=0;m++) {
+        mi=e->signalfifo[s][m];
+        mt=e->mod[s][mi].type;
+        if (mi>=sl || modModulatorTypes[mt]!=1) continue;
+        jobs[jobcount].synth=s;
+        jobs[jobcount].patch=p;
+        jobs[jobcount].module=mi;
+        jobs[jobcount].value=&c[16 + p*(128+3*sl*4) + 128 + sl*4 + mi*4];
+        jobs[jobcount].quant=&c[16 + p*(128+3*sl*4) + 128 + sl*8 + mi*4];
+        memcpy(&jobs[jobcount].orig, jobs[jobcount].value, sizeof(u32));
+        memcpy(&q, jobs[jobcount].quant, sizeof(u32));
+        jobs[jobcount].origbits=(q<PREC_MINBITS || q>32) ? 32 : q;
+        jobcount++;
+      }
+    }
+    s++;
+  }
+  return 0;
+}
+
+
+static int prec_load(const char *filename)
+{
+  FILE *f;
+
+  f=fopen(filename, "rb");
+  if (!f) { perror(filename); return -1; }
+  fseek(f, 0, SEEK_END);
+  songlen=ftell(f);
+  fseek(f, 0, SEEK_SET);
+  songdata=malloc(songlen>0 ? songlen : 1);
+  if (!songdata || fread(songdata, 1, songlen, f)!=songlen) {
+    fprintf(stderr, "failed to read %s\n", filename);
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+  return 0;
+}
+
+
+static int prec_save(const char *filename)
+{
+  FILE *f;
+  u32 v, crc;
+  int i, q;
+
+  for(i=0;i<jobcount;i++) {
+    q=jobs[i].bits;
+    v=prec_truncate(jobs[i].orig, q);
+    memcpy(jobs[i].value, &v, sizeof(u32));
+    memcpy(jobs[i].quant, &q, sizeof(u32));
+  }
+  crc=engine_crc32(0, &songdata[8], songlen-12);
+  memcpy(&songdata[songlen-4], &crc, sizeof(u32));
+
+  f=fopen(filename, "wb");
+  if (!f) { perror(filename); return -1; }
+  if (fwrite(songdata, 1, songlen, f)!=songlen) { perror(filename); fclose(f); return -1; }
+  return fclose(f) ? -1 : 0;
+}
+
+
+
+
+static double prec_snr(double noise)
+{
+  return noise>0 ? 10*log10(signalenergy/noise) : INFINITY;
+}
+
+static void usage(void)
+{
+  fprintf(stderr,
+    "usage: komposter-precision [-s snr] [-p peak] [-j threads] [-o output.ksong] song.ksong\n"
+    "\n"
+    "  -s  smallest signal to error ratio in db (default 60)\n"
+    "  -p  largest peak error in dbfs, eg. -70 (default none)\n"
+    "  -j  number of search threads (default is one per cpu)\n"
+    "  -o  write the song with the truncated modulators\n");
+}
+
+
+int main(int argc, char **argv)
+{
+  char *outfile=NULL;
+  double snr=60, peakdb=0, noise, peak;
+  int c, threads, usepeak=0, round, i, r, renders, before, after;
+  kengine *e;
+  short *buf;
+
+  threads=sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads<1) threads=1;
+  while ((c=getopt(argc, argv, "s:p:j:o:h"))!=-1) {
+    switch(c) {
+      case 's': snr=atof(optarg); break;
+      case 'p': peakdb=atof(optarg); usepeak=1; break;
+      case 'j': threads=atoi(optarg); if (threads<1) threads=1; break;
+      case 'o': outfile=optarg; break;
+      default: usage(); return 1;
+    }
+  }
+  if (optind!=argc-1) { usage(); return 1; }
+  if (prec_load(argv[optind])) return 1;
+
+  e=engine_new();
+  if (!e) { fprintf(stderr, "out of memory\n"); return 1; }
+  r=engine_loadmem(e, songdata, songlen);
+  if (r) { fprintf(stderr, "failed to load %s (error %d)\n", argv[optind], r); return 1; }
+
+  // full precision reference
+  measures=engine_songlength(e);
+  frames=engine_start(e, 0, measures);
+  reference=(frames<0) ? NULL : malloc(frames*4);
+  buf=malloc(PREC_BLOCK*4);
+  if (!reference || !buf || prec_findjobs(e) || engine_start(e, 0, measures)<0) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  engine_render(e, reference, frames);
+  for(signalenergy=0,i=0;i<frames;i++) signalenergy+=(double)reference[i*2]*reference[i*2];
+
+  maxnoise=signalenergy/pow(10, snr/10);
+  maxpeak=usepeak ? 32767*pow(10, peakdb/20) : -1;
+  printf("%s: %ld frames, %d float modulators in the patches used\n", argv[optind], frames, jobcount);
+
+  // the errors of modulators truncated together add up, so search again
+  // with a tighter budget for each until all of them fit the bound
+  for(round=0,budget=1.0;round<PREC_ROUNDS;round++,budget*=0.5) {
+    prec_run(threads);
+    for(i=0;i<jobcount;i++)
+      e->modvalue[jobs[i].synth][jobs[i].patch][jobs[i].module]=prec_float(prec_truncate(jobs[i].orig, jobs[i].bits));
+    if (!prec_measure(e, buf, 1.0, &noise, &peak)) break;
+    printf("round %d: snr %.1f db, peak error %.1f dbfs over the bound, tightening\n",
+      round+1, prec_snr(noise), 20*log10(peak/32767));
+    for(i=0;i<jobcount;i++)
+      e->modvalue[jobs[i].synth][jobs[i].patch][jobs[i].module]=prec_float(jobs[i].orig);
+  }
+  if (round==PREC_ROUNDS) {
+    printf("no precision found within the bound, keeping the song as it is\n");
+    for(i=0;i<jobcount;i++) jobs[i].bits=jobs[i].origbits;
+    noise=0; peak=0;
+  } else {
+    // measure the whole song for the report
+    maxnoise=maxpeak=-1;
+    prec_measure(e, buf, 1.0, &noise, &peak);
+  }
+
+  for(i=0,renders=0,before=0,after=0;i<jobcount;i++) {
+    if (prec_truncate(jobs[i].orig, jobs[i].bits)!=jobs[i].orig) {
+      printf("synth %d patch %d module %d (%s): %d -> %d bits, %.9g -> %.9g\n",
+        jobs[i].synth, jobs[i].patch, jobs[i].module, e->mod[jobs[i].synth][jobs[i].module].label,
+        jobs[i].origbits, jobs[i].bits,
+        prec_float(jobs[i].orig), prec_float(prec_truncate(jobs[i].orig, jobs[i].bits)));
+    }
+    renders+=jobs[i].renders;
+    before+=jobs[i].origbits;
+    after+=jobs[i].bits;
+  }
+  printf("modulator bits %d -> %d after %d renders\n", before, after, renders);
+  printf("error: snr %.1f db, peak %.1f dbfs\n", prec_snr(noise), peak>0 ? 20*log10(peak/32767) : -INFINITY);
+
+  engine_free(e);
+  if (outfile && prec_save(outfile)) return 1;
+  return 0;
+}
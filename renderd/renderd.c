@@ -0,0 +1,424 @@
+/*
+ * Komposter
+ *
+ * Copyright (c) 2010 Noora Halme et al. (see AUTHORS)
+ *
+ * This code is licensed under the GNU General Public
+ * License version 2. See LICENSE for full text.
+ *
+ * Render daemon with an on-disk cache of rendered songs
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "engine.h"
+#include "renderd.h"
+#include "rtlog.h"
+
+// pending connections waiting for a worker
+#define RENDERD_QUEUE	64
+
+int renderd_queue[RENDERD_QUEUE];
+int renderd_queued=0;
+int renderd_head=0;
+pthread_mutex_t renderd_lock=PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t renderd_cond=PTHREAD_COND_INITIALIZER;
+
+char socketpath[512];
+char cachedir[512];
+
+
+// wav header with fixed-size fields
+typedef struct {
+  char chunkid[4];
+  u32 chunksize;
+  char format[4];
+  char sub1chunkid[4];
+  u32 sub1chunksize;
+  unsigned short audioformat;
+  unsigned short numchannels;
+  u32 samplerate;
+  u32 byterate;
+  unsigned short blockalign;
+  unsigned short bitspersample;
+  char sub2chunkid[4];
+  u32 sub2chunksize;
+} renderd_wavheader;
+
+
+static void renderd_wavinit(renderd_wavheader *w, u32 datalen)
+{
+  memcpy(w->chunkid, "RIFF", 4);
+  w->chunksize=36+datalen;
+  memcpy(w->format, "WAVE", 4);
+  memcpy(w->sub1chunkid, "fmt ", 4);
+  w->sub1chunksize=16;
+  w->audioformat=1;
+  w->numchannels=2;
+  w->samplerate=OUTPUTFREQ;
+  w->byterate=OUTPUTFREQ*2*2;
+  w->blockalign=2*2;
+  w->bitspersample=16;
+  memcpy(w->sub2chunkid, "data", 4);
+  w->sub2chunksize=datalen;
+}
+
+
+// read and write until all bytes are transferred. returns 0 on success
+static int renderd_read(int fd, void *buf, long len)
+{
+  long n;
+  unsigned char *p=buf;
+
+  while (len>0) {
+    n=read(fd, p, len);
+    if (n<0 && errno==EINTR) continue;
+    if (n<=0) return -1;
+    p+=n; len-=n;
+  }
+  return 0;
+}
+
+static int renderd_write(int fd, const void *buf, long len)
+{
+  long n;
+  const unsigned char *p=buf;
+
+  while (len>0) {
+    n=write(fd, p, len);
+    if (n<0 && errno==EINTR) continue;
+    if (n<=0) return -1;
+    p+=n; len-=n;
+  }
+  return 0;
+}
+
+
+static int renderd_address(struct sockaddr_un *addr)
+{
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family=AF_UNIX;
+  if (strlen(socketpath) >= sizeof(addr->sun_path)) {
+    fprintf(stderr, "socket path too long: %s\n", socketpath);
+    return -1;
+  }
+  strcpy(addr->sun_path, socketpath);
+  return 0;
+}
+
+
+static void renderd_respond(int fd, int status, int format, short *pcm, long frames)
+{
+  renderd_response r;
+  renderd_wavheader w;
+
+  memcpy(r.magic, RENDERD_RESPONSE, 4);
+  r.status=status;
+  r.length=0;
+  if (status==RENDERD_OK) {
+    r.length=frames*4;
+    if (format==RENDERD_FORMAT_WAV) r.length+=sizeof(renderd_wavheader);
+  }
+  if (renderd_write(fd, &r, sizeof(r))) return;
+  if (status!=RENDERD_OK) return;
+
+  if (format==RENDERD_FORMAT_WAV) {
+    renderd_wavinit(&w, frames*4);
+    if (renderd_write(fd, &w, sizeof(w))) return;
+  }
+  renderd_write(fd, pcm, frames*4);
+}
+
+
+
+
+//
+// cache
+//
+
+// loads a cached render. returns the buffer and sets frames, or NULL on a miss
+static short *renderd_cacheload(const char *path, long *frames)
+{
+  FILE *f;
+  long len;
+  short *pcm;
+
+  f=fopen(path, "rb");
+  if (!f) return NULL;
+  fseek(f, 0, SEEK_END);
+  len=ftell(f);
+  fseek(f, 0, SEEK_SET);
+  pcm=malloc(len>0 ? len : 1);
+  if (!pcm || fread(pcm, 1, len, f) != len) { free(pcm); fclose(f); return NULL; }
+  fclose(f);
+  *frames=len/4;
+  return pcm;
+}
+
+// store a render to the cache. written to a temporary file first so that
+// concurrent readers never see a partial file
+static void renderd_cachestore(const char *path, short *pcm, long frames)
+{
+  FILE *f;
+  char tmppath[640];
+  int ok;
+
+  snprintf(tmppath, sizeof(tmppath), "%s.%lu", path, (unsigned long)pthread_self());
+  f=fopen(tmppath, "wb");
+  if (!f) return;
+  ok=(fwrite(pcm, 4, frames, f)==frames);
+  if (fclose(f)) ok=0;
+  if (ok) rename(tmppath, path); else unlink(tmppath);
+}
+
+
+
+
+//
+// request handling
+//
+
+// print the messages the engine posted while rendering
+static void renderd_log(int flags, const char *msg)
+{
+  printf("renderd: %s\n", msg);
+}
+
+
+static void renderd_serve(int fd)
+{
+  renderd_request q;
+  unsigned char *song;
+  char path[600];
+  kengine *e;
+  short *pcm;
+  long frames;
+  u32 crc;
+  int r, songlen, measures;
+  unsigned int dropped;
+
+  if (renderd_read(fd, &q, sizeof(q))) return;
+  if (memcmp(q.magic, RENDERD_REQUEST, 4) || q.format>RENDERD_FORMAT_WAV || q.length>RENDERD_MAX_PAYLOAD) {
+    renderd_respond(fd, RENDERD_ERROR_REQUEST, 0, NULL, 0);
+    return;
+  }
+
+  song=malloc(q.length ? q.length : 1);
+  if (!song) { renderd_respond(fd, RENDERD_ERROR_MEMORY, 0, NULL, 0); return; }
+  if (renderd_read(fd, song, q.length)) { free(song); return; }
+
+  e=engine_new();
+  if (!e) { free(song); renderd_respond(fd, RENDERD_ERROR_MEMORY, 0, NULL, 0); return; }
+  r=engine_loadmem(e, song, q.length);
+  crc=engine_songcrc(song, q.length);
+  free(song);
+  if (r) { engine_free(e); renderd_respond(fd, r, 0, NULL, 0); return; }
+
+  // resolve the render range
+  songlen=engine_songlength(e);
+  measures=q.measures ? q.measures : songlen-(int)q.start;
+  if (q.start>=MAX_SONGLEN || measures<=0 || q.start+measures>MAX_SONGLEN) {
+    engine_free(e);
+    renderd_respond(fd, RENDERD_ERROR_RANGE, 0, NULL, 0);
+    return;
+  }
+
+  // the same song, range and engine version always renders to the same audio
+  snprintf(path, sizeof(path), "%s/%08x-v%d-%u-%d.raw", cachedir, crc, ENGINE_VERSION, q.start, measures);
+  pcm=renderd_cacheload(path, &frames);
+  if (pcm) {
+    printf("renderd: cache hit %s\n", path);
+  } else {
+    frames=engine_start(e, q.start, measures);
+    pcm=(frames<0) ? NULL : malloc(frames*4);
+    if (!pcm) { engine_free(e); renderd_respond(fd, RENDERD_ERROR_MEMORY, 0, NULL, 0); return; }
+    engine_render(e, pcm, frames);
+    renderd_cachestore(path, pcm, frames);
+    printf("renderd: rendered %s (%ld frames)\n", path, frames);
+  }
+  engine_free(e);
+  rtlog_drain(renderd_log);
+  dropped=rtlog_dropped();
+  if (dropped) printf("renderd: %u engine messages dropped\n", dropped);
+
+  renderd_respond(fd, RENDERD_OK, q.format, pcm, frames);
+  free(pcm);
+}
+
+
+static void *renderd_worker(void *param)
+{
+  int fd;
+
+  for(;;) {
+    pthread_mutex_lock(&renderd_lock);
+    while (!renderd_queued) pthread_cond_wait(&renderd_cond, &renderd_lock);
+    fd=renderd_queue[renderd_head];
+    renderd_head=(renderd_head+1)%RENDERD_QUEUE;
+    renderd_queued--;
+    pthread_mutex_unlock(&renderd_lock);
+
+    renderd_serve(fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+
+static int renderd_listen(int threads)
+{
+  struct sockaddr_un addr;
+  pthread_t tid;
+  int s, fd, i;
+
+  if (renderd_address(&addr)) return 1;
+  s=socket(AF_UNIX, SOCK_STREAM, 0);
+  if (s<0) { perror("socket"); return 1; }
+  unlink(socketpath);
+  if (bind(s, (struct sockaddr*)&addr, sizeof(addr))) { perror("bind"); return 1; }
+  if (listen(s, RENDERD_QUEUE)) { perror("listen"); return 1; }
+
+  for(i=0;i<threads;i++) {
+    if (pthread_create(&tid, NULL, renderd_worker, NULL)) { perror("pthread_create"); return 1; }
+    pthread_detach(tid);
+  }
+  printf("renderd: listening on %s with %d threads, cache in %s\n", socketpath, threads, cachedir);
+
+  for(;;) {
+    fd=accept(s, NULL, NULL);
+    if (fd<0) { if (errno!=EINTR) perror("accept"); continue; }
+
+    pthread_mutex_lock(&renderd_lock);
+    if (renderd_queued==RENDERD_QUEUE) {
+      pthread_mutex_unlock(&renderd_lock);
+      close(fd); // too busy, client sees a dropped connection
+      continue;
+    }
+    renderd_queue[(renderd_head+renderd_queued)%RENDERD_QUEUE]=fd;
+    renderd_queued++;
+    pthread_cond_signal(&renderd_cond);
+    pthread_mutex_unlock(&renderd_lock);
+  }
+  return 0;
+}
+
+
+
+
+//
+// client mode for build scripts
+//
+
+static int renderd_client(const char *songfile, const char *outfile, int format, int start, int measures)
+{
+  struct sockaddr_un addr;
+  renderd_request q;
+  renderd_response r;
+  unsigned char *buf;
+  long len;
+  FILE *f;
+  int s;
+
+  f=fopen(songfile, "rb");
+  if (!f) { perror(songfile); return 1; }
+  fseek(f, 0, SEEK_END);
+  len=ftell(f);
+  fseek(f, 0, SEEK_SET);
+  buf=malloc(len);
+  if (!buf || fread(buf, 1, len, f)!=len) { fprintf(stderr, "failed to read %s\n", songfile); return 1; }
+  fclose(f);
+
+  if (renderd_address(&addr)) return 1;
+  s=socket(AF_UNIX, SOCK_STREAM, 0);
+  if (s<0 || connect(s, (struct sockaddr*)&addr, sizeof(addr))) { perror(socketpath); return 1; }
+
+  memcpy(q.magic, RENDERD_REQUEST, 4);
+  q.format=format;
+  q.start=start;
+  q.measures=measures;
+  q.length=len;
+  if (renderd_write(s, &q, sizeof(q)) || renderd_write(s, buf, len)) { perror("write"); return 1; }
+  free(buf);
+
+  if (renderd_read(s, &r, sizeof(r)) || memcmp(r.magic, RENDERD_RESPONSE, 4)) {
+    fprintf(stderr, "no response from %s\n", socketpath);
+    return 1;
+  }
+  if (r.status!=RENDERD_OK) { fprintf(stderr, "render failed with status %u\n", r.status); return 1; }
+
+  buf=malloc(r.length ? r.length : 1);
+  if (!buf || renderd_read(s, buf, r.length)) { fprintf(stderr, "truncated response\n"); return 1; }
+  close(s);
+
+  f=outfile ? fopen(outfile, "wb") : stdout;
+  if (!f) { perror(outfile); return 1; }
+  if (fwrite(buf, 1, r.length, f)!=r.length) { perror("fwrite"); return 1; }
+  if (outfile) fclose(f);
+  free(buf);
+  return 0;
+}
+
+
+
+
+static void usage(void)
+{
+  fprintf(stderr,
+    "usage: komposter-renderd [-S socket] [-d cachedir] [-j threads]\n"
+    "       komposter-renderd [-S socket] -c song.ksong [-o output] [-w] [-s start] [-m measures]\n"
+    "\n"
+    "  -S  unix socket path (default ~/.komposter-renderd.sock)\n"
+    "  -d  cache directory (default ~/.komposter-cache)\n"
+    "  -j  number of render threads (default is one per cpu)\n"
+    "  -c  send a song to a running daemon and write the result\n"
+    "  -o  output file for -c (default stdout)\n"
+    "  -w  output a wav file instead of raw 16-bit stereo pcm\n"
+    "  -s  first measure to render (default 0)\n"
+    "  -m  number of measures to render (default until end of song)\n");
+}
+
+
+int main(int argc, char **argv)
+{
+  char *home, *songfile=NULL, *outfile=NULL;
+  int c, threads, format=RENDERD_FORMAT_PCM, start=0, measures=0;
+
+  home=getenv("HOME");
+  if (!home) home=".";
+  snprintf(socketpath, sizeof(socketpath), "%s/.komposter-renderd.sock", home);
+  snprintf(cachedir, sizeof(cachedir), "%s/.komposter-cache", home);
+  threads=sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads<1) threads=1;
+
+  while ((c=getopt(argc, argv, "S:d:j:c:o:ws:m:h"))!=-1) {
+    switch(c) {
+      case 'S': strncpy(socketpath, optarg, sizeof(socketpath)-1); break;
+      case 'd': strncpy(cachedir, optarg, sizeof(cachedir)-1); break;
+      case 'j': threads=atoi(optarg); if (threads<1) threads=1; break;
+      case 'c': songfile=optarg; break;
+      case 'o': outfile=optarg; break;
+      case 'w': format=RENDERD_FORMAT_WAV; break;
+      case 's': start=atoi(optarg); break;
+      case 'm': measures=atoi(optarg); break;
+      default: usage(); return 1;
+    }
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  if (songfile) return renderd_client(songfile, outfile, format, start, measures);
+
+  mkdir(cachedir, 0755);
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  return renderd_listen(threads);
+}
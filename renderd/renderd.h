@@ -0,0 +1,55 @@
+/*
+ * Komposter
+ *
+ * Copyright (c) 2010 Noora Halme et al. (see AUTHORS)
+ *
+ * This code is licensed under the GNU General Public
+ * License version 2. See LICENSE for full text.
+ *
+ * Render daemon socket protocol
+ *
+ */
+
+#ifndef __RENDERD_H__
+#define __RENDERD_H__
+
+#include "engine.h"
+
+/*
+  a client connects to the unix socket, sends one request header
+  followed by the .ksong file image and reads back one response header
+  followed by the rendered audio. all fields are little-endian dwords.
+  the connection is closed after each request.
+*/
+
+#define RENDERD_REQUEST		"KRDQ"
+#define RENDERD_RESPONSE	"KRDR"
+
+// output formats, both 16-bit stereo at OUTPUTFREQ
+#define RENDERD_FORMAT_PCM	0
+#define RENDERD_FORMAT_WAV	1
+
+// response status codes. 1-5 are the FILE_ERROR_* codes from loading the song
+#define RENDERD_OK		0
+#define RENDERD_ERROR_REQUEST	16 // bad magic, format or payload size
+#define RENDERD_ERROR_RANGE	17 // render range outside the song
+#define RENDERD_ERROR_MEMORY	18
+
+// largest .ksong accepted
+#define RENDERD_MAX_PAYLOAD	(16*1024*1024)
+
+typedef struct {
+  char magic[4];
+  u32 format;
+  u32 start;	// first measure to render
+  u32 measures;	// number of measures, 0 to render until end of song
+  u32 length;	// size of the .ksong image following the header
+} renderd_request;
+
+typedef struct {
+  char magic[4];
+  u32 status;
+  u32 length;	// bytes of audio following the header
+} renderd_response;
+
+#endif
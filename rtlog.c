@@ -0,0 +1,99 @@
+/*
+ * Komposter
+ *
+ * Copyright (c) 2010 Noora Halme et al. (see AUTHORS)
+ *
+ * This code is licensed under the GNU General Public
+ * License version 2. See LICENSE for full text.
+ *
+ * Log messages from the audio threads
+ *
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include "rtlog.h"
+
+/*
+  the audio threads can't write to the terminal without risking a
+  dropout, so they post messages to a ring of fixed size records
+  instead and the ui thread prints them out later.
+
+  any number of threads may post. a thread claims a record by moving
+  the tail with compare-and-swap, formats the message into it and then
+  publishes it by setting the sequence number of the record. the
+  drain reads records in order until it reaches one that hasn't been
+  published yet, and hands each record back to the posters by moving
+  its sequence number a lap forward.
+*/
+
+typedef struct {
+  unsigned int seq;
+  int flags;
+  char msg[RTLOG_MSGLEN];
+} rtlog_entry;
+
+static rtlog_entry rtlog_ring[RTLOG_ENTRIES];
+static unsigned int rtlog_tail=0;
+static unsigned int rtlog_head=0;
+static unsigned int rtlog_drops=0;
+static pthread_mutex_t rtlog_lock=PTHREAD_MUTEX_INITIALIZER;
+
+
+void rtlog(int flags, const char *fmt, ...)
+{
+  unsigned int tail, seq;
+  rtlog_entry *r;
+  va_list ap;
+
+  tail=__atomic_load_n(&rtlog_tail, __ATOMIC_RELAXED);
+  for(;;) {
+    r=&rtlog_ring[tail&(RTLOG_ENTRIES-1)];
+    seq=__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE)+(tail&(RTLOG_ENTRIES-1));
+    if (seq==tail) {
+      // free, try to claim it
+      if (__atomic_compare_exchange_n(&rtlog_tail, &tail, tail+1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    } else if ((int)(seq-tail) < 0) {
+      // not drained yet, the log is full
+      __atomic_fetch_add(&rtlog_drops, 1, __ATOMIC_RELAXED);
+      return;
+    } else {
+      // claimed by another thread in between
+      tail=__atomic_load_n(&rtlog_tail, __ATOMIC_RELAXED);
+    }
+  }
+
+  r->flags=flags;
+  va_start(ap, fmt);
+  vsnprintf(r->msg, RTLOG_MSGLEN, fmt, ap);
+  va_end(ap);
+  __atomic_store_n(&r->seq, (tail&~(RTLOG_ENTRIES-1))+1, __ATOMIC_RELEASE);
+}
+
+
+int rtlog_drain(void (*out)(int flags, const char *msg))
+{
+  rtlog_entry *r;
+  unsigned int lap;
+  int n=0;
+
+  if (pthread_mutex_trylock(&rtlog_lock)) return 0;
+  for(;;) {
+    r=&rtlog_ring[rtlog_head&(RTLOG_ENTRIES-1)];
+    lap=rtlog_head&~(RTLOG_ENTRIES-1);
+    if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE)!=lap+1) break;
+    out(r->flags, r->msg);
+    __atomic_store_n(&r->seq, lap+RTLOG_ENTRIES, __ATOMIC_RELEASE);
+    rtlog_head++;
+    n++;
+  }
+  pthread_mutex_unlock(&rtlog_lock);
+  return n;
+}
+
+
+unsigned int rtlog_dropped(void)
+{
+  return __atomic_exchange_n(&rtlog_drops, 0, __ATOMIC_RELAXED);
+}
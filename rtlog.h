@@ -0,0 +1,37 @@
+/*
+ * Komposter
+ *
+ * Copyright (c) 2010 Noora Halme et al. (see AUTHORS)
+ *
+ * This code is licensed under the GNU General Public
+ * License version 2. See LICENSE for full text.
+ *
+ * Log messages from the audio threads
+ *
+ */
+
+#ifndef __RTLOG_H__
+#define __RTLOG_H__
+
+// number of messages held until drained, must be a power of two
+#define RTLOG_ENTRIES	256
+
+// longest message, including the terminating zero
+#define RTLOG_MSGLEN	120
+
+// flags for messages
+#define RTLOG_CONSOLE	1 // also show on the editor console
+
+// post a message without blocking. if the log is full the message is
+// dropped and counted
+void rtlog(int flags, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// pass the posted messages in order to out. safe to call from several
+// threads, but only one of them drains at a time and the others return
+// at once. returns the number of messages passed
+int rtlog_drain(void (*out)(int flags, const char *msg));
+
+// messages dropped since the last call
+unsigned int rtlog_dropped(void);
+
+#endif
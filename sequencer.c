@@ -139,9 +139,6 @@ int seq_patch[MAX_CHANNELS][MAX_SONGLEN];
 // from main
 extern int cpage;
 
-// from modules.c
-extern int gate[MAX_SYNTH];
-
 // from pattern.c
 extern unsigned int pattlen[MAX_PATTERN];
 extern int cpatch[MAX_SYNTH];
@@ -449,12 +446,11 @@ void sequencer_mouse_click(int button, int state, int x, int y)
       if (seq_ui[B_NEWSONG]&1) {
         if (seq_ui[B_NEWSONG]&8) {
           // wipe everything
-          synth_lockaudio();
           for(i=0;i<MAX_SYNTH;i++) synth_clear(i);
           patch_init();
           pattern_init();
           sequencer_clearsong();
-          synth_releaseaudio();
+          audio_songchanged();
           console_post("Song cleared and everything reset back to defaults");
           seq_ui[B_NEWSONG]&=0xff-8;
         } else {
@@ -467,8 +463,8 @@ void sequencer_mouse_click(int button, int state, int x, int y)
       }
 
       // test ui elements      
-      if (seq_ui[B_DECCH]) { if (seqch>2) seqch--; return; }
-      if (seq_ui[B_ADDCH]) { if (seqch<MAX_CHANNELS) seqch++; return; }
+      if (seq_ui[B_DECCH]) { if (seqch>2) { seqch--; audio_songchanged(); } return; }
+      if (seq_ui[B_ADDCH]) { if (seqch<MAX_CHANNELS) { seqch++; audio_songchanged(); } return; }
 /*
       if (seq_ui[B_BPMDN]) { if (bpm>0) synth_update_bpm(bpm-1); return; }
       if (seq_ui[B_BPMUP]) { if (bpm<255) synth_update_bpm(bpm+1); return; }
@@ -478,8 +474,8 @@ void sequencer_mouse_click(int button, int state, int x, int y)
         dialog_bindkeyboard(&sequencer_bpm_keyboard);
         return;
       }
-      if (seq_ui[B_SSHORTER]) { if (seqsonglen>1) seqsonglen--; return; }
-      if (seq_ui[B_SLONGER]) { if (seqsonglen<(MAX_SONGLEN-1)) seqsonglen++; return; }
+      if (seq_ui[B_SSHORTER]) { if (seqsonglen>1) { seqsonglen--; audio_songchanged(); } return; }
+      if (seq_ui[B_SLONGER]) { if (seqsonglen<(MAX_SONGLEN-1)) { seqsonglen++; audio_songchanged(); } return; }
 
       if (seq_ui[B_CLEAR]) { if (!seq_playing) { seq_render_start=0; seq_render_end=0; } return; }
       if (seq_ui[B_REWIND]) {
@@ -558,6 +554,7 @@ void sequencer_mouse_click(int button, int state, int x, int y)
            seq_repeat[seq_hover_ch][j]=1;
            seq_transpose[seq_hover_ch][j]=0;
            seq_patch[seq_hover_ch][j]=0;
+           audio_songchanged();
           } else {
             //start dragging it
             seq_drag_active=1;
@@ -615,6 +612,7 @@ void sequencer_mouse_click(int button, int state, int x, int y)
           seq_patch[seq_drag_pattch][j]=seq_patch[seq_drag_pattch][seq_drag_pattstart];          
           seq_pattern[seq_drag_pattch][seq_drag_pattstart]=-1;
           for(i=1;i<pl;i++) seq_pattern[seq_drag_pattch][j+i]=-1;
+          audio_songchanged();
           i=sequencer_cursorpos(x, y, &seq_hover_ch, &seq_hover_meas); // extra hovercheck to move the cursor as well
         } else {
           // pattern was clicked but not dragged anywhere - jump to pattern page and select the pattern
@@ -671,6 +669,7 @@ void sequencer_mouse_click(int button, int state, int x, int y)
       // right click on channel label
       if (seq_chlabel_hover>=0 && seq_chlabel_hover<255) {
           seq_mute[seq_chlabel_hover]^=1; // toggle channel mute
+          audio_songchanged();
           return;
       }
       
@@ -1189,6 +1188,7 @@ void sequencer_pattern_click(int button, int state, int x, int y)
         seq_repeat[seq_hover_ch][seq_hover_meas]=seq_add_repeat;
         seq_transpose[seq_hover_ch][seq_hover_meas]=seq_add_transpose;
         seq_patch[seq_hover_ch][seq_hover_meas]=seq_add_patch;
+        audio_songchanged();
         
         dialog_close();
         return;
@@ -1255,7 +1255,6 @@ void sequencer_channel_hover(int x, int y)
 void sequencer_channel_click(int button, int state, int x, int y)
 {
   if (state==GLUT_DOWN && !hovertest_box(x,y,(DS_WIDTH/2),(DS_HEIGHT/2),150,240 )) {
-    kmm_gcollect();
     dialog_close();
     return;
   }
@@ -1264,24 +1263,20 @@ void sequencer_channel_click(int button, int state, int x, int y)
     if (state==GLUT_DOWN) {
       if (seq_ui[B_CHAN_NEXTSYNTH]) { 
         if (seq_synth[seq_chlabel_hover]<MAX_SYNTH) {
-          synth_lockaudio();
           seq_synth[seq_chlabel_hover]++;
-          kmm_gcollect();
-          synth_releaseaudio();
+          audio_songchanged();
         }
       }
       if (seq_ui[B_CHAN_PREVSYNTH]) {
         if (seq_synth[seq_chlabel_hover]>0) {
-          synth_lockaudio();
           seq_synth[seq_chlabel_hover]--;
-          kmm_gcollect();
-          synth_releaseaudio();
+          audio_songchanged();
         }
       }
       
-      if (seq_ui[B_ENVRESTART]&1) seq_restart[seq_chlabel_hover]^=SEQ_RESTART_ENV;
-      if (seq_ui[B_VCORESTART]&1) seq_restart[seq_chlabel_hover]^=SEQ_RESTART_VCO;
-      if (seq_ui[B_LFORESTART]&1) seq_restart[seq_chlabel_hover]^=SEQ_RESTART_LFO;
+      if (seq_ui[B_ENVRESTART]&1) { seq_restart[seq_chlabel_hover]^=SEQ_RESTART_ENV; audio_songchanged(); }
+      if (seq_ui[B_VCORESTART]&1) { seq_restart[seq_chlabel_hover]^=SEQ_RESTART_VCO; audio_songchanged(); }
+      if (seq_ui[B_LFORESTART]&1) { seq_restart[seq_chlabel_hover]^=SEQ_RESTART_LFO; audio_songchanged(); }
 
       sequencer_channel_hover(x,y);      
       return;
@@ -1289,7 +1284,6 @@ void sequencer_channel_click(int button, int state, int x, int y)
   }
 
   if (button==GLUT_RIGHT_BUTTON && hovertest_box(x,y,(DS_WIDTH/2),(DS_HEIGHT/2),150,240 )) {
-    kmm_gcollect();
     dialog_close(); return; 
   }
 }
@@ -1298,7 +1292,6 @@ void sequencer_channel_click(int button, int state, int x, int y)
 void sequencer_channel_keyboard(unsigned char key, int x, int y)
 {
   if (key==27) {
-    kmm_gcollect();
     dialog_close(); return; 
   }  
 }    
@@ -1576,7 +1569,6 @@ void sequencer_file_checkstate(void)
         }
       }
       if (songfd_active==FD_LOAD) {
-        synth_lockaudio();
         r=load_ksong(fn);
         if (r) {
           console_post("Error while loading song!");
@@ -1595,7 +1587,7 @@ void sequencer_file_checkstate(void)
           seq_render_end=0;
           console_post("Song loaded successfully from disk!");
         }
-        synth_releaseaudio();
+        audio_songchanged();
       }
       // use this as the new song path
       dotfile_setvalue("songFileDir", (char*)&songfd[songfd_active].cpath);
@@ -1747,6 +1739,5 @@ void sequencer_bpm_close_dialog() {
     synth_update_bpm(sequencer_bpm_convert());
   bpm_kbfocus&=0x03;
   glutIgnoreKeyRepeat(1);
-  kmm_gcollect();
   dialog_close();
 }
\ No newline at end of file
@@ -19,16 +19,13 @@
 #include "buffermm.h"
 #include "constants.h"
 #include "dialog.h"
+#include "engine.h"
 #include "font.h"
 #include "patch.h"
+#include "pattern.h"
 #include "synthesizer.h"
 #include "widgets.h"
 
-// channel restart flags in seq
-#define SEQ_RESTART_ENV	1
-#define	SEQ_RESTART_VCO	2
-#define SEQ_RESTART_LFO	4
-
 
 void sequencer_init();
 
@@ -32,7 +32,6 @@
 #define SQR(X) X*X
 
 // from audio.c
-extern int audio_spinlock;
 extern int audiomode;
 
 // from patch.c
@@ -70,22 +69,6 @@ char synth_label_text[65];
 int synth_label_kbfocus;
 
 
-// wait for audio spin lock to go down and mute the audio
-void synth_lockaudio(void)
-{
-  // a potential race condition here - be careful. :)
-  while (audio_spinlock) usleep(5);
-  audiomode=AUDIOMODE_MUTE;
-}
-
-
-// resume the audio playback
-void synth_releaseaudio(void)
-{
-  audiomode=AUDIOMODE_COMPOSING;
-}
-
-
 void synth_init(void)
 {
  int s,m,n;
@@ -116,7 +99,6 @@ void synth_init(void)
 
   // just to be sure when re-initializing
   synth_stackify(csynth);
-  kmm_gcollect();
   
   // no dialogs visible
   fd_active=-1;
@@ -145,7 +127,6 @@ void synth_clear(int csyn)
   strcpy((char*)(&synthname[csyn]), "Unnamed synthesizer");
   mod[csyn][m].outputpos=0;
   synth_stackify(csyn);
-  kmm_gcollect();
 }
 
 
@@ -352,10 +333,8 @@ void synth_mouse_click(int button, int state, int x, int y)
       if (m==GLUT_ACTIVE_SHIFT) {
         if ((m=getactive(&mod[csynth][0],MAX_MODULES)) >=0 ) {
           // todo: maybe a confirmation first?
-          synth_lockaudio();
           if (m>2) synth_deletemodule(m);
           synth_stackify(csynth); // re-arrange signal stack
-          synth_releaseaudio();
         }
         return;
       }
@@ -365,9 +344,7 @@ void synth_mouse_click(int button, int state, int x, int y)
 
       if (synth_ui[B_CLEAR]&1) {
         if (synth_ui[B_CLEAR]&8) {
-          synth_lockaudio();
           synth_clear(csynth);
-          synth_releaseaudio();
           sprintf(tmps, "Synthesizer %02d cleared and reset to defaults", csynth);
           console_post(tmps);
           synth_ui[B_CLEAR]&=0xff-8;
@@ -383,21 +360,15 @@ void synth_mouse_click(int button, int state, int x, int y)
       // test clicks to ui elements
       if (synth_ui[B_PREV]) { // select previous synth to voice 0
         if (csynth>0) {
-          synth_lockaudio();
           csynth--;
           synth_stackify(csynth);
-          kmm_gcollect();
-          synth_releaseaudio();
           return;
         }
       }
       if (synth_ui[B_NEXT]) { 
         if (csynth<(MAX_SYNTH-1)) {
-          synth_lockaudio();
           csynth++; 
           synth_stackify(csynth); 
-          kmm_gcollect(); 
-          synth_releaseaudio();
           return; 
         }
       }
@@ -462,7 +433,6 @@ void synth_mouse_click(int button, int state, int x, int y)
       if (signaldrag>=0) {
         // make a patch between the modules if dropped to an input
         if ((m=getactivein(&mod[csynth][0],MAX_MODULES)) >=0 ) {
-          synth_lockaudio();
           // make a patch
           mod[csynth][m].input[mod[csynth][m].inpactive]=signaldrag;
           sprintf(tmps, "Signal from %s patched to %s(%s)!\n",
@@ -483,7 +453,6 @@ void synth_mouse_click(int button, int state, int x, int y)
               mod[csynth][signaldrag].scale=modInputScale[mod[csynth][m].type][mod[csynth][m].inpactive];
           }
           synth_stackify(csynth); // re-arrange signal stack for new route
-          synth_releaseaudio();
         }
         signaldrag=-1;
         // re-set active flags
@@ -671,7 +640,7 @@ void synth_addmodule(int type)
       mod[csynth][m].x=bmi;
       mod[csynth][m].y=bmj;
 
-      kmm_gcollect();
+      audio_patchchanged(1);
       
       sprintf(tmps, "Added module %s", modTypeNames[type]);
       console_post(tmps);
@@ -694,7 +663,7 @@ void synth_deletemodule(int m)
   for (i=0;i<MAX_MODULES;i++)
     for(j=0;j<4;j++)
       if (mod[csynth][i].input[j]==m) mod[csynth][i].input[j]=-1;
-  kmm_gcollect();
+  audio_patchchanged(1);
 }
 
 void synth_draw_addmodule(void)
@@ -807,7 +776,6 @@ void synth_file_checkstate(void)
         }
       }
       if (fd_active==FD_LOAD) {
-        synth_lockaudio();
         f=fopen(fn, "rb");
         if (f) {
           synth_clear(csynth);
@@ -830,8 +798,6 @@ void synth_file_checkstate(void)
         } else {
           console_post("Unable to open file for reading!");
         }
-        kmm_gcollect();
-        synth_releaseaudio();
       }
       // use this as the new synth path
       dotfile_setvalue("synthFileDir", (char*)&fd[fd_active].cpath);
@@ -33,8 +33,6 @@
 #include "widgets.h"
 //#include "synthesizer_file.h"
 
-void synth_lockaudio(void);
-void synth_releaseaudio(void);
 
 void synth_clear(int csyn);
 